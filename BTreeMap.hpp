@@ -0,0 +1,1088 @@
+#ifndef BTREE_MAP_HPP
+#define BTREE_MAP_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "BTreeMapIterator.hpp"
+#include "BTreeMapNode.hpp"
+#include "RBTreeSimd.hpp"
+
+namespace demidenko
+{
+  // B+ tree with the interface of RBTree: entries live in linked leaves of a few cache lines,
+  // so a lookup touches O(log n / log B) nodes instead of O(log n).
+  // Iterators and references are invalidated by insertions and erasures, as in any B-tree.
+  template < class K,
+    class T,
+    class Compare = std::less< K >,
+    class Allocator = std::allocator< std::pair< const K, T > > >
+  class BTreeMap
+  {
+    using Capacity = detail::BTreeCapacity< K, T >;
+    using NodeBase = detail::BTreeNodeBase;
+    using Leaf = detail::BTreeLeaf< K, T, Capacity::LEAF >;
+    using Inner = detail::BTreeInner< K, Capacity::INNER >;
+    static_assert(std::is_nothrow_move_constructible< K >::value && std::is_nothrow_move_assignable< K >::value,
+      "Inner nodes shift their keys with moves that must not throw");
+
+  public:
+    using iterator = BTreeMapIterator< Leaf, false >;
+    using const_iterator = BTreeMapIterator< Leaf, true >;
+    using value_type = typename iterator::value_type;
+    using key_type = const K;
+    using mapped_type = T;
+    using allocator_type = Allocator;
+
+    BTreeMap():
+      root_(nullptr),
+      height_(0),
+      size_(0),
+      compare_({}),
+      alloc_(),
+      innerAlloc_(innerAllocatorFor(alloc_))
+    {}
+    BTreeMap(Compare compare, const Allocator& alloc = Allocator()):
+      root_(nullptr),
+      height_(0),
+      size_(0),
+      compare_(compare),
+      alloc_(alloc),
+      innerAlloc_(innerAllocatorFor(alloc_))
+    {}
+    explicit BTreeMap(const Allocator& alloc):
+      root_(nullptr),
+      height_(0),
+      size_(0),
+      compare_({}),
+      alloc_(alloc),
+      innerAlloc_(innerAllocatorFor(alloc_))
+    {}
+    BTreeMap(const BTreeMap< K, T, Compare, Allocator >& src):
+      BTreeMap(src, LeafTraits::select_on_container_copy_construction(src.alloc_))
+    {}
+    BTreeMap(const BTreeMap< K, T, Compare, Allocator >& src, const Allocator& alloc):
+      root_(nullptr),
+      height_(0),
+      size_(0),
+      compare_(src.compare_),
+      alloc_(alloc),
+      innerAlloc_(innerAllocatorFor(alloc_))
+    {
+      if (src.root_)
+      {
+        Leaf* last = nullptr;
+        root_ = copyNode(src.root_, src.height_, last);
+        height_ = src.height_;
+        size_ = src.size_;
+      }
+    }
+    BTreeMap(BTreeMap< K, T, Compare, Allocator >&& src) noexcept:
+      root_(src.root_),
+      height_(src.height_),
+      size_(src.size_),
+      compare_(std::move(src.compare_)),
+      alloc_(std::move(src.alloc_)),
+      innerAlloc_(std::move(src.innerAlloc_))
+    {
+      src.root_ = nullptr;
+      src.height_ = 0;
+      src.size_ = 0;
+    }
+    BTreeMap< K, T, Compare, Allocator >& operator=(const BTreeMap< K, T, Compare, Allocator >& src)
+    {
+      constexpr bool propagate = LeafTraits::propagate_on_container_copy_assignment::value;
+      BTreeMap< K, T, Compare, Allocator > newMap(src, propagate ? LeafAllocator(src.alloc_) : alloc_);
+      swapContents(newMap);
+      std::swap(alloc_, newMap.alloc_);
+      return *this;
+    }
+    BTreeMap< K, T, Compare, Allocator >& operator=(BTreeMap< K, T, Compare, Allocator >&& src) noexcept(
+      LeafTraits::propagate_on_container_move_assignment::value || LeafTraits::is_always_equal::value)
+    {
+      if constexpr (!LeafTraits::propagate_on_container_move_assignment::value)
+      {
+        if (alloc_ != src.alloc_)
+        {
+          return *this = static_cast< const BTreeMap< K, T, Compare, Allocator >& >(src);
+        }
+      }
+      swapContents(src);
+      if constexpr (LeafTraits::propagate_on_container_move_assignment::value)
+      {
+        std::swap(alloc_, src.alloc_);
+      }
+      return *this;
+    }
+    virtual ~BTreeMap()
+    {
+      clear();
+    }
+    allocator_type get_allocator() const
+    {
+      return allocator_type(alloc_);
+    }
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+    void clear() noexcept
+    {
+      if (root_)
+      {
+        destroySubtree(root_, height_);
+      }
+      root_ = nullptr;
+      height_ = 0;
+      size_ = 0;
+    }
+    T& operator[](const K& key)
+    {
+      return insertUnique(key, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple())
+        .first->second;
+    }
+    T& operator[](K&& key)
+    {
+      return insertUnique(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple())
+        .first->second;
+    }
+    T& at(const K& key)
+    {
+      return atEntry(key).second;
+    }
+    const T& at(const K& key) const
+    {
+      return atEntry(key).second;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    T& at(const Key& key)
+    {
+      return atEntry(key).second;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const T& at(const Key& key) const
+    {
+      return atEntry(key).second;
+    }
+    int count(const K& key) const
+    {
+      return findEqual(key).leaf != nullptr;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    int count(const Key& key) const
+    {
+      return findEqual(key).leaf != nullptr;
+    }
+    iterator find(const K& key)
+    {
+      return toIterator(findEqual(key));
+    }
+    const_iterator find(const K& key) const
+    {
+      return toIterator(findEqual(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    iterator find(const Key& key)
+    {
+      return toIterator(findEqual(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator find(const Key& key) const
+    {
+      return toIterator(findEqual(key));
+    }
+    iterator lowerBound(const K& key)
+    {
+      return toIterator(findBound< false >(key));
+    }
+    const_iterator lowerBound(const K& key) const
+    {
+      return toIterator(findBound< false >(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    iterator lowerBound(const Key& key)
+    {
+      return toIterator(findBound< false >(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator lowerBound(const Key& key) const
+    {
+      return toIterator(findBound< false >(key));
+    }
+    iterator upperBound(const K& key)
+    {
+      return toIterator(findBound< true >(key));
+    }
+    const_iterator upperBound(const K& key) const
+    {
+      return toIterator(findBound< true >(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    iterator upperBound(const Key& key)
+    {
+      return toIterator(findBound< true >(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator upperBound(const Key& key) const
+    {
+      return toIterator(findBound< true >(key));
+    }
+    std::pair< iterator, iterator > equalRange(const K& key)
+    {
+      iterator first = lowerBound(key);
+      return { first, (first != end() && !compare_(key, first->first)) ? std::next(first) : first };
+    }
+    std::pair< const_iterator, const_iterator > equalRange(const K& key) const
+    {
+      const_iterator first = lowerBound(key);
+      return { first, (first != end() && !compare_(key, first->first)) ? std::next(first) : first };
+    }
+    // Number of keys in [lo, hi), O(log n + k).
+    std::size_t countInRange(const K& lo, const K& hi) const
+    {
+      std::size_t result = 0;
+      forEachInRange(lo, hi, [&](const value_type&) {
+        ++result;
+      });
+      return result;
+    }
+    // Bulk traversals walk the leaf chain and never go back up the tree.
+    template < class F >
+    void forEach(F&& f)
+    {
+      visitLeaves< false >(firstLeaf(), 0, f);
+    }
+    template < class F >
+    void forEach(F&& f) const
+    {
+      visitLeaves< false >(firstLeaf(), 0, [&](const value_type& value) {
+        f(value);
+        return true;
+      });
+    }
+    template < class F >
+    void forEachReverse(F&& f)
+    {
+      visitLeaves< true >(lastLeaf(), 0, f);
+    }
+    template < class F >
+    void forEachReverse(F&& f) const
+    {
+      visitLeaves< true >(lastLeaf(), 0, [&](const value_type& value) {
+        f(value);
+        return true;
+      });
+    }
+    // Calls f for every element with a key in [lo, hi), in order.
+    template < class F >
+    void forEachInRange(const K& lo, const K& hi, F&& f)
+    {
+      Position start = findBound< false >(lo);
+      visitLeaves< false >(start.leaf, start.index, [&](value_type& value) {
+        if (!compare_(value.first, hi))
+        {
+          return false;
+        }
+        f(value);
+        return true;
+      });
+    }
+    template < class F >
+    void forEachInRange(const K& lo, const K& hi, F&& f) const
+    {
+      Position start = findBound< false >(lo);
+      visitLeaves< false >(start.leaf, start.index, [&](const value_type& value) {
+        if (!compare_(value.first, hi))
+        {
+          return false;
+        }
+        f(value);
+        return true;
+      });
+    }
+    bool insert(const K& key, const T& value)
+    {
+      return insertUnique(key, key, value).second;
+    }
+    // The hint is only taken for interface parity with RBTree: a descent is a handful of nodes anyway.
+    iterator insert(const_iterator, const K& key, const T& value)
+    {
+      return insertUnique(key, key, value).first;
+    }
+    template < class... Args >
+    std::pair< iterator, bool > emplace(Args&&... args)
+    {
+      value_type value(std::forward< Args >(args)...);
+      return insertUnique(value.first, std::move(value));
+    }
+    template < class... Args >
+    iterator emplaceHint(const_iterator, Args&&... args)
+    {
+      return emplace(std::forward< Args >(args)...).first;
+    }
+    template < class... Args >
+    std::pair< iterator, bool > tryEmplace(const K& key, Args&&... args)
+    {
+      return insertUnique(key,
+        std::piecewise_construct,
+        std::forward_as_tuple(key),
+        std::forward_as_tuple(std::forward< Args >(args)...));
+    }
+    template < class... Args >
+    std::pair< iterator, bool > tryEmplace(K&& key, Args&&... args)
+    {
+      return insertUnique(key,
+        std::piecewise_construct,
+        std::forward_as_tuple(std::move(key)),
+        std::forward_as_tuple(std::forward< Args >(args)...));
+    }
+    bool erase(const K& key)
+    {
+      if (!root_)
+      {
+        return false;
+      }
+      PathStep path[MAX_HEIGHT];
+      Leaf* leaf = descend(key, path);
+      std::size_t index = leafBound< false >(leaf, key);
+      if (index == leaf->count || compare_(key, leaf->entry(index).first))
+      {
+        return false;
+      }
+      eraseAt(path, leaf, index);
+      --size_;
+      return true;
+    }
+    // Checks ordering, separators, occupancy, equal leaf depth and the leaf chain.
+    bool isBTree() const
+    {
+      if (!root_)
+      {
+        return size_ == 0;
+      }
+      std::size_t count = 0;
+      const Leaf* previous = nullptr;
+      return isValidNode(root_, height_, nullptr, nullptr, true, count, previous) && count == size_ && !previous->next;
+    }
+    iterator begin()
+    {
+      return toIterator(Position{ firstLeaf(), 0 });
+    }
+    const_iterator begin() const
+    {
+      return toIterator(Position{ firstLeaf(), 0 });
+    }
+    const_iterator cbegin() const
+    {
+      return begin();
+    }
+    iterator end()
+    {
+      return iterator(nullptr, 0);
+    }
+    const_iterator end() const
+    {
+      return const_iterator(nullptr, 0);
+    }
+    const_iterator cend() const
+    {
+      return end();
+    }
+
+  private:
+    using LeafAllocator = typename std::allocator_traits< Allocator >::template rebind_alloc< Leaf >;
+    using LeafTraits = std::allocator_traits< LeafAllocator >;
+    using InnerAllocator = typename std::allocator_traits< Allocator >::template rebind_alloc< Inner >;
+    using InnerTraits = std::allocator_traits< InnerAllocator >;
+    static constexpr std::size_t MIN_LEAF = Capacity::LEAF / 2;
+    static constexpr std::size_t MIN_INNER = Capacity::INNER / 2;
+    // Every inner node but the root has at least three children.
+    static constexpr std::size_t MAX_HEIGHT = 64;
+
+    struct Position
+    {
+      Leaf* leaf;
+      std::size_t index;
+    };
+    struct PathStep
+    {
+      Inner* node;
+      std::size_t index;
+    };
+
+    Leaf* createLeaf()
+    {
+      Leaf* leaf = LeafTraits::allocate(alloc_, 1);
+      return ::new (static_cast< void* >(leaf)) Leaf();
+    }
+    // Inner nodes get an allocator made as for a copy of the map. A PoolAllocator, whose arena has the single block
+    // size of the leaves, thus gives them an arena of their own; other allocators usually just share theirs.
+    static InnerAllocator innerAllocatorFor(const LeafAllocator& alloc)
+    {
+      return InnerTraits::select_on_container_copy_construction(InnerAllocator(alloc));
+    }
+    Inner* createInner()
+    {
+      Inner* inner = InnerTraits::allocate(innerAlloc_, 1);
+      return ::new (static_cast< void* >(inner)) Inner();
+    }
+    void destroyLeaf(Leaf* leaf) noexcept
+    {
+      for (std::size_t i = 0; i < leaf->count; ++i)
+      {
+        leaf->slots.destroy(leaf->order[i]);
+      }
+      leaf->~Leaf();
+      LeafTraits::deallocate(alloc_, leaf, 1);
+    }
+    void destroyInner(Inner* inner) noexcept
+    {
+      for (std::size_t i = 0; i < inner->count; ++i)
+      {
+        inner->keys.destroy(i);
+      }
+      inner->~Inner();
+      InnerTraits::deallocate(innerAlloc_, inner, 1);
+    }
+    void destroySubtree(NodeBase* node, std::size_t height) noexcept
+    {
+      if (height == 0)
+      {
+        destroyLeaf(static_cast< Leaf* >(node));
+        return;
+      }
+      Inner* inner = static_cast< Inner* >(node);
+      for (std::size_t i = 0; i <= inner->count; ++i)
+      {
+        destroySubtree(inner->children[i], height - 1);
+      }
+      destroyInner(inner);
+    }
+    // Copies a subtree, linking its leaves after last.
+    NodeBase* copyNode(const NodeBase* src, std::size_t height, Leaf*& last)
+    {
+      if (height == 0)
+      {
+        const Leaf* from = static_cast< const Leaf* >(src);
+        Leaf* to = createLeaf();
+        try
+        {
+          for (; to->count < from->count; ++to->count)
+          {
+            to->slots.construct(to->count, from->entry(to->count));
+          }
+        }
+        catch (...)
+        {
+          destroyLeaf(to);
+          throw;
+        }
+        to->prev = last;
+        if (last)
+        {
+          last->next = to;
+        }
+        last = to;
+        return to;
+      }
+      const Inner* from = static_cast< const Inner* >(src);
+      Inner* to = createInner();
+      // Children linked so far, one more than the keys once the first is.
+      std::size_t nLinked = 0;
+      try
+      {
+        to->children[0] = copyNode(from->children[0], height - 1, last);
+        nLinked = 1;
+        for (; to->count < from->count; ++to->count, ++nLinked)
+        {
+          NodeBase* child = copyNode(from->children[to->count + 1], height - 1, last);
+          try
+          {
+            to->keys.construct(to->count, from->keys[to->count]);
+          }
+          catch (...)
+          {
+            destroySubtree(child, height - 1);
+            throw;
+          }
+          to->children[to->count + 1] = child;
+        }
+      }
+      catch (...)
+      {
+        for (std::size_t i = 0; i < nLinked; ++i)
+        {
+          destroySubtree(to->children[i], height - 1);
+        }
+        destroyInner(to);
+        throw;
+      }
+      return to;
+    }
+    void swapContents(BTreeMap< K, T, Compare, Allocator >& other) noexcept
+    {
+      std::swap(root_, other.root_);
+      std::swap(height_, other.height_);
+      std::swap(size_, other.size_);
+      std::swap(compare_, other.compare_);
+      // Private to the nodes, so it goes with them whatever the propagation traits of the leaves' allocator.
+      std::swap(innerAlloc_, other.innerAlloc_);
+    }
+
+    // Number of separators not greater than key, which is the index of the child holding it.
+    // Arithmetic keys under std::less scan the separators a vector at a time.
+    template < class Key >
+    std::size_t childIndex(const Inner* node, const Key& key) const
+    {
+      if constexpr (detail::IsSimdSearchable< K, Compare >::value && std::is_same< Key, K >::value)
+      {
+        return detail::countNotGreater(node->keys.data(), node->count, key);
+      }
+      std::size_t lo = 0;
+      std::size_t hi = node->count;
+      while (lo < hi)
+      {
+        std::size_t mid = (lo + hi) / 2;
+        if (compare_(key, node->keys[mid]))
+        {
+          hi = mid;
+        }
+        else
+        {
+          lo = mid + 1;
+        }
+      }
+      return lo;
+    }
+    // First entry not less than key, or greater than key when UPPER.
+    template < bool UPPER, class Key >
+    std::size_t leafBound(const Leaf* leaf, const Key& key) const
+    {
+      std::size_t lo = 0;
+      std::size_t hi = leaf->count;
+      while (lo < hi)
+      {
+        std::size_t mid = (lo + hi) / 2;
+        if (UPPER ? !compare_(key, leaf->entry(mid).first) : compare_(leaf->entry(mid).first, key))
+        {
+          lo = mid + 1;
+        }
+        else
+        {
+          hi = mid;
+        }
+      }
+      return lo;
+    }
+    template < class Key >
+    Leaf* descend(const Key& key, PathStep* path) const
+    {
+      NodeBase* node = root_;
+      for (std::size_t level = 0; level < height_; ++level)
+      {
+        Inner* inner = static_cast< Inner* >(node);
+        std::size_t index = childIndex(inner, key);
+        if (path)
+        {
+          path[level] = { inner, index };
+        }
+        node = inner->children[index];
+      }
+      return static_cast< Leaf* >(node);
+    }
+    template < class Key >
+    Position findEqual(const Key& key) const
+    {
+      if (!root_)
+      {
+        return { nullptr, 0 };
+      }
+      Leaf* leaf = descend(key, nullptr);
+      std::size_t index = leafBound< false >(leaf, key);
+      if (index == leaf->count || compare_(key, leaf->entry(index).first))
+      {
+        return { nullptr, 0 };
+      }
+      return { leaf, index };
+    }
+    template < bool UPPER, class Key >
+    Position findBound(const Key& key) const
+    {
+      if (!root_)
+      {
+        return { nullptr, 0 };
+      }
+      Leaf* leaf = descend(key, nullptr);
+      std::size_t index = leafBound< UPPER >(leaf, key);
+      if (index == leaf->count)
+      {
+        return { leaf->next, 0 };
+      }
+      return { leaf, index };
+    }
+    template < class Key >
+    value_type& atEntry(const Key& key) const
+    {
+      Position position = findEqual(key);
+      if (!position.leaf)
+      {
+        throw std::out_of_range("There are no such element\n");
+      }
+      return position.leaf->entry(position.index);
+    }
+    static iterator toIterator(Position position)
+    {
+      return position.leaf && position.index < position.leaf->count ? iterator(position.leaf, position.index)
+                                                                     : iterator(nullptr, 0);
+    }
+    Leaf* firstLeaf() const
+    {
+      NodeBase* node = root_;
+      for (std::size_t level = 0; level < height_; ++level)
+      {
+        node = static_cast< Inner* >(node)->children[0];
+      }
+      return static_cast< Leaf* >(node);
+    }
+    Leaf* lastLeaf() const
+    {
+      NodeBase* node = root_;
+      for (std::size_t level = 0; level < height_; ++level)
+      {
+        Inner* inner = static_cast< Inner* >(node);
+        node = inner->children[inner->count];
+      }
+      return static_cast< Leaf* >(node);
+    }
+    // Calls f from the given entry on until it returns false; void-returning callbacks never stop the walk.
+    template < bool REVERSE, class F >
+    static void visitLeaves(Leaf* leaf, std::size_t index, F&& f)
+    {
+      for (; leaf; leaf = REVERSE ? leaf->prev : leaf->next, index = 0)
+      {
+        for (; index < leaf->count; ++index)
+        {
+          value_type& value = leaf->entry(REVERSE ? leaf->count - 1 - index : index);
+          if constexpr (std::is_void< decltype(f(value)) >::value)
+          {
+            f(value);
+          }
+          else if (!f(value))
+          {
+            return;
+          }
+        }
+      }
+    }
+
+    template < class... Args >
+    static void constructEntry(Leaf* leaf, std::size_t index, Args&&... args)
+    {
+      std::uint8_t slot = leaf->order[leaf->count];
+      leaf->slots.construct(slot, std::forward< Args >(args)...);
+      for (std::size_t i = leaf->count; i > index; --i)
+      {
+        leaf->order[i] = leaf->order[i - 1];
+      }
+      leaf->order[index] = slot;
+      ++leaf->count;
+    }
+    static void eraseEntry(Leaf* leaf, std::size_t index) noexcept
+    {
+      std::uint8_t slot = leaf->order[index];
+      leaf->slots.destroy(slot);
+      --leaf->count;
+      for (std::size_t i = index; i < leaf->count; ++i)
+      {
+        leaf->order[i] = leaf->order[i + 1];
+      }
+      leaf->order[leaf->count] = slot;
+    }
+    // Inserts key at index with child right before (childIndex == index) or after it (childIndex == index + 1).
+    static void insertKey(Inner* node, std::size_t index, K&& key, std::size_t childIndex, NodeBase* child) noexcept
+    {
+      std::size_t n = node->count;
+      if (index == n)
+      {
+        node->keys.construct(n, std::move(key));
+      }
+      else
+      {
+        node->keys.construct(n, std::move(node->keys[n - 1]));
+        for (std::size_t i = n - 1; i > index; --i)
+        {
+          node->keys[i] = std::move(node->keys[i - 1]);
+        }
+        node->keys[index] = std::move(key);
+      }
+      for (std::size_t i = n + 1; i > childIndex; --i)
+      {
+        node->children[i] = node->children[i - 1];
+      }
+      node->children[childIndex] = child;
+      ++node->count;
+    }
+    static void removeKey(Inner* node, std::size_t index, std::size_t childIndex) noexcept
+    {
+      std::size_t n = node->count;
+      for (std::size_t i = index; i + 1 < n; ++i)
+      {
+        node->keys[i] = std::move(node->keys[i + 1]);
+      }
+      node->keys.destroy(n - 1);
+      for (std::size_t i = childIndex; i < n; ++i)
+      {
+        node->children[i] = node->children[i + 1];
+      }
+      --node->count;
+    }
+
+    template < class Key, class... Args >
+    std::pair< iterator, bool > insertUnique(const Key& key, Args&&... args)
+    {
+      if (!root_)
+      {
+        root_ = createLeaf();
+      }
+      PathStep path[MAX_HEIGHT];
+      Leaf* leaf = descend(key, path);
+      std::size_t index = leafBound< false >(leaf, key);
+      if (index < leaf->count && !compare_(key, leaf->entry(index).first))
+      {
+        return { iterator(leaf, index), false };
+      }
+      if (leaf->count < Capacity::LEAF)
+      {
+        constructEntry(leaf, index, std::forward< Args >(args)...);
+        ++size_;
+        return { iterator(leaf, index), true };
+      }
+      return { splitInsert(path, leaf, index, std::forward< Args >(args)...), true };
+    }
+    // Everything that may throw happens before the tree is touched: the nodes for the whole chain of splits
+    // are allocated up front, the new entry goes to the spare slot and the upper half is copied out first.
+    template < class... Args >
+    iterator splitInsert(PathStep* path, Leaf* leaf, std::size_t index, Args&&... args)
+    {
+      std::size_t fullInners = 0;
+      while (fullInners < height_ && path[height_ - 1 - fullInners].node->count == Capacity::INNER)
+      {
+        ++fullInners;
+      }
+      std::size_t nSpares = fullInners + (fullInners == height_);
+      Inner* spares[MAX_HEIGHT + 1];
+      std::size_t nAllocated = 0;
+      Leaf* right = nullptr;
+      try
+      {
+        right = createLeaf();
+        for (; nAllocated < nSpares; ++nAllocated)
+        {
+          spares[nAllocated] = createInner();
+        }
+        constructEntry(leaf, index, std::forward< Args >(args)...);
+      }
+      catch (...)
+      {
+        releaseSpares(right, spares, nAllocated);
+        throw;
+      }
+      constexpr std::size_t KEEP = (Capacity::LEAF + 1) / 2;
+      try
+      {
+        K separator = moveUpperHalf(leaf, right, KEEP);
+        for (std::size_t i = KEEP; i <= Capacity::LEAF; ++i)
+        {
+          leaf->slots.destroy(leaf->order[i]);
+        }
+        leaf->count = KEEP;
+        right->next = leaf->next;
+        if (right->next)
+        {
+          right->next->prev = right;
+        }
+        right->prev = leaf;
+        leaf->next = right;
+        insertSeparator(path, std::move(separator), right, spares);
+        ++size_;
+        return index < KEEP ? iterator(leaf, index) : iterator(right, index - KEEP);
+      }
+      catch (...)
+      {
+        eraseEntry(leaf, index);
+        releaseSpares(right, spares, nAllocated);
+        throw;
+      }
+    }
+    void releaseSpares(Leaf* leaf, Inner** spares, std::size_t n) noexcept
+    {
+      if (leaf)
+      {
+        destroyLeaf(leaf);
+      }
+      for (std::size_t i = 0; i < n; ++i)
+      {
+        destroyInner(spares[i]);
+      }
+    }
+    // Fills the empty right leaf with the entries of leaf from keep on and returns the separator between them.
+    // On failure right is left empty and leaf untouched.
+    K moveUpperHalf(Leaf* leaf, Leaf* right, std::size_t keep)
+    {
+      K separator(leaf->entry(keep).first);
+      try
+      {
+        for (std::size_t i = keep; i < leaf->count; ++i, ++right->count)
+        {
+          right->slots.construct(right->count, std::move_if_noexcept(leaf->entry(i)));
+        }
+      }
+      catch (...)
+      {
+        for (; right->count > 0; --right->count)
+        {
+          right->slots.destroy(right->count - 1);
+        }
+        throw;
+      }
+      return separator;
+    }
+    void insertSeparator(PathStep* path, K separator, NodeBase* child, Inner** spares) noexcept
+    {
+      constexpr std::size_t MIDDLE = (Capacity::INNER + 1) / 2;
+      for (std::size_t level = height_; level-- > 0;)
+      {
+        Inner* node = path[level].node;
+        insertKey(node, path[level].index, std::move(separator), path[level].index + 1, child);
+        if (node->count <= Capacity::INNER)
+        {
+          return;
+        }
+        Inner* right = *spares++;
+        for (std::size_t i = MIDDLE + 1; i <= Capacity::INNER; ++i, ++right->count)
+        {
+          right->keys.construct(right->count, std::move(node->keys[i]));
+          right->children[right->count] = node->children[i];
+        }
+        right->children[right->count] = node->children[Capacity::INNER + 1];
+        separator = std::move(node->keys[MIDDLE]);
+        for (std::size_t i = MIDDLE; i <= Capacity::INNER; ++i)
+        {
+          node->keys.destroy(i);
+        }
+        node->count = MIDDLE;
+        child = right;
+      }
+      Inner* newRoot = *spares;
+      newRoot->keys.construct(0, std::move(separator));
+      newRoot->children[0] = root_;
+      newRoot->children[1] = child;
+      newRoot->count = 1;
+      root_ = newRoot;
+      ++height_;
+    }
+
+    // Erases the entry at index, first borrowing from or merging with a sibling when the leaf would underflow.
+    // Only that step moves entries, before anything is erased, so a copy that throws leaves the map unchanged.
+    void eraseAt(PathStep* path, Leaf* leaf, std::size_t index)
+    {
+      if (height_ == 0 || leaf->count > MIN_LEAF)
+      {
+        eraseEntry(leaf, index);
+        if (leaf->count == 0)
+        {
+          destroyLeaf(leaf);
+          root_ = nullptr;
+        }
+        return;
+      }
+      Inner* parent = path[height_ - 1].node;
+      std::size_t childIndex = path[height_ - 1].index;
+      Leaf* left = childIndex > 0 ? static_cast< Leaf* >(parent->children[childIndex - 1]) : nullptr;
+      Leaf* right = childIndex < parent->count ? static_cast< Leaf* >(parent->children[childIndex + 1]) : nullptr;
+      if (left && left->count > MIN_LEAF)
+      {
+        K separator(left->entry(left->count - 1).first);
+        constructEntry(leaf, 0, std::move_if_noexcept(left->entry(left->count - 1)));
+        eraseEntry(left, left->count - 1);
+        parent->keys[childIndex - 1] = std::move(separator);
+        eraseEntry(leaf, index + 1);
+      }
+      else if (right && right->count > MIN_LEAF)
+      {
+        K separator(right->entry(1).first);
+        constructEntry(leaf, leaf->count, std::move_if_noexcept(right->entry(0)));
+        eraseEntry(right, 0);
+        parent->keys[childIndex] = std::move(separator);
+        eraseEntry(leaf, index);
+      }
+      else
+      {
+        if (left)
+        {
+          index += left->count;
+          mergeLeaves(left, leaf);
+          removeKey(parent, childIndex - 1, childIndex);
+          leaf = left;
+        }
+        else
+        {
+          mergeLeaves(leaf, right);
+          removeKey(parent, childIndex, childIndex + 1);
+        }
+        eraseEntry(leaf, index);
+        rebalanceInner(path, height_ - 1);
+      }
+      assert(leaf->count >= MIN_LEAF && leaf->count <= Capacity::LEAF);
+    }
+    // Moves every entry of src to the end of dst, then unlinks and frees src.
+    // A copy that throws is undone, leaving both leaves as they were.
+    void mergeLeaves(Leaf* dst, Leaf* src)
+    {
+      std::size_t n = dst->count;
+      try
+      {
+        for (std::size_t i = 0; i < src->count; ++i)
+        {
+          constructEntry(dst, dst->count, std::move_if_noexcept(src->entry(i)));
+        }
+      }
+      catch (...)
+      {
+        while (dst->count > n)
+        {
+          eraseEntry(dst, dst->count - 1);
+        }
+        throw;
+      }
+      if (src->prev)
+      {
+        src->prev->next = src->next;
+      }
+      if (src->next)
+      {
+        src->next->prev = src->prev;
+      }
+      destroyLeaf(src);
+    }
+    void rebalanceInner(PathStep* path, std::size_t level) noexcept
+    {
+      Inner* node = path[level].node;
+      if (level == 0)
+      {
+        if (node->count == 0)
+        {
+          root_ = node->children[0];
+          destroyInner(node);
+          --height_;
+        }
+        return;
+      }
+      if (node->count >= MIN_INNER)
+      {
+        return;
+      }
+      Inner* parent = path[level - 1].node;
+      std::size_t index = path[level - 1].index;
+      Inner* left = index > 0 ? static_cast< Inner* >(parent->children[index - 1]) : nullptr;
+      Inner* right = index < parent->count ? static_cast< Inner* >(parent->children[index + 1]) : nullptr;
+      if (left && left->count > MIN_INNER)
+      {
+        insertKey(node, 0, std::move(parent->keys[index - 1]), 0, left->children[left->count]);
+        parent->keys[index - 1] = std::move(left->keys[left->count - 1]);
+        removeKey(left, left->count - 1, left->count);
+        return;
+      }
+      if (right && right->count > MIN_INNER)
+      {
+        insertKey(node, node->count, std::move(parent->keys[index]), node->count + 1, right->children[0]);
+        parent->keys[index] = std::move(right->keys[0]);
+        removeKey(right, 0, 0);
+        return;
+      }
+      if (left)
+      {
+        mergeInners(left, node, parent, index - 1);
+      }
+      else
+      {
+        mergeInners(node, right, parent, index);
+      }
+      rebalanceInner(path, level - 1);
+    }
+    void mergeInners(Inner* left, Inner* right, Inner* parent, std::size_t separator) noexcept
+    {
+      insertKey(left, left->count, std::move(parent->keys[separator]), left->count + 1, right->children[0]);
+      for (std::size_t i = 0; i < right->count; ++i)
+      {
+        insertKey(left, left->count, std::move(right->keys[i]), left->count + 1, right->children[i + 1]);
+      }
+      destroyInner(right);
+      removeKey(parent, separator, separator + 1);
+    }
+
+    bool isValidNode(const NodeBase* node,
+      std::size_t height,
+      const K* lo,
+      const K* hi,
+      bool isRoot,
+      std::size_t& count,
+      const Leaf*& previous) const
+    {
+      if (height == 0)
+      {
+        const Leaf* leaf = static_cast< const Leaf* >(node);
+        if ((!isRoot && leaf->count < MIN_LEAF) || leaf->prev != previous || (previous && previous->next != leaf))
+        {
+          return false;
+        }
+        for (std::size_t i = 0; i < leaf->count; ++i)
+        {
+          const K& key = leaf->entry(i).first;
+          if ((i > 0 && !compare_(leaf->entry(i - 1).first, key)) || (lo && compare_(key, *lo)) || (hi && !compare_(key, *hi)))
+          {
+            return false;
+          }
+        }
+        count += leaf->count;
+        previous = leaf;
+        return true;
+      }
+      const Inner* inner = static_cast< const Inner* >(node);
+      if (inner->count == 0 || (!isRoot && inner->count < MIN_INNER))
+      {
+        return false;
+      }
+      for (std::size_t i = 0; i <= inner->count; ++i)
+      {
+        const K* childLo = i > 0 ? &inner->keys[i - 1] : lo;
+        const K* childHi = i < inner->count ? &inner->keys[i] : hi;
+        if ((childLo && childHi && !compare_(*childLo, *childHi))
+            || !isValidNode(inner->children[i], height - 1, childLo, childHi, false, count, previous))
+        {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    NodeBase* root_;
+    std::size_t height_;
+    std::size_t size_;
+    Compare compare_;
+    LeafAllocator alloc_;
+    InnerAllocator innerAlloc_;
+  };
+}
+
+#endif
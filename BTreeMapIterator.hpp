@@ -0,0 +1,98 @@
+#ifndef BTREE_MAP_ITERATOR_HPP
+#define BTREE_MAP_ITERATOR_HPP
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+#include "BTreeMapNode.hpp"
+
+namespace demidenko
+{
+  template < class K, class T, class Compare, class Allocator >
+  class BTreeMap;
+
+  template < class Leaf, bool CONST >
+  class BTreeMapIterator
+  {
+    template < class, class, class, class >
+    friend class BTreeMap;
+    template < class, bool >
+    friend class BTreeMapIterator;
+
+  public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::conditional_t< CONST, const typename Leaf::value_type, typename Leaf::value_type >;
+    using reference = value_type&;
+    using pointer = value_type*;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    BTreeMapIterator(const BTreeMapIterator&) = default;
+    template < bool OTHER_CONST, class = std::enable_if_t< CONST && !OTHER_CONST > >
+    BTreeMapIterator(const BTreeMapIterator< Leaf, OTHER_CONST >& other):
+      leaf_(other.leaf_),
+      index_(other.index_)
+    {}
+    ~BTreeMapIterator() = default;
+    BTreeMapIterator< Leaf, CONST >& operator=(const BTreeMapIterator< Leaf, CONST >&) = default;
+    BTreeMapIterator< Leaf, CONST >& operator++()
+    {
+      if (++index_ == leaf_->count)
+      {
+        leaf_ = leaf_->next;
+        index_ = 0;
+      }
+      return *this;
+    }
+    BTreeMapIterator< Leaf, CONST > operator++(int)
+    {
+      BTreeMapIterator< Leaf, CONST > temp(*this);
+      ++*this;
+      return temp;
+    }
+    BTreeMapIterator< Leaf, CONST >& operator--()
+    {
+      if (index_ == 0)
+      {
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count;
+      }
+      --index_;
+      return *this;
+    }
+    BTreeMapIterator< Leaf, CONST > operator--(int)
+    {
+      BTreeMapIterator< Leaf, CONST > temp(*this);
+      --*this;
+      return temp;
+    }
+
+    value_type& operator*() const
+    {
+      return leaf_->entry(index_);
+    }
+    value_type* operator->() const
+    {
+      return std::addressof(leaf_->entry(index_));
+    }
+
+    bool operator==(const BTreeMapIterator< Leaf, CONST >& other) const
+    {
+      return leaf_ == other.leaf_ && index_ == other.index_;
+    }
+    bool operator!=(const BTreeMapIterator< Leaf, CONST >& other) const
+    {
+      return !(*this == other);
+    }
+
+  private:
+    BTreeMapIterator(Leaf* leaf, std::size_t index):
+      leaf_(leaf),
+      index_(index)
+    {}
+    Leaf* leaf_;
+    std::size_t index_;
+  };
+}
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef BTREE_MAP_NODE_HPP
+#define BTREE_MAP_NODE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace demidenko
+{
+  namespace detail
+  {
+    // Uninitialized storage for N objects of type V.
+    template < class V, std::size_t N >
+    class RawSlots
+    {
+    public:
+      V* data() noexcept
+      {
+        return std::launder(reinterpret_cast< V* >(bytes_));
+      }
+      const V* data() const noexcept
+      {
+        return std::launder(reinterpret_cast< const V* >(bytes_));
+      }
+      V& operator[](std::size_t i) noexcept
+      {
+        return *std::launder(reinterpret_cast< V* >(bytes_ + i * sizeof(V)));
+      }
+      const V& operator[](std::size_t i) const noexcept
+      {
+        return *std::launder(reinterpret_cast< const V* >(bytes_ + i * sizeof(V)));
+      }
+      template < class... Args >
+      V& construct(std::size_t i, Args&&... args)
+      {
+        return *::new (static_cast< void* >(bytes_ + i * sizeof(V))) V(std::forward< Args >(args)...);
+      }
+      void destroy(std::size_t i) noexcept
+      {
+        (*this)[i].~V();
+      }
+
+    private:
+      alignas(V) unsigned char bytes_[N * sizeof(V)];
+    };
+
+    // Fills about NODE_BYTES with entries, staying within what an 8-bit count can address.
+    template < class K, class T >
+    struct BTreeCapacity
+    {
+      static constexpr std::size_t NODE_BYTES = 256;
+      static constexpr std::size_t clamp(std::size_t n)
+      {
+        return n < 4 ? 4 : (n > 64 ? 64 : n);
+      }
+      static constexpr std::size_t LEAF = clamp(NODE_BYTES / sizeof(std::pair< const K, T >));
+      static constexpr std::size_t INNER = clamp(NODE_BYTES / (sizeof(K) + sizeof(void*)));
+    };
+
+    struct BTreeNodeBase
+    {
+      // Entries of a leaf or keys of an inner node.
+      std::uint8_t count = 0;
+    };
+    // Entries never move inside a leaf: order[0, count) are the used slots in key order, the rest are free.
+    // The extra slot lets an insertion construct its entry before the leaf is split.
+    template < class K, class T, std::size_t N >
+    struct BTreeLeaf: BTreeNodeBase
+    {
+      using value_type = std::pair< const K, T >;
+      BTreeLeaf() noexcept
+      {
+        for (std::size_t i = 0; i <= N; ++i)
+        {
+          order[i] = static_cast< std::uint8_t >(i);
+        }
+      }
+      value_type& entry(std::size_t i) noexcept
+      {
+        return slots[order[i]];
+      }
+      const value_type& entry(std::size_t i) const noexcept
+      {
+        return slots[order[i]];
+      }
+      std::uint8_t order[N + 1];
+      BTreeLeaf* prev = nullptr;
+      BTreeLeaf* next = nullptr;
+      RawSlots< value_type, N + 1 > slots;
+    };
+    // keys[i] separates children[i] from children[i + 1]: keys of children[i + 1] are not less than it.
+    // The extra key and child let an insertion overflow the node before it is split.
+    template < class K, std::size_t N >
+    struct BTreeInner: BTreeNodeBase
+    {
+      RawSlots< K, N + 1 > keys;
+      BTreeNodeBase* children[N + 2];
+    };
+  }
+}
+#endif
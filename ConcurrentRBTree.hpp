@@ -0,0 +1,354 @@
+#ifndef CONCURRENT_RBTREE_HPP
+#define CONCURRENT_RBTREE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "RBTreePathCopy.hpp"
+
+namespace demidenko
+{
+  // Sorted map read without locks while one writer at a time updates it.
+  // An update copies the path it changes and publishes the new root, so a reader keeps a consistent snapshot.
+  // Nodes left out of the published tree are freed once every reader pinned before has gone,
+  // readers announcing the epoch they entered in one of maxReaders slots.
+  template < class K,
+    class T,
+    class Compare = std::less< K >,
+    class Allocator = std::allocator< std::pair< const K, T > > >
+  class ConcurrentRBTree: private PathCopyCore< detail::PathNode< K, T, false >, Compare, Allocator >
+  {
+    using Node = detail::PathNode< K, T, false >;
+    using Core = PathCopyCore< Node, Compare, Allocator >;
+    using typename Core::Subtree;
+    using typename Core::SplitResult;
+    static constexpr std::size_t CACHE_LINE = 64;
+
+    // Epoch a reader entered in, 0 for a free slot. One per cache line, so readers do not share lines.
+    struct alignas(CACHE_LINE) ReaderSlot
+    {
+      std::atomic< std::uint64_t > epoch{ 0 };
+    };
+
+  public:
+    using value_type = typename Node::value_type;
+    using const_iterator = typename Core::const_iterator;
+    using key_type = const K;
+    using mapped_type = T;
+    using allocator_type = Allocator;
+
+    // Pins a snapshot of the tree: its nodes stay alive until the reader is destroyed.
+    // Keep readers short, an old one holds back the reclamation of everything retired since.
+    class Reader
+    {
+      friend class ConcurrentRBTree< K, T, Compare, Allocator >;
+
+    public:
+      Reader(Reader&& src) noexcept:
+        tree_(src.tree_),
+        slot_(src.slot_),
+        root_(src.root_)
+      {
+        src.slot_ = nullptr;
+      }
+      Reader(const Reader&) = delete;
+      Reader& operator=(const Reader&) = delete;
+      ~Reader()
+      {
+        if (slot_)
+        {
+          slot_->epoch.store(0, std::memory_order_release);
+        }
+      }
+      const T& at(const K& key) const
+      {
+        return atNode(key)->value.second;
+      }
+      template < class Key, class C = Compare, class = typename C::is_transparent >
+      const T& at(const Key& key) const
+      {
+        return atNode(key)->value.second;
+      }
+      int count(const K& key) const
+      {
+        return tree_->findEqualNode(root_, key) != nullptr;
+      }
+      template < class Key, class C = Compare, class = typename C::is_transparent >
+      int count(const Key& key) const
+      {
+        return tree_->findEqualNode(root_, key) != nullptr;
+      }
+      const_iterator find(const K& key) const
+      {
+        return tree_->findAt(root_, key);
+      }
+      template < class Key, class C = Compare, class = typename C::is_transparent >
+      const_iterator find(const Key& key) const
+      {
+        return tree_->findAt(root_, key);
+      }
+      const_iterator lowerBound(const K& key) const
+      {
+        return tree_->template boundAt< false >(root_, key);
+      }
+      template < class Key, class C = Compare, class = typename C::is_transparent >
+      const_iterator lowerBound(const Key& key) const
+      {
+        return tree_->template boundAt< false >(root_, key);
+      }
+      const_iterator upperBound(const K& key) const
+      {
+        return tree_->template boundAt< true >(root_, key);
+      }
+      template < class Key, class C = Compare, class = typename C::is_transparent >
+      const_iterator upperBound(const Key& key) const
+      {
+        return tree_->template boundAt< true >(root_, key);
+      }
+      const_iterator begin() const
+      {
+        return tree_->beginAt(root_);
+      }
+      const_iterator end() const
+      {
+        return const_iterator();
+      }
+
+    private:
+      Reader(const ConcurrentRBTree< K, T, Compare, Allocator >* tree, ReaderSlot* slot):
+        tree_(tree),
+        slot_(slot),
+        root_(tree->root_.load(std::memory_order_seq_cst))
+      {}
+      template < class Key >
+      const Node* atNode(const Key& key) const
+      {
+        const Node* result = tree_->findEqualNode(root_, key);
+        if (!result)
+        {
+          throw std::out_of_range("There are no such element\n");
+        }
+        return result;
+      }
+      const ConcurrentRBTree< K, T, Compare, Allocator >* tree_;
+      ReaderSlot* slot_;
+      const Node* root_;
+    };
+
+    explicit ConcurrentRBTree(Compare compare = Compare(), const Allocator& alloc = Allocator(), std::size_t maxReaders = 64):
+      Core(compare, alloc),
+      root_(nullptr),
+      size_(0),
+      epoch_(1),
+      nSlots_(maxReaders ? maxReaders : 1),
+      slots_(std::make_unique< ReaderSlot[] >(nSlots_))
+    {}
+    ConcurrentRBTree(const ConcurrentRBTree< K, T, Compare, Allocator >&) = delete;
+    ConcurrentRBTree< K, T, Compare, Allocator >& operator=(const ConcurrentRBTree< K, T, Compare, Allocator >&) = delete;
+    // No reader may outlive the tree.
+    virtual ~ConcurrentRBTree()
+    {
+      destroyTree(root_.load(std::memory_order_relaxed));
+      for (const std::pair< std::uint64_t, Node* >& retired : retired_)
+      {
+        Core::destroyNode(retired.second);
+      }
+    }
+    allocator_type get_allocator() const
+    {
+      return allocator_type(Core::alloc_);
+    }
+    // Size of the latest published tree, may be stale by the time it returns.
+    std::size_t size() const noexcept
+    {
+      return size_.load(std::memory_order_acquire);
+    }
+    bool empty() const noexcept
+    {
+      return size() == 0;
+    }
+    // Waits for a free slot if maxReaders readers are already pinned.
+    Reader read() const
+    {
+      for (;;)
+      {
+        for (std::size_t i = 0; i < nSlots_; ++i)
+        {
+          std::uint64_t free = 0;
+          if (slots_[i].epoch.load(std::memory_order_relaxed) == 0
+              && slots_[i].epoch.compare_exchange_strong(free, epoch_.load(std::memory_order_seq_cst)))
+          {
+            return Reader(this, &slots_[i]);
+          }
+        }
+        std::this_thread::yield();
+      }
+    }
+    // Updates are serialized, and either publish their whole change or leave the tree as it was.
+    bool insert(const K& key, const T& value)
+    {
+      return emplace(key, value);
+    }
+    template < class... Args >
+    bool emplace(const K& key, Args&&... args)
+    {
+      std::lock_guard< std::mutex > lock(writeMutex_);
+      Node* root = root_.load(std::memory_order_relaxed);
+      if (Core::findEqualNode(root, key))
+      {
+        return false;
+      }
+      update([&] {
+        Node* pivot = Core::createNode(std::piecewise_construct,
+          std::forward_as_tuple(key),
+          std::forward_as_tuple(std::forward< Args >(args)...));
+        SplitResult parts = Core::splitNodes(Core::wholeTree(root), key);
+        return Core::joinNodes(parts.less, pivot, parts.greater).root;
+      }, 1);
+      return true;
+    }
+    std::size_t erase(const K& key)
+    {
+      return eraseKey(key);
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    std::size_t erase(const Key& key)
+    {
+      return eraseKey(key);
+    }
+    void clear()
+    {
+      std::lock_guard< std::mutex > lock(writeMutex_);
+      Node* root = root_.load(std::memory_order_relaxed);
+      update([&] {
+        retireTree(root);
+        return static_cast< Node* >(nullptr);
+      }, -static_cast< std::ptrdiff_t >(size()));
+    }
+    bool isRBTree() const
+    {
+      std::lock_guard< std::mutex > lock(writeMutex_);
+      const Node* root = root_.load(std::memory_order_relaxed);
+      return Core::colorOf(root) == Core::Color::Black && Core::isWeakRBTree(root);
+    }
+    // Frees the retired nodes no pinned reader can reach. Updates do it on their own.
+    void reclaim()
+    {
+      std::lock_guard< std::mutex > lock(writeMutex_);
+      reclaimRetired();
+    }
+    // Nodes retired and not freed yet.
+    std::size_t retiredCount() const
+    {
+      std::lock_guard< std::mutex > lock(writeMutex_);
+      return retired_.size();
+    }
+
+  private:
+    template < class Key >
+    std::size_t eraseKey(const Key& key)
+    {
+      std::lock_guard< std::mutex > lock(writeMutex_);
+      Node* root = root_.load(std::memory_order_relaxed);
+      if (!Core::findEqualNode(root, key))
+      {
+        return 0;
+      }
+      update([&] {
+        SplitResult parts = Core::splitNodes(Core::wholeTree(root), key);
+        Core::dropNode(parts.equal);
+        return Core::joinSubtrees(parts.less, parts.greater).root;
+      }, -1);
+      return 1;
+    }
+    // Publishes the root made by build, retiring the nodes it has replaced.
+    template < class Build >
+    void update(Build&& build, std::ptrdiff_t delta)
+    {
+      Node* root = Core::buildUpdate(build);
+      // Room first, so that retiring cannot fail once the root is published. Growing geometrically keeps
+      // the updates amortized O(log n) while a pinned reader holds back the reclamation.
+      std::size_t nRetired = retired_.size() + Core::replaced_.size();
+      try
+      {
+        if (nRetired > retired_.capacity())
+        {
+          retired_.reserve(std::max(nRetired, 2 * retired_.capacity()));
+        }
+      }
+      catch (...)
+      {
+        Core::rollbackUpdate();
+        throw;
+      }
+      root_.store(root, std::memory_order_seq_cst);
+      size_.store(static_cast< std::size_t >(static_cast< std::ptrdiff_t >(size()) + delta), std::memory_order_release);
+      // Readers pinned from now on cannot see the replaced nodes, the ones pinned before have an older epoch.
+      std::uint64_t epoch = epoch_.fetch_add(1, std::memory_order_seq_cst);
+      for (Node* node : Core::replaced_)
+      {
+        retired_.emplace_back(epoch, node);
+      }
+      Core::created_.clear();
+      Core::replaced_.clear();
+      reclaimRetired();
+    }
+    void reclaimRetired() noexcept
+    {
+      std::uint64_t oldest = std::numeric_limits< std::uint64_t >::max();
+      for (std::size_t i = 0; i < nSlots_; ++i)
+      {
+        std::uint64_t epoch = slots_[i].epoch.load(std::memory_order_seq_cst);
+        if (epoch && epoch < oldest)
+        {
+          oldest = epoch;
+        }
+      }
+      std::size_t nFreed = 0;
+      for (; nFreed < retired_.size() && retired_[nFreed].first < oldest; ++nFreed)
+      {
+        Core::destroyNode(retired_[nFreed].second);
+      }
+      retired_.erase(retired_.begin(), retired_.begin() + static_cast< std::ptrdiff_t >(nFreed));
+    }
+
+    void destroyTree(Node* root) noexcept
+    {
+      if (root)
+      {
+        destroyTree(root->left);
+        destroyTree(root->right);
+        Core::destroyNode(root);
+      }
+    }
+    void retireTree(Node* root)
+    {
+      if (root)
+      {
+        retireTree(root->left);
+        retireTree(root->right);
+        Core::dropNode(root);
+      }
+    }
+
+    std::atomic< Node* > root_;
+    std::atomic< std::size_t > size_;
+    std::atomic< std::uint64_t > epoch_;
+    std::size_t nSlots_;
+    std::unique_ptr< ReaderSlot[] > slots_;
+    std::vector< std::pair< std::uint64_t, Node* > > retired_;
+    mutable std::mutex writeMutex_;
+  };
+}
+#endif
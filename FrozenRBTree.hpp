@@ -0,0 +1,351 @@
+#ifndef FROZEN_RBTREE_HPP
+#define FROZEN_RBTREE_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+#include "FrozenRBTreeIterator.hpp"
+#include "RBTreeSimd.hpp"
+#include "RBTreeTraits.hpp"
+
+namespace demidenko
+{
+  // Immutable sorted map laid out in Eytzinger (breadth-first) order, usually made by RBTree::freeze().
+  // A search is a branch-free walk down one array of keys that prefetches the cache line holding its descendants
+  // a few levels down. Values are kept apart in the same order so that they never dilute the lines of the keys.
+  // They hold their whole pairs, keys included, so that iterators yield a real value_type& as every other map
+  // here does: the second copy of each key costs memory but no search ever reads it.
+  template < class K,
+    class T,
+    class Compare = std::less< K >,
+    class Allocator = std::allocator< std::pair< const K, T > > >
+  class FrozenRBTree
+  {
+  public:
+    using value_type = std::pair< const K, T >;
+    using const_iterator = FrozenRBTreeIterator< value_type >;
+    using iterator = const_iterator;
+    using key_type = const K;
+    using mapped_type = T;
+    using allocator_type = Allocator;
+
+    FrozenRBTree():
+      keys_(nullptr),
+      values_(nullptr),
+      size_(0),
+      compare_({}),
+      alloc_()
+    {}
+    // Builds from a strictly ascending range.
+    template < class ForwardIt >
+    FrozenRBTree(ForwardIt first, ForwardIt last, Compare compare = Compare(), const Allocator& alloc = Allocator()):
+      FrozenRBTree(first, last, static_cast< std::size_t >(std::distance(first, last)), compare, alloc)
+    {}
+    // The same from a range of exactly n elements, whose length is known already.
+    template < class InputIt >
+    FrozenRBTree(InputIt first,
+      InputIt last,
+      std::size_t n,
+      Compare compare = Compare(),
+      const Allocator& alloc = Allocator()):
+      keys_(nullptr),
+      values_(nullptr),
+      size_(0),
+      compare_(compare),
+      alloc_(alloc)
+    {
+      build(first, last, n);
+    }
+    FrozenRBTree(const FrozenRBTree< K, T, Compare, Allocator >& src):
+      FrozenRBTree(src, ValueTraits::select_on_container_copy_construction(src.alloc_))
+    {}
+    FrozenRBTree(const FrozenRBTree< K, T, Compare, Allocator >& src, const Allocator& alloc):
+      keys_(nullptr),
+      values_(nullptr),
+      size_(0),
+      compare_(src.compare_),
+      alloc_(alloc)
+    {
+      build(src.begin(), src.end(), src.size_);
+    }
+    FrozenRBTree(FrozenRBTree< K, T, Compare, Allocator >&& src) noexcept:
+      keys_(src.keys_),
+      values_(src.values_),
+      size_(src.size_),
+      compare_(std::move(src.compare_)),
+      alloc_(std::move(src.alloc_))
+    {
+      src.keys_ = nullptr;
+      src.values_ = nullptr;
+      src.size_ = 0;
+    }
+    FrozenRBTree< K, T, Compare, Allocator >& operator=(const FrozenRBTree< K, T, Compare, Allocator >& src)
+    {
+      constexpr bool propagate = ValueTraits::propagate_on_container_copy_assignment::value;
+      FrozenRBTree< K, T, Compare, Allocator > newTree(src, propagate ? ValueAllocator(src.alloc_) : alloc_);
+      swapContents(newTree);
+      return *this;
+    }
+    FrozenRBTree< K, T, Compare, Allocator >& operator=(FrozenRBTree< K, T, Compare, Allocator >&& src) noexcept(
+      ValueTraits::propagate_on_container_move_assignment::value || ValueTraits::is_always_equal::value)
+    {
+      if constexpr (!ValueTraits::propagate_on_container_move_assignment::value)
+      {
+        if (alloc_ != src.alloc_)
+        {
+          return *this = static_cast< const FrozenRBTree< K, T, Compare, Allocator >& >(src);
+        }
+      }
+      swapContents(src);
+      return *this;
+    }
+    virtual ~FrozenRBTree()
+    {
+      destroyFirst(size_);
+      deallocate();
+    }
+    allocator_type get_allocator() const
+    {
+      return allocator_type(alloc_);
+    }
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+    const T& at(const K& key) const
+    {
+      return atSlot(key);
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const T& at(const Key& key) const
+    {
+      return atSlot(key);
+    }
+    int count(const K& key) const
+    {
+      return equalSlot(key) != 0;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    int count(const Key& key) const
+    {
+      return equalSlot(key) != 0;
+    }
+    const_iterator find(const K& key) const
+    {
+      return toIterator(equalSlot(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator find(const Key& key) const
+    {
+      return toIterator(equalSlot(key));
+    }
+    const_iterator lowerBound(const K& key) const
+    {
+      return toIterator(boundSlot< false >(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator lowerBound(const Key& key) const
+    {
+      return toIterator(boundSlot< false >(key));
+    }
+    const_iterator upperBound(const K& key) const
+    {
+      return toIterator(boundSlot< true >(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator upperBound(const Key& key) const
+    {
+      return toIterator(boundSlot< true >(key));
+    }
+    std::pair< const_iterator, const_iterator > equalRange(const K& key) const
+    {
+      std::size_t slot = boundSlot< false >(key);
+      const_iterator first = toIterator(slot);
+      return { first, slot && !isLess(key, keys_[slot]) ? std::next(first) : first };
+    }
+    const_iterator begin() const
+    {
+      return toIterator(detail::eytzingerFirst(size_));
+    }
+    const_iterator cbegin() const
+    {
+      return begin();
+    }
+    const_iterator end() const
+    {
+      return toIterator(0);
+    }
+    const_iterator cend() const
+    {
+      return end();
+    }
+
+  private:
+    using KeyAllocator = typename std::allocator_traits< Allocator >::template rebind_alloc< K >;
+    using KeyTraits = std::allocator_traits< KeyAllocator >;
+    using ValueAllocator = typename std::allocator_traits< Allocator >::template rebind_alloc< value_type >;
+    using ValueTraits = std::allocator_traits< ValueAllocator >;
+    static constexpr bool IS_THREE_WAY = detail::IsThreeWay< Compare, K >::value;
+    static constexpr std::size_t CACHE_LINE = 64;
+    // Slots of one level that fit a cache line: the descendants of k that many levels down are contiguous.
+    static constexpr std::size_t prefetchStride()
+    {
+      std::size_t stride = 1;
+      while (stride * 2 * sizeof(K) <= CACHE_LINE)
+      {
+        stride *= 2;
+      }
+      return stride;
+    }
+
+    // Both arrays are indexed from 1, slot 0 is never constructed.
+    template < class InputIt >
+    void build(InputIt first, InputIt last, std::size_t n)
+    {
+      if (n == 0)
+      {
+        return;
+      }
+      KeyAllocator keyAlloc(alloc_);
+      keys_ = KeyTraits::allocate(keyAlloc, n + 1);
+      try
+      {
+        values_ = ValueTraits::allocate(alloc_, n + 1);
+      }
+      catch (...)
+      {
+        KeyTraits::deallocate(keyAlloc, keys_, n + 1);
+        keys_ = nullptr;
+        throw;
+      }
+      size_ = n;
+      std::size_t built = 0;
+      try
+      {
+        std::size_t previous = 0;
+        for (std::size_t k = detail::eytzingerFirst(n); first != last; ++first, ++built)
+        {
+          // Slot 0 past the last of n slots: the range is longer than n.
+          assert(k != 0);
+          const value_type& value = *first;
+          if (previous && !isLess(keys_[previous], value.first))
+          {
+            throw std::invalid_argument("Range is not strictly ascending\n");
+          }
+          ::new (static_cast< void* >(keys_ + k)) K(value.first);
+          try
+          {
+            ::new (static_cast< void* >(values_ + k)) value_type(value);
+          }
+          catch (...)
+          {
+            keys_[k].~K();
+            throw;
+          }
+          previous = k;
+          k = detail::eytzingerNext(k, n);
+        }
+        assert(built == n);
+      }
+      catch (...)
+      {
+        destroyFirst(built);
+        deallocate();
+        throw;
+      }
+    }
+    // Destroys the first n slots in key order.
+    void destroyFirst(std::size_t n) noexcept
+    {
+      for (std::size_t k = detail::eytzingerFirst(size_); n > 0; --n, k = detail::eytzingerNext(k, size_))
+      {
+        keys_[k].~K();
+        values_[k].~value_type();
+      }
+    }
+    void deallocate() noexcept
+    {
+      if (keys_)
+      {
+        KeyAllocator keyAlloc(alloc_);
+        KeyTraits::deallocate(keyAlloc, keys_, size_ + 1);
+        ValueTraits::deallocate(alloc_, values_, size_ + 1);
+      }
+      keys_ = nullptr;
+      values_ = nullptr;
+      size_ = 0;
+    }
+    void swapContents(FrozenRBTree< K, T, Compare, Allocator >& other) noexcept
+    {
+      std::swap(keys_, other.keys_);
+      std::swap(values_, other.values_);
+      std::swap(size_, other.size_);
+      std::swap(compare_, other.compare_);
+      std::swap(alloc_, other.alloc_);
+    }
+
+    // Goes right whenever the slot is less than key (not greater than key when UPPER).
+    // The first slot where the walk turned left for the last time is the bound, 0 if it never did.
+    template < bool UPPER, class Key >
+    std::size_t boundSlot(const Key& key) const
+    {
+      constexpr std::size_t STRIDE = prefetchStride();
+      std::uintptr_t base = reinterpret_cast< std::uintptr_t >(keys_);
+      std::size_t k = 1;
+      while (k <= size_)
+      {
+        detail::prefetch(base + k * STRIDE * sizeof(K));
+        k = 2 * k + static_cast< std::size_t >(UPPER ? !isLess(key, keys_[k]) : isLess(keys_[k], key));
+      }
+      return k >> (detail::countTrailingZeros(~k) + 1);
+    }
+    template < class Key >
+    std::size_t equalSlot(const Key& key) const
+    {
+      std::size_t slot = boundSlot< false >(key);
+      return slot && !isLess(key, keys_[slot]) ? slot : 0;
+    }
+    template < class Key >
+    const T& atSlot(const Key& key) const
+    {
+      std::size_t slot = equalSlot(key);
+      if (!slot)
+      {
+        throw std::out_of_range("There are no such element\n");
+      }
+      return values_[slot].second;
+    }
+    const_iterator toIterator(std::size_t slot) const
+    {
+      return const_iterator(values_, slot, size_);
+    }
+    template < class First, class Second >
+    bool isLess(const First& first, const Second& second) const
+    {
+      if constexpr (IS_THREE_WAY)
+      {
+        return compare_(first, second) < 0;
+      }
+      else
+      {
+        return compare_(first, second);
+      }
+    }
+
+    K* keys_;
+    value_type* values_;
+    std::size_t size_;
+    Compare compare_;
+    ValueAllocator alloc_;
+  };
+}
+#endif
@@ -0,0 +1,138 @@
+#ifndef FROZEN_RBTREE_ITERATOR_HPP
+#define FROZEN_RBTREE_ITERATOR_HPP
+
+#include <cstddef>
+#include <iterator>
+#include "RBTreeSimd.hpp"
+
+namespace demidenko
+{
+  namespace detail
+  {
+    // In-order walk over an implicit tree of n slots numbered from 1, children of k being 2k and 2k + 1.
+    // Slot 0 stands for the end.
+    inline std::size_t eytzingerFirst(std::size_t n) noexcept
+    {
+      std::size_t k = n ? 1 : 0;
+      while (2 * k <= n && k)
+      {
+        k *= 2;
+      }
+      return k;
+    }
+    inline std::size_t eytzingerLast(std::size_t n) noexcept
+    {
+      std::size_t k = n ? 1 : 0;
+      while (2 * k + 1 <= n && k)
+      {
+        k = 2 * k + 1;
+      }
+      return k;
+    }
+    inline std::size_t eytzingerNext(std::size_t k, std::size_t n) noexcept
+    {
+      if (2 * k + 1 <= n)
+      {
+        k = 2 * k + 1;
+        while (2 * k <= n)
+        {
+          k *= 2;
+        }
+        return k;
+      }
+      // Up past every ancestor we are the right child of, then once more.
+      return k >> (countTrailingZeros(~k) + 1);
+    }
+    inline std::size_t eytzingerPrevious(std::size_t k, std::size_t n) noexcept
+    {
+      if (k == 0)
+      {
+        return eytzingerLast(n);
+      }
+      if (2 * k <= n)
+      {
+        k *= 2;
+        while (2 * k + 1 <= n)
+        {
+          k = 2 * k + 1;
+        }
+        return k;
+      }
+      return k >> (countTrailingZeros(k) + 1);
+    }
+  }
+
+  template < class K, class T, class Compare, class Allocator >
+  class FrozenRBTree;
+
+  template < class Value >
+  class FrozenRBTreeIterator
+  {
+    template < class, class, class, class >
+    friend class FrozenRBTree;
+
+  public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = const Value;
+    using reference = value_type&;
+    using pointer = value_type*;
+    using iterator_category = std::bidirectional_iterator_tag;
+
+    FrozenRBTreeIterator(const FrozenRBTreeIterator&) = default;
+    ~FrozenRBTreeIterator() = default;
+    FrozenRBTreeIterator< Value >& operator=(const FrozenRBTreeIterator< Value >&) = default;
+    FrozenRBTreeIterator< Value >& operator++()
+    {
+      index_ = detail::eytzingerNext(index_, size_);
+      return *this;
+    }
+    FrozenRBTreeIterator< Value > operator++(int)
+    {
+      FrozenRBTreeIterator< Value > temp(*this);
+      ++*this;
+      return temp;
+    }
+    // Unlike the tree iterators, end() can be decremented.
+    FrozenRBTreeIterator< Value >& operator--()
+    {
+      index_ = detail::eytzingerPrevious(index_, size_);
+      return *this;
+    }
+    FrozenRBTreeIterator< Value > operator--(int)
+    {
+      FrozenRBTreeIterator< Value > temp(*this);
+      --*this;
+      return temp;
+    }
+
+    value_type& operator*() const
+    {
+      return values_[index_];
+    }
+    value_type* operator->() const
+    {
+      return values_ + index_;
+    }
+
+    bool operator==(const FrozenRBTreeIterator< Value >& other) const
+    {
+      return values_ == other.values_ && index_ == other.index_;
+    }
+    bool operator!=(const FrozenRBTreeIterator< Value >& other) const
+    {
+      return !(*this == other);
+    }
+
+  private:
+    FrozenRBTreeIterator(const Value* values, std::size_t index, std::size_t size):
+      values_(values),
+      index_(index),
+      size_(size)
+    {}
+    const Value* values_;
+    std::size_t index_;
+    std::size_t size_;
+  };
+}
+
+#endif
@@ -0,0 +1,261 @@
+#ifndef MAPPED_RBTREE_HPP
+#define MAPPED_RBTREE_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "RBTreeSerialization.hpp"
+#include "RBTreeTraits.hpp"
+
+namespace demidenko
+{
+  // Read-only view of a file written by RBTree::serialize(), searched straight in its mapped pages.
+  // Opening costs one mmap whatever the size: pages are read in by the searches that touch them.
+  // The keys are trusted to be ascending, as serialize() writes them; deserialize() checks instead.
+  template < class K, class T, class Compare = std::less< K > >
+  class MappedRBTree
+  {
+  public:
+    using value_type = std::pair< const K, T >;
+    using const_iterator = SerializedIterator< K, T >;
+    using iterator = const_iterator;
+    using key_type = const K;
+    using mapped_type = T;
+
+    explicit MappedRBTree(const std::string& path, Compare compare = Compare()):
+      data_(nullptr),
+      bytes_(0),
+      keys_(nullptr),
+      values_(nullptr),
+      size_(0),
+      compare_(compare)
+    {
+      detail::checkSerializable< K, T >();
+      int file = ::open(path.c_str(), O_RDONLY);
+      if (file < 0)
+      {
+        throw std::system_error(errno, std::generic_category(), "Could not open " + path);
+      }
+      struct stat status;
+      if (::fstat(file, &status) != 0)
+      {
+        int error = errno;
+        ::close(file);
+        throw std::system_error(error, std::generic_category(), "Could not stat " + path);
+      }
+      bytes_ = static_cast< std::size_t >(status.st_size);
+      if (bytes_ < sizeof(detail::SerializedHeader))
+      {
+        ::close(file);
+        throw std::invalid_argument("Stream holds no serialized tree of these types\n");
+      }
+      void* data = ::mmap(nullptr, bytes_, PROT_READ, MAP_SHARED, file, 0);
+      int error = errno;
+      ::close(file);
+      if (data == MAP_FAILED)
+      {
+        throw std::system_error(error, std::generic_category(), "Could not map " + path);
+      }
+      data_ = static_cast< const char* >(data);
+      try
+      {
+        std::uint64_t total = detail::checkSerializedHeader< K, T >(
+          detail::loadObject< detail::SerializedHeader >(data_));
+        if (total > bytes_)
+        {
+          throw std::invalid_argument("Stream holds no serialized tree of these types\n");
+        }
+      }
+      catch (...)
+      {
+        unmap();
+        throw;
+      }
+      detail::SerializedHeader header = detail::loadObject< detail::SerializedHeader >(data_);
+      keys_ = data_ + sizeof(detail::SerializedHeader);
+      values_ = data_ + header.valuesOffset;
+      size_ = static_cast< std::size_t >(header.count);
+    }
+    MappedRBTree(const MappedRBTree< K, T, Compare >&) = delete;
+    MappedRBTree< K, T, Compare >& operator=(const MappedRBTree< K, T, Compare >&) = delete;
+    MappedRBTree(MappedRBTree< K, T, Compare >&& src) noexcept:
+      data_(src.data_),
+      bytes_(src.bytes_),
+      keys_(src.keys_),
+      values_(src.values_),
+      size_(src.size_),
+      compare_(std::move(src.compare_))
+    {
+      src.data_ = nullptr;
+      src.size_ = 0;
+    }
+    MappedRBTree< K, T, Compare >& operator=(MappedRBTree< K, T, Compare >&& src) noexcept
+    {
+      std::swap(data_, src.data_);
+      std::swap(bytes_, src.bytes_);
+      std::swap(keys_, src.keys_);
+      std::swap(values_, src.values_);
+      std::swap(size_, src.size_);
+      std::swap(compare_, src.compare_);
+      return *this;
+    }
+    virtual ~MappedRBTree()
+    {
+      unmap();
+    }
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+    // A copy, values being read out of the mapped bytes.
+    T at(const K& key) const
+    {
+      return toIterator(atIndex(key)).value();
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    T at(const Key& key) const
+    {
+      return toIterator(atIndex(key)).value();
+    }
+    int count(const K& key) const
+    {
+      return equalIndex(key) != size_;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    int count(const Key& key) const
+    {
+      return equalIndex(key) != size_;
+    }
+    const_iterator find(const K& key) const
+    {
+      return toIterator(equalIndex(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator find(const Key& key) const
+    {
+      return toIterator(equalIndex(key));
+    }
+    const_iterator lowerBound(const K& key) const
+    {
+      return toIterator(boundIndex< false >(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator lowerBound(const Key& key) const
+    {
+      return toIterator(boundIndex< false >(key));
+    }
+    const_iterator upperBound(const K& key) const
+    {
+      return toIterator(boundIndex< true >(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator upperBound(const Key& key) const
+    {
+      return toIterator(boundIndex< true >(key));
+    }
+    const_iterator begin() const
+    {
+      return toIterator(0);
+    }
+    const_iterator cbegin() const
+    {
+      return begin();
+    }
+    const_iterator end() const
+    {
+      return toIterator(size_);
+    }
+    const_iterator cend() const
+    {
+      return end();
+    }
+
+  private:
+    static constexpr bool IS_THREE_WAY = detail::IsThreeWay< Compare, K >::value;
+
+    void unmap() noexcept
+    {
+      if (data_)
+      {
+        ::munmap(const_cast< char* >(data_), bytes_);
+        data_ = nullptr;
+      }
+    }
+    const_iterator toIterator(std::size_t index) const noexcept
+    {
+      return const_iterator(keys_, values_, index);
+    }
+    K keyAt(std::size_t index) const noexcept
+    {
+      return detail::loadObject< K >(keys_ + index * sizeof(K));
+    }
+    // First index whose key is not less than key, or greater than it when UPPER. The halving loop has no branch
+    // on the comparison to mispredict.
+    template < bool UPPER, class Key >
+    std::size_t boundIndex(const Key& key) const
+    {
+      std::size_t first = 0;
+      for (std::size_t n = size_; n > 1;)
+      {
+        std::size_t half = n / 2;
+        bool isBefore = UPPER ? !isLess(key, keyAt(first + half - 1)) : isLess(keyAt(first + half - 1), key);
+        first = isBefore ? first + half : first;
+        n -= half;
+      }
+      if (size_ && (UPPER ? !isLess(key, keyAt(first)) : isLess(keyAt(first), key)))
+      {
+        ++first;
+      }
+      return first;
+    }
+    template < class Key >
+    std::size_t equalIndex(const Key& key) const
+    {
+      std::size_t index = boundIndex< false >(key);
+      return index != size_ && !isLess(key, keyAt(index)) ? index : size_;
+    }
+    template < class Key >
+    std::size_t atIndex(const Key& key) const
+    {
+      std::size_t index = equalIndex(key);
+      if (index == size_)
+      {
+        throw std::out_of_range("There are no such element\n");
+      }
+      return index;
+    }
+    template < class First, class Second >
+    bool isLess(const First& first, const Second& second) const
+    {
+      if constexpr (IS_THREE_WAY)
+      {
+        return compare_(first, second) < 0;
+      }
+      else
+      {
+        return compare_(first, second);
+      }
+    }
+
+    const char* data_;
+    std::size_t bytes_;
+    const char* keys_;
+    const char* values_;
+    std::size_t size_;
+    Compare compare_;
+  };
+}
+#endif
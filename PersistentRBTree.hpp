@@ -0,0 +1,274 @@
+#ifndef PERSISTENT_RBTREE_HPP
+#define PERSISTENT_RBTREE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+#include "RBTreePathCopy.hpp"
+
+namespace demidenko
+{
+  // Sorted map whose copies are O(1) snapshots sharing their nodes.
+  // An update copies the O(log n) nodes of its path, joins included, and leaves every other version as it was.
+  // Nodes are reference counted: the last version to let go of one frees it, with its own allocator.
+  // Every version therefore takes the allocator of the version it was made from, copies included, so that
+  // PoolAllocator versions share one arena. That arena is not thread-safe: unlike std::allocator versions,
+  // pooled ones must be updated and dropped on one thread at a time.
+  template < class K,
+    class T,
+    class Compare = std::less< K >,
+    class Allocator = std::allocator< std::pair< const K, T > > >
+  class PersistentRBTree: private PathCopyCore< detail::PathNode< K, T, true >, Compare, Allocator >
+  {
+    using Node = detail::PathNode< K, T, true >;
+    using Core = PathCopyCore< Node, Compare, Allocator >;
+    using typename Core::NodeTraits;
+    using typename Core::Subtree;
+    using typename Core::SplitResult;
+
+  public:
+    using value_type = typename Node::value_type;
+    using const_iterator = typename Core::const_iterator;
+    using iterator = const_iterator;
+    using key_type = const K;
+    using mapped_type = T;
+    using allocator_type = Allocator;
+
+    PersistentRBTree():
+      PersistentRBTree(Compare())
+    {}
+    PersistentRBTree(Compare compare, const Allocator& alloc = Allocator()):
+      Core(compare, alloc),
+      root_(nullptr),
+      size_(0)
+    {}
+    explicit PersistentRBTree(const Allocator& alloc):
+      PersistentRBTree(Compare(), alloc)
+    {}
+    // Shares every node of src, and its allocator to free them.
+    PersistentRBTree(const PersistentRBTree< K, T, Compare, Allocator >& src):
+      Core(src.compare_, src.alloc_, src.version_),
+      root_(retain(src.root_)),
+      size_(src.size_)
+    {}
+    PersistentRBTree(PersistentRBTree< K, T, Compare, Allocator >&& src) noexcept:
+      Core(std::move(src.compare_), std::move(src.alloc_), src.version_),
+      root_(src.root_),
+      size_(src.size_)
+    {
+      src.root_ = nullptr;
+      src.size_ = 0;
+    }
+    PersistentRBTree< K, T, Compare, Allocator >& operator=(const PersistentRBTree< K, T, Compare, Allocator >& src)
+    {
+      PersistentRBTree< K, T, Compare, Allocator > shared(src);
+      // Every node reachable from here must be older than the next update.
+      shared.version_ = std::max(Core::version_, src.version_);
+      return *this = std::move(shared);
+    }
+    PersistentRBTree< K, T, Compare, Allocator >& operator=(PersistentRBTree< K, T, Compare, Allocator >&& src) noexcept
+    {
+      std::swap(root_, src.root_);
+      std::swap(size_, src.size_);
+      std::swap(Core::version_, src.version_);
+      std::swap(Core::compare_, src.compare_);
+      std::swap(Core::alloc_, src.alloc_);
+      return *this;
+    }
+    virtual ~PersistentRBTree()
+    {
+      release(root_);
+    }
+    allocator_type get_allocator() const
+    {
+      return allocator_type(Core::alloc_);
+    }
+    // The current version, sharing every node. Same as a copy.
+    PersistentRBTree< K, T, Compare, Allocator > snapshot() const
+    {
+      return *this;
+    }
+    std::size_t size() const noexcept
+    {
+      return size_;
+    }
+    bool empty() const noexcept
+    {
+      return size_ == 0;
+    }
+    void clear() noexcept
+    {
+      release(root_);
+      root_ = nullptr;
+      size_ = 0;
+    }
+    // Updates either make the whole new version or leave the tree as it was.
+    bool insert(const K& key, const T& value)
+    {
+      return emplace(key, value);
+    }
+    template < class... Args >
+    bool emplace(const K& key, Args&&... args)
+    {
+      if (Core::findEqualNode(root_, key))
+      {
+        return false;
+      }
+      update([&] {
+        Node* pivot = Core::createNode(std::piecewise_construct,
+          std::forward_as_tuple(key),
+          std::forward_as_tuple(std::forward< Args >(args)...));
+        SplitResult parts = Core::splitNodes(Core::wholeTree(root_), key);
+        return Core::joinNodes(parts.less, pivot, parts.greater).root;
+      });
+      ++size_;
+      return true;
+    }
+    std::size_t erase(const K& key)
+    {
+      return eraseKey(key);
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    std::size_t erase(const Key& key)
+    {
+      return eraseKey(key);
+    }
+    const T& at(const K& key) const
+    {
+      return atNode(key)->value.second;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const T& at(const Key& key) const
+    {
+      return atNode(key)->value.second;
+    }
+    int count(const K& key) const
+    {
+      return Core::findEqualNode(root_, key) != nullptr;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    int count(const Key& key) const
+    {
+      return Core::findEqualNode(root_, key) != nullptr;
+    }
+    const_iterator find(const K& key) const
+    {
+      return Core::findAt(root_, key);
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator find(const Key& key) const
+    {
+      return Core::findAt(root_, key);
+    }
+    const_iterator lowerBound(const K& key) const
+    {
+      return Core::template boundAt< false >(root_, key);
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator lowerBound(const Key& key) const
+    {
+      return Core::template boundAt< false >(root_, key);
+    }
+    const_iterator upperBound(const K& key) const
+    {
+      return Core::template boundAt< true >(root_, key);
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator upperBound(const Key& key) const
+    {
+      return Core::template boundAt< true >(root_, key);
+    }
+    const_iterator begin() const
+    {
+      return Core::beginAt(root_);
+    }
+    const_iterator cbegin() const
+    {
+      return begin();
+    }
+    const_iterator end() const
+    {
+      return const_iterator();
+    }
+    const_iterator cend() const
+    {
+      return end();
+    }
+    bool isRBTree() const
+    {
+      return Core::colorOf(root_) == Core::Color::Black && Core::isWeakRBTree(root_);
+    }
+
+  private:
+    template < class Key >
+    std::size_t eraseKey(const Key& key)
+    {
+      if (!Core::findEqualNode(root_, key))
+      {
+        return 0;
+      }
+      update([&] {
+        SplitResult parts = Core::splitNodes(Core::wholeTree(root_), key);
+        Core::dropNode(parts.equal);
+        return Core::joinSubtrees(parts.less, parts.greater).root;
+      });
+      --size_;
+      return 1;
+    }
+    template < class Key >
+    const Node* atNode(const Key& key) const
+    {
+      const Node* result = Core::findEqualNode(root_, key);
+      if (!result)
+      {
+        throw std::out_of_range("There are no such element\n");
+      }
+      return result;
+    }
+    // The new version points to the children of every replaced node, which gain a reference first.
+    // Only then do the replaced nodes lose the one of their old parent, so the order they come in does not matter.
+    template < class Build >
+    void update(Build&& build)
+    {
+      root_ = Core::buildUpdate(build);
+      for (Node* node : Core::replaced_)
+      {
+        retain(node->left);
+        retain(node->right);
+      }
+      for (Node* node : Core::replaced_)
+      {
+        release(node);
+      }
+      Core::created_.clear();
+      Core::replaced_.clear();
+    }
+    static Node* retain(Node* node) noexcept
+    {
+      if (node)
+      {
+        node->refs.fetch_add(1, std::memory_order_relaxed);
+      }
+      return node;
+    }
+    void release(Node* node) noexcept
+    {
+      while (node && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+        release(node->left);
+        Node* next = node->right;
+        Core::destroyNode(node);
+        node = next;
+      }
+    }
+
+    Node* root_;
+    std::size_t size_;
+  };
+}
+#endif
@@ -1,76 +1,284 @@
 #ifndef RBTREE_HPP
 #define RBTREE_HPP
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <functional>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <new>
 #include <ostream>
 #include <queue>
 #include <stdexcept>
+#include <tuple>
+#include <type_traits>
 #include <utility>
+#include <vector>
+#include "FrozenRBTree.hpp"
 #include "RBTreeIterator.hpp"
+#include "RBTreeMemory.hpp"
 #include "RBTreeNode.hpp"
+#include "RBTreeNodeHandle.hpp"
+#include "RBTreeOptions.hpp"
+#include "RBTreeParallel.hpp"
+#include "RBTreeSerialization.hpp"
+#include "RBTreeSimd.hpp"
+#include "RBTreeStats.hpp"
+#include "RBTreeTraits.hpp"
 
 namespace demidenko
 {
-  template < class K, class T, class Compare = std::less< K > >
-  class RBTree
+  template < class K,
+    class T,
+    class Compare = std::less< K >,
+    class Allocator = std::allocator< std::pair< const K, T > >,
+    class Options = DefaultOptions >
+  class RBTree: private detail::StatsCounter< Options::collectStats >,
+                private detail::FingerCache< detail::Node< K, T, Options >, Options::fingerSearch >,
+                private detail::Graveyard< detail::Node< K, T, Options >, Options::tombstones >
   {
+    using Node = detail::Node< K, T, Options >;
+    using Counter = detail::StatsCounter< Options::collectStats >;
+    using Finger = detail::FingerCache< Node, Options::fingerSearch >;
+    using Graveyard = detail::Graveyard< Node, Options::tombstones >;
+    using Augment = typename Options::Augment;
+    static constexpr bool HAS_AUGMENT = !std::is_same< Augment, NoAugment >::value;
+    static_assert(!(Options::tombstones && Options::orderStatistic), "subtree sizes would count the tombstones");
+
   public:
-    using iterator = RBTreeIterator< K, T, Compare, false >;
-    using const_iterator = RBTreeIterator< K, T, Compare, true >;
+    using iterator = RBTreeIterator< Node, false >;
+    using const_iterator = RBTreeIterator< Node, true >;
     using value_type = typename iterator::value_type;
     using key_type = const K;
     using mapped_type = T;
+    using allocator_type = Allocator;
+    using node_type = RBTreeNodeHandle< Node, typename std::allocator_traits< Allocator >::template rebind_alloc< Node > >;
+    // The value_type of Options::Augment, void without one.
+    using aggregate_type = typename detail::AggregateType< Augment >::type;
 
     RBTree():
       root_(nullptr),
-      compare_({})
+      size_(0),
+      compare_({}),
+      alloc_()
+    {}
+    RBTree(Compare compare, const Allocator& alloc = Allocator()):
+      root_(nullptr),
+      size_(0),
+      compare_(compare),
+      alloc_(alloc)
     {}
-    RBTree(Compare compare):
+    explicit RBTree(const Allocator& alloc):
       root_(nullptr),
-      compare_(compare)
+      size_(0),
+      compare_({}),
+      alloc_(alloc)
+    {}
+    RBTree(const RBTree< K, T, Compare, Allocator, Options >& src):
+      RBTree(src, NodeTraits::select_on_container_copy_construction(src.alloc_))
     {}
-    RBTree(const RBTree< K, T, Compare >& src):
+    RBTree(const RBTree< K, T, Compare, Allocator, Options >& src, const Allocator& alloc):
+      root_(nullptr),
+      size_(0),
       compare_(src.compare_),
-      root_(nullptr)
+      alloc_(alloc)
+    {
+      copyFrom(src.root_, src.size_);
+      Graveyard::addTombstones(src.nTombstones());
+    }
+    // Allocates every node up front on the calling thread, then copies the values of large subtrees in parallel.
+    RBTree(const RBTree< K, T, Compare, Allocator, Options >& src, ParallelPolicy policy):
+      RBTree(src.compare_, NodeTraits::select_on_container_copy_construction(src.alloc_))
     {
-      if (src.root_)
+      std::size_t n = src.size_;
+      if (n == 0 || policy.nThreads <= 1 || n < policy.grain)
       {
-        try
+        copyFrom(src.root_, n);
+        Graveyard::addTombstones(src.nTombstones());
+        return;
+      }
+      if constexpr (detail::HasReserve< NodeAllocator >::value)
+      {
+        alloc_.reserve(n);
+      }
+      std::vector< Node* > slots;
+      slots.reserve(n);
+      try
+      {
+        while (slots.size() < n)
         {
-          root_ = new Node{ src.root_->value, Color::Black };
-          copyTree(src.root_, root_);
+          slots.push_back(NodeTraits::allocate(alloc_, 1));
+          Counter::countAllocation();
         }
-        catch (...)
+        copyParallel(src.root_, nullptr, slots.data(), n, policy.nThreads, policy.grain);
+      }
+      catch (...)
+      {
+        for (Node* slot : slots)
         {
-          clear();
+          NodeTraits::deallocate(alloc_, slot, 1);
+          Counter::countDeallocation();
         }
+        throw;
       }
+      root_ = slots.front();
+      size_ = n;
+      Graveyard::addTombstones(src.nTombstones());
     }
-    RBTree(RBTree< K, T, Compare >&& src) noexcept:
-      root_(src.root_)
+    RBTree(RBTree< K, T, Compare, Allocator, Options >&& src) noexcept:
+      root_(src.root_),
+      size_(src.size_),
+      compare_(std::move(src.compare_)),
+      alloc_(std::move(src.alloc_))
     {
+      src.forgetFinger();
+      Graveyard::swapTombstones(src);
       src.root_ = nullptr;
+      src.size_ = 0;
     }
-    RBTree< K, T, Compare >& operator=(const RBTree< K, T, Compare >& src)
+    RBTree< K, T, Compare, Allocator, Options >& operator=(const RBTree< K, T, Compare, Allocator, Options >& src)
     {
-      RBTree< K, T, Compare > newTree(src);
+      constexpr bool propagate = NodeTraits::propagate_on_container_copy_assignment::value;
+      RBTree< K, T, Compare, Allocator, Options > newTree(src, propagate ? NodeAllocator(src.alloc_) : alloc_);
+      Finger::forgetFinger();
       std::swap(root_, newTree.root_);
+      std::swap(size_, newTree.size_);
+      Graveyard::swapTombstones(newTree);
       std::swap(compare_, newTree.compare_);
+      std::swap(alloc_, newTree.alloc_);
       return *this;
     }
-    RBTree< K, T, Compare >& operator=(RBTree< K, T, Compare >&& src) noexcept
+    RBTree< K, T, Compare, Allocator, Options >& operator=(RBTree< K, T, Compare, Allocator, Options >&& src) noexcept(
+      NodeTraits::propagate_on_container_move_assignment::value || NodeTraits::is_always_equal::value)
     {
+      if constexpr (!NodeTraits::propagate_on_container_move_assignment::value)
+      {
+        if (alloc_ != src.alloc_)
+        {
+          return *this = static_cast< const RBTree< K, T, Compare, Allocator, Options >& >(src);
+        }
+      }
+      Finger::forgetFinger();
+      src.forgetFinger();
       std::swap(root_, src.root_);
+      std::swap(size_, src.size_);
+      Graveyard::swapTombstones(src);
       std::swap(compare_, src.compare_);
+      if constexpr (NodeTraits::propagate_on_container_move_assignment::value)
+      {
+        std::swap(alloc_, src.alloc_);
+      }
       return *this;
     }
     virtual ~RBTree()
     {
       clear();
     }
+    // O(1), allocating nothing. Allocators are swapped if they propagate on swap, and must be equal otherwise.
+    void swap(RBTree< K, T, Compare, Allocator, Options >& other) noexcept(
+      std::is_nothrow_swappable< Compare >::value)
+    {
+      using std::swap;
+      Finger::forgetFinger();
+      other.forgetFinger();
+      swap(root_, other.root_);
+      swap(size_, other.size_);
+      Graveyard::swapTombstones(other);
+      swap(compare_, other.compare_);
+      if constexpr (NodeTraits::propagate_on_container_swap::value)
+      {
+        swap(alloc_, other.alloc_);
+      }
+      else
+      {
+        assert(NodeTraits::is_always_equal::value || alloc_ == other.alloc_);
+      }
+    }
+    allocator_type get_allocator() const
+    {
+      return allocator_type(alloc_);
+    }
+    std::size_t size() const noexcept
+    {
+      return size_ - Graveyard::nTombstones();
+    }
+    bool empty() const noexcept
+    {
+      return size() == 0;
+    }
+    // What the allocator takes per node, its overhead included: a pool block, or an estimate of a heap one.
+    std::size_t nodeBytes() const
+    {
+      if constexpr (detail::HasMemoryUsage< NodeAllocator >::value)
+      {
+        std::size_t blockBytes = alloc_.memoryUsage().blockBytes;
+        if (blockBytes)
+        {
+          return blockBytes;
+        }
+      }
+      return detail::heapBlockBytes(sizeof(Node));
+    }
+    // A pool counts whole, slabs and free blocks included, as if no other container shared it.
+    RBTreeMemory memoryUsage() const
+    {
+      std::size_t payload = sizeof(value_type) + 3 * sizeof(Node*) + (Options::compactNodes ? 0 : sizeof(Color))
+        + (Options::orderStatistic ? sizeof(std::size_t) : 0)
+        + (HAS_AUGMENT ? sizeof(detail::SubtreeAggregate< Augment >) : 0);
+      RBTreeMemory result{ size_, sizeof(Node), sizeof(Node) - payload, nodeBytes(), sizeof(*this), 0 };
+      std::size_t held = size_ * result.blockBytes;
+      if constexpr (detail::HasMemoryUsage< NodeAllocator >::value)
+      {
+        auto usage = alloc_.memoryUsage();
+        if (usage.blockBytes)
+        {
+          std::size_t heapBytes = detail::heapBlockBytes(sizeof(Node));
+          held = usage.slabBytes + usage.fallbacks * heapBytes;
+          std::size_t used = usage.liveBlocks * usage.blockBytes + usage.fallbacks * heapBytes;
+          result.fragmentation = held ? 1 - static_cast< double >(used) / static_cast< double >(held) : 0;
+        }
+      }
+      result.totalBytes += held;
+      return result;
+    }
+    // Both need StatsOptions or alike. Copies and moved-to trees start counting from zero.
+    const RBTreeStats& stats() const noexcept
+    {
+      static_assert(Options::collectStats, "stats need Options::collectStats");
+      return Counter::stats_;
+    }
+    void resetStats() noexcept
+    {
+      static_assert(Options::collectStats, "stats need Options::collectStats");
+      Counter::stats_ = RBTreeStats();
+    }
+    // Both need TombstoneOptions or alike. compact() purges every tombstone in O(n), at a quiet time say.
+    std::size_t tombstones() const noexcept
+    {
+      static_assert(Options::tombstones, "tombstones need Options::tombstones");
+      return Graveyard::nTombstones();
+    }
+    void compact() noexcept
+    {
+      static_assert(Options::tombstones, "tombstones need Options::tombstones");
+      purgeTombstones();
+    }
     void clear() noexcept
     {
+      Finger::forgetFinger();
+      Graveyard::forgetTombstones();
+      if constexpr (std::is_trivially_destructible< Node >::value && detail::HasRelease< NodeAllocator >::value)
+      {
+        if (alloc_.release())
+        {
+          Counter::countDeallocation(size_);
+          root_ = nullptr;
+          size_ = 0;
+          return;
+        }
+      }
       Node* current = minNode(root_);
       while (current)
       {
@@ -84,234 +292,1769 @@ namespace demidenko
         }
         else
         {
-          Node* candidate = current->p;
+          Node* candidate = current->parent();
           while (candidate && candidate->right == current)
           {
-            delete current;
+            destroyNode(current);
             current = candidate;
-            candidate = candidate->p;
+            candidate = candidate->parent();
           }
-          delete current;
+          destroyNode(current);
           current = candidate;
         }
       }
       root_ = nullptr;
+      size_ = 0;
     }
     T& operator[](const K& key)
     {
-      Node* candidate = findNode(key);
-      if (!candidate || !areKeysEqual(key, candidate->value.first))
+      InsertPosition position = findInsertPosition(key);
+      if (position.existing)
       {
-        candidate = insert(key, T());
+        return position.existing->value.second;
       }
-      return candidate->value.second;
+      return insertNode(position, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple())->value.second;
     }
-    T& at(const K& key)
+    T& operator[](K&& key)
     {
-      Node* candidate = findNode(key);
-      if (candidate && areKeysEqual(key, candidate->value.first))
+      InsertPosition position = findInsertPosition(key);
+      if (position.existing)
       {
-        return candidate->value.second;
+        return position.existing->value.second;
       }
-      throw std::out_of_range("There are no such element\n");
+      return insertNode(position, std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple())
+        ->value.second;
+    }
+    T& at(const K& key)
+    {
+      return atNode(key)->value.second;
     }
     const T& at(const K& key) const
     {
-      Node* candidate = findNode(key);
-      if (candidate && areKeysEqual(key, candidate->value.first))
-      {
-        return candidate->value.second;
-      }
-      throw std::out_of_range("There are no such element\n");
+      return atNode(key)->value.second;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    T& at(const Key& key)
+    {
+      return atNode(key)->value.second;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const T& at(const Key& key) const
+    {
+      return atNode(key)->value.second;
     }
     int count(const K& key) const
     {
-      Node* candidate = findNode(key);
-      return candidate && areKeysEqual(key, candidate->value.first);
+      return findEqualNode(key) != nullptr;
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    int count(const Key& key) const
+    {
+      return findEqualNode(key) != nullptr;
+    }
+    iterator find(const K& key)
+    {
+      return iterator(findEqualNode(key));
+    }
+    const_iterator find(const K& key) const
+    {
+      return const_iterator(findEqualNode(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    iterator find(const Key& key)
+    {
+      return iterator(findEqualNode(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator find(const Key& key) const
+    {
+      return const_iterator(findEqualNode(key));
     }
     iterator lowerBound(const K& key)
     {
-      iterator iter{ findNode(key) };
-      if (iter != end() && compare_(*iter, key))
+      return iterator(lowerBoundNode(key));
+    }
+    const_iterator lowerBound(const K& key) const
+    {
+      return const_iterator(lowerBoundNode(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    iterator lowerBound(const Key& key)
+    {
+      return iterator(lowerBoundNode(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator lowerBound(const Key& key) const
+    {
+      return const_iterator(lowerBoundNode(key));
+    }
+    iterator upperBound(const K& key)
+    {
+      return iterator(upperBoundNode(key));
+    }
+    const_iterator upperBound(const K& key) const
+    {
+      return const_iterator(upperBoundNode(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    iterator upperBound(const Key& key)
+    {
+      return iterator(upperBoundNode(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    const_iterator upperBound(const Key& key) const
+    {
+      return const_iterator(upperBoundNode(key));
+    }
+    std::pair< iterator, iterator > equalRange(const K& key)
+    {
+      std::pair< Node*, Node* > range = equalRangeNodes(key);
+      return { iterator(range.first), iterator(range.second) };
+    }
+    std::pair< const_iterator, const_iterator > equalRange(const K& key) const
+    {
+      std::pair< Node*, Node* > range = equalRangeNodes(key);
+      return { const_iterator(range.first), const_iterator(range.second) };
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    std::pair< iterator, iterator > equalRange(const Key& key)
+    {
+      std::pair< Node*, Node* > range = equalRangeNodes(key);
+      return { iterator(range.first), iterator(range.second) };
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    std::pair< const_iterator, const_iterator > equalRange(const Key& key) const
+    {
+      std::pair< Node*, Node* > range = equalRangeNodes(key);
+      return { const_iterator(range.first), const_iterator(range.second) };
+    }
+    // Writes find(key) for every key of [first, last) to out, in order.
+    // Up to BATCH_LANES descents advance in lockstep, each prefetching its next node while the others compare,
+    // so that their cache misses overlap instead of adding up.
+    template < class ForwardIt, class OutputIt >
+    OutputIt findBatch(ForwardIt first, ForwardIt last, OutputIt out)
+    {
+      findBatchNodes(first, last, [&](Node* node) {
+        *out++ = iterator(node);
+      });
+      return out;
+    }
+    template < class ForwardIt, class OutputIt >
+    OutputIt findBatch(ForwardIt first, ForwardIt last, OutputIt out) const
+    {
+      findBatchNodes(first, last, [&](Node* node) {
+        *out++ = const_iterator(node);
+      });
+      return out;
+    }
+    // Number of keys in [lo, hi). O(log n) with order statistics, O(log n + k) otherwise.
+    std::size_t countInRange(const K& lo, const K& hi) const
+    {
+      if constexpr (Options::orderStatistic)
       {
-        ++iter;
+        std::size_t loRank = rankOf(lo);
+        std::size_t hiRank = rankOf(hi);
+        return hiRank > loRank ? hiRank - loRank : 0;
+      }
+      else
+      {
+        std::size_t result = 0;
+        visitRange(root_, lo, hi, [&](const value_type&) {
+          ++result;
+        });
+        return result;
       }
-      return iter;
     }
-    const_iterator lowerBound(const K& key) const
+    // All of them need Options::Augment. The combined aggregate of the keys in [lo, hi), in O(log n).
+    aggregate_type rangeAggregate(const K& lo, const K& hi) const
     {
-      const_iterator iter{ findNode(key) };
-      if (iter != end() && compare_(*iter, key))
+      static_assert(HAS_AUGMENT, "aggregates need Options::Augment");
+      Node* current = root_;
+      while (current && (isLess(current->value.first, lo) || !isLess(current->value.first, hi)))
+      {
+        current = isLess(current->value.first, lo) ? current->right : current->left;
+      }
+      if (!current)
+      {
+        return Augment::identity();
+      }
+      aggregate_type result = Augment::identity();
+      for (Node* left = current->left; left;)
+      {
+        if (isLess(left->value.first, lo))
+        {
+          left = left->right;
+          continue;
+        }
+        result = Augment::combine(Augment::combine(ownAggregate(left), aggregateOf(left->right)), result);
+        left = left->left;
+      }
+      result = Augment::combine(result, ownAggregate(current));
+      for (Node* right = current->right; right;)
       {
-        ++iter;
+        if (!isLess(right->value.first, hi))
+        {
+          right = right->left;
+          continue;
+        }
+        result = Augment::combine(result, Augment::combine(aggregateOf(right->left), ownAggregate(right)));
+        right = right->right;
       }
-      return iter;
+      return result;
+    }
+    aggregate_type aggregate() const
+    {
+      static_assert(HAS_AUGMENT, "aggregates need Options::Augment");
+      return aggregateOf(root_);
+    }
+    // The first element, from position on if given, whose own aggregate satisfies pred. pred must hold for a
+    // combination whenever it holds for a part, so that a subtree failing it holds no match and is skipped.
+    // The search is O(log n) when conversely pred(combine(a, b)) implies pred(a) || pred(b), as x < max for a
+    // ValueMax: the first interval of an interval tree ending after x is the one of least start containing x,
+    // if any does. Otherwise, as x <= sum for a ValueSum, it backtracks out of subtrees no element of which
+    // satisfies pred alone, up to O(n).
+    template < class Pred >
+    iterator findFirstWhere(Pred pred)
+    {
+      return iterator(firstWhereNode(root_, pred));
+    }
+    template < class Pred >
+    const_iterator findFirstWhere(Pred pred) const
+    {
+      return const_iterator(firstWhereNode(root_, pred));
+    }
+    template < class Pred >
+    iterator findFirstWhere(const_iterator position, Pred pred)
+    {
+      return iterator(nextWhereNode(position.node_, pred));
+    }
+    template < class Pred >
+    const_iterator findFirstWhere(const_iterator position, Pred pred) const
+    {
+      return const_iterator(nextWhereNode(position.node_, pred));
+    }
+    // Recomputes the aggregates above position after its mapped value was written in place. O(log n).
+    void updateAggregate(const_iterator position) noexcept
+    {
+      static_assert(HAS_AUGMENT, "aggregates need Options::Augment");
+      updatePath(position.node_);
+    }
+    // Bulk traversals keep the pending ancestors on a fixed-size stack instead of following parent pointers.
+    template < class F >
+    void forEach(F&& f)
+    {
+      visitAll< false >(root_, f);
+    }
+    template < class F >
+    void forEach(F&& f) const
+    {
+      visitAll< false >(root_, [&](const value_type& value) {
+        f(value);
+      });
+    }
+    template < class F >
+    void forEachReverse(F&& f)
+    {
+      visitAll< true >(root_, f);
+    }
+    template < class F >
+    void forEachReverse(F&& f) const
+    {
+      visitAll< true >(root_, [&](const value_type& value) {
+        f(value);
+      });
+    }
+    // Calls f for every element on up to policy.nThreads threads, in no particular order. The tree is cut
+    // at subtree roots into pieces of exactly proportional sizes with Options::orderStatistic, of equal black
+    // heights otherwise, and pieces smaller than policy.grain are walked serially.
+    template < class F >
+    void parallelForEach(F&& f, ParallelPolicy policy = ParallelPolicy())
+    {
+      auto fold = [&f](bool, value_type& value) {
+        f(value);
+        return true;
+      };
+      detail::KeepFirst combine;
+      reduceParallel(root_, blackHeight(root_), true, fold, combine, policy.nThreads, policy.grain);
+    }
+    template < class F >
+    void parallelForEach(F&& f, ParallelPolicy policy = ParallelPolicy()) const
+    {
+      auto fold = [&f](bool, const value_type& value) {
+        f(value);
+        return true;
+      };
+      detail::KeepFirst combine;
+      reduceParallel(root_, blackHeight(root_), true, fold, combine, policy.nThreads, policy.grain);
+    }
+    // Folds the elements of each piece in order, starting from init, and combines the results of the pieces
+    // in key order too, so that fold and combine need not commute: combine(combine(a, b), c) must only equal
+    // combine(a, combine(b, c)), with init an identity of it. Both may run on several threads at once.
+    template < class U, class Fold, class Combine >
+    U parallelReduce(U init, Fold fold, Combine combine, ParallelPolicy policy = ParallelPolicy()) const
+    {
+      auto foldConst = [&fold](U result, const value_type& value) {
+        return fold(std::move(result), value);
+      };
+      return reduceParallel(root_, blackHeight(root_), init, foldConst, combine, policy.nThreads, policy.grain);
+    }
+    // Calls f for every element with a key in [lo, hi), in order, without following parent pointers.
+    template < class F >
+    void forEachInRange(const K& lo, const K& hi, F&& f)
+    {
+      visitRange(root_, lo, hi, f);
+    }
+    template < class F >
+    void forEachInRange(const K& lo, const K& hi, F&& f) const
+    {
+      visitRange(root_, lo, hi, [&](const value_type& value) {
+        f(value);
+      });
     }
     bool insert(const K& key, const T& value)
     {
-      return insertNode(findNode(key), key, value);
+      InsertPosition position = findInsertPosition(key);
+      return !position.existing && insertNode(position, key, value);
+    }
+    // Amortized O(1) when the key belongs right before or right after hint.
+    iterator insert(const_iterator hint, const K& key, const T& value)
+    {
+      InsertPosition position = findHintedPosition(hint, key);
+      return iterator(position.existing ? position.existing : insertNode(position, key, value));
+    }
+    template < class... Args >
+    std::pair< iterator, bool > emplace(Args&&... args)
+    {
+      Node* newNode = createNode(Color::Red, nullptr, std::forward< Args >(args)...);
+      return emplaceNode(findInsertPosition(newNode->value.first), newNode);
     }
+    template < class... Args >
+    iterator emplaceHint(const_iterator hint, Args&&... args)
+    {
+      Node* newNode = createNode(Color::Red, nullptr, std::forward< Args >(args)...);
+      return emplaceNode(findHintedPosition(hint, newNode->value.first), newNode).first;
+    }
+    template < class... Args >
+    std::pair< iterator, bool > tryEmplace(const K& key, Args&&... args)
+    {
+      InsertPosition position = findInsertPosition(key);
+      if (position.existing)
+      {
+        return { iterator(position.existing), false };
+      }
+      Node* newNode = insertNode(position,
+        std::piecewise_construct,
+        std::forward_as_tuple(key),
+        std::forward_as_tuple(std::forward< Args >(args)...));
+      return { iterator(newNode), true };
+    }
+    template < class... Args >
+    std::pair< iterator, bool > tryEmplace(K&& key, Args&&... args)
+    {
+      InsertPosition position = findInsertPosition(key);
+      if (position.existing)
+      {
+        return { iterator(position.existing), false };
+      }
+      Node* newNode = insertNode(position,
+        std::piecewise_construct,
+        std::forward_as_tuple(std::move(key)),
+        std::forward_as_tuple(std::forward< Args >(args)...));
+      return { iterator(newNode), true };
+    }
+    // Only marks the node with Options::tombstones.
     bool erase(const K& key)
     {
-      Node* target = findNode(key);
-      if (!target || !areKeysEqual(key, target->value.first))
+      Node* target = findEqualNode(key);
+      if (!target)
       {
         return false;
       }
-      eraseNode(target);
+      eraseEntry(target);
       return true;
     }
-    bool isRBTree() const
+    // Returns the iterator following position, with no search. Amortized O(1) rebalancing.
+    iterator erase(const_iterator position)
+    {
+      Node* next = liveFrom(iterator::successor(position.node_));
+      eraseEntry(position.node_);
+      return iterator(next);
+    }
+    iterator erase(iterator position)
+    {
+      return erase(const_iterator(position));
+    }
+    // Erases [first, last) and returns last. Ranges longer than about twice the height are cut out with two splits
+    // and a join in O(log n) instead of rebalancing once per element; destroying the nodes stays linear.
+    iterator erase(const_iterator first, const_iterator last)
     {
-      if (root_->color != Color::Black)
+      Node* current = first.node_;
+      std::size_t limit = 1;
+      for (std::size_t n = size_; n; n >>= 1)
       {
-        return false;
+        limit += 2;
       }
-      return isWeakRBTree(root_);
+      for (std::size_t k = 0; current != last.node_ && k < limit; ++k)
+      {
+        current = iterator::successor(current);
+      }
+      if (current != last.node_)
+      {
+        purgeTombstones();
+        return iterator(eraseSplitting(first.node_, last.node_));
+      }
+      for (current = first.node_; current != last.node_;)
+      {
+        Node* next = liveFrom(iterator::successor(current));
+        eraseEntry(current);
+        current = next;
+      }
+      return iterator(last.node_);
     }
-    void walkByLevels(std::ostream& out) const
+    // Unlinks the node of key, if any, and hands it over without moving or copying its value.
+    node_type extract(const K& key)
     {
-      if (!root_)
+      return extractNode(findEqualNode(key));
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    node_type extract(const Key& key)
+    {
+      return extractNode(findEqualNode(key));
+    }
+    node_type extract(const_iterator position)
+    {
+      return extractNode(position.node_);
+    }
+    // Links the node of the handle unless its key is present, when the handle keeps it.
+    // A node of an allocator unequal to this one has its value moved into a new node instead.
+    std::pair< iterator, bool > insert(node_type&& handle)
+    {
+      if (handle.empty())
       {
-        return;
+        return { end(), false };
       }
-      std::queue< Node* > queue;
-      queue.push(root_);
-      while (!queue.empty())
+      InsertPosition position = findInsertPosition(handle.key());
+      if (position.existing)
       {
-        Node* current = queue.front();
-        queue.pop();
-        out << current->value.first << ' ';
-        if (current->left)
-        {
-          queue.push(current->left);
-        }
-        if (current->right)
+        return { iterator(position.existing), false };
+      }
+      if constexpr (!NodeTraits::is_always_equal::value)
+      {
+        if (alloc_ != *handle.alloc_)
         {
-          queue.push(current->right);
+          Node* newNode = insertNode(position, std::move(handle.node_->value));
+          node_type spent(std::move(handle));
+          return { iterator(newNode), true };
         }
       }
+      return { iterator(linkNode(position, resetNode(handle.release()))), true };
     }
-    iterator begin()
+    // Moves every node of source whose key is missing here, relinking them without allocating,
+    // unless the allocators are unequal and the values have to move into new nodes.
+    // An ascending pass: each descent starts from the previous insertion.
+    void merge(RBTree< K, T, Compare, Allocator, Options >& source)
     {
-      return iterator(minNode(root_));
+      if (&source == this)
+      {
+        return;
+      }
+      purgeTombstones();
+      source.purgeTombstones();
+      bool isRelinked = NodeTraits::is_always_equal::value || alloc_ == source.alloc_;
+      Node* finger = nullptr;
+      for (Node* current = minNode(source.root_); current;)
+      {
+        Node* next = iterator::successor(current);
+        const K& key = current->value.first;
+        InsertPosition position = findInsertPosition(key, finger ? spanningAncestor(finger, key) : root_);
+        if (!position.existing)
+        {
+          if (isRelinked)
+          {
+            source.unlinkNode(current);
+            finger = linkNode(position, resetNode(current));
+          }
+          else
+          {
+            finger = insertNode(position, std::move(current->value));
+            source.eraseNode(current);
+          }
+        }
+        current = next;
+      }
     }
-    const_iterator begin() const
+    void merge(RBTree< K, T, Compare, Allocator, Options >&& source)
     {
-      return const_iterator(minNode(root_));
+      merge(source);
     }
-    const_iterator cbegin() const
+    // Both need OrderStatisticOptions or alike.
+    iterator nth(std::size_t index)
     {
-      return const_iterator(minNode(root_));
+      return iterator(nthNode(index));
     }
-    iterator end()
+    const_iterator nth(std::size_t index) const
     {
-      return iterator(nullptr);
+      return const_iterator(nthNode(index));
     }
-    const_iterator end() const
+    // Number of elements less than key.
+    std::size_t rank(const K& key) const
     {
-      return const_iterator(nullptr);
+      return rankOf(key);
     }
-    const_iterator cend() const
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    std::size_t rank(const Key& key) const
     {
-      return const_iterator(nullptr);
+      return rankOf(key);
     }
-
-  private:
-    using Color = detail::Color;
-    using Node = detail::Node< K, T >;
-
-    void copyTree(const Node* from, Node* to) const
+    // Replaces the contents with a strictly ascending range in O(n), without any rotation.
+    template < class InputIt >
+    void assignSorted(InputIt first, InputIt last)
     {
-      auto gotoMinCopying = [&] {
-        while (from->left)
+      clear();
+      if constexpr (detail::HasReserve< NodeAllocator >::value
+                    && std::is_base_of< std::forward_iterator_tag,
+                      typename std::iterator_traits< InputIt >::iterator_category >::value)
+      {
+        alloc_.reserve(static_cast< std::size_t >(std::distance(first, last)));
+      }
+      Node* head = nullptr;
+      Node* tail = nullptr;
+      std::size_t n = 0;
+      try
+      {
+        for (; first != last; ++first, ++n)
         {
-          from = from->left;
-          to->left = new Node{ from->value, from->color, to };
-          to = to->left;
+          Node* newNode = createNode(Color::Black, nullptr, *first);
+          if (tail && !isLess(tail->value.first, newNode->value.first))
+          {
+            destroyNode(newNode);
+            throw std::invalid_argument("Range is not strictly ascending\n");
+          }
+          (tail ? tail->right : head) = newNode;
+          tail = newNode;
         }
-      };
-      gotoMinCopying();
-      while (from)
+      }
+      catch (...)
       {
-        if (from->right)
+        while (head)
         {
-          from = from->right;
-          to->right = new Node{ from->value, from->color, to };
-          to = to->right;
-          gotoMinCopying();
+          Node* next = head->right;
+          destroyNode(head);
+          head = next;
         }
-        else
+        throw;
+      }
+      relinkSorted(head, n);
+    }
+    // Inserts the pairs of [first, last) whose keys are missing, keeping the first of equal ones, as insert() would.
+    // The batch is sorted and applied in one ascending pass, each descent starting from the previous insertion.
+    // Batches large next to the tree are merged with it and relinked in O(n + m) instead.
+    // Returns the number of inserted pairs. Nothing is inserted if a copy throws.
+    template < class InputIt >
+    std::size_t insertBatch(InputIt first, InputIt last)
+    {
+      purgeTombstones();
+      std::vector< Node* > batch;
+      try
+      {
+        for (; first != last; ++first)
         {
-          const Node* candidate = from->p;
-          while (candidate && candidate->right == from)
+          // Room first, growing geometrically, so that push_back never throws with a node in hand.
+          if (batch.size() == batch.capacity())
           {
-            from = candidate;
-            to = to->p;
-            candidate = candidate->p;
+            batch.reserve(2 * batch.size() + 1);
           }
-          from = candidate;
-          to = to->p;
+          batch.push_back(createNode(Color::Red, nullptr, *first));
         }
+        std::stable_sort(batch.begin(), batch.end(), [this](const Node* lhs, const Node* rhs) {
+          return isLess(lhs->value.first, rhs->value.first);
+        });
+      }
+      catch (...)
+      {
+        for (Node* node : batch)
+        {
+          destroyNode(node);
+        }
+        throw;
+      }
+      std::size_t oldSize = size_;
+      if (isBulkCheaper(batch.size()))
+      {
+        Node* head = nullptr;
+        Node* tail = nullptr;
+        std::size_t n = 0;
+        std::size_t next = 0;
+        auto append = [&](Node* node) {
+          (tail ? tail->right : head) = node;
+          tail = node;
+          ++n;
+        };
+        auto appendBatch = [&](Node* node) {
+          if (tail && !isLess(tail->value.first, node->value.first))
+          {
+            destroyNode(node);
+            return;
+          }
+          append(node);
+        };
+        drainInOrder([&](Node* node) {
+          for (; next < batch.size() && isLess(batch[next]->value.first, node->value.first); ++next)
+          {
+            appendBatch(batch[next]);
+          }
+          for (; next < batch.size() && !isLess(node->value.first, batch[next]->value.first); ++next)
+          {
+            destroyNode(batch[next]);
+          }
+          append(node);
+        });
+        for (; next < batch.size(); ++next)
+        {
+          appendBatch(batch[next]);
+        }
+        relinkSorted(head, n);
+        return size_ - oldSize;
+      }
+      Node* finger = nullptr;
+      for (Node* node : batch)
+      {
+        const K& key = node->value.first;
+        InsertPosition position = findInsertPosition(key, finger ? spanningAncestor(finger, key) : root_);
+        if (position.existing)
+        {
+          destroyNode(node);
+        }
+        else
+        {
+          finger = linkNode(position, node);
+        }
+      }
+      return size_ - oldSize;
+    }
+    // Erases every key of [first, last) in one ascending pass, or by relinking the survivors when that is cheaper.
+    // Returns the number of erased elements.
+    template < class InputIt >
+    std::size_t eraseBatch(InputIt first, InputIt last)
+    {
+      std::vector< K > keys(first, last);
+      auto less = [this](const K& lhs, const K& rhs) {
+        return isLess(lhs, rhs);
+      };
+      std::sort(keys.begin(), keys.end(), less);
+      keys.erase(std::unique(keys.begin(), keys.end(), [&](const K& lhs, const K& rhs) {
+        return !less(lhs, rhs);
+      }), keys.end());
+      purgeTombstones();
+      std::size_t oldSize = size_;
+      if (isBulkCheaper(keys.size()))
+      {
+        Node* head = nullptr;
+        Node* tail = nullptr;
+        std::size_t n = 0;
+        std::size_t next = 0;
+        drainInOrder([&](Node* node) {
+          for (; next < keys.size() && isLess(keys[next], node->value.first); ++next)
+          {}
+          if (next < keys.size() && !isLess(node->value.first, keys[next]))
+          {
+            destroyNode(node);
+            return;
+          }
+          (tail ? tail->right : head) = node;
+          tail = node;
+          ++n;
+        });
+        relinkSorted(head, n);
+        return oldSize - size_;
+      }
+      Node* finger = nullptr;
+      for (const K& key : keys)
+      {
+        Node* target = lowerBoundNode(key, finger ? spanningAncestor(finger, key) : root_);
+        if (target && !isLess(key, target->value.first))
+        {
+          finger = iterator::predesessor(target);
+          eraseNode(target);
+        }
+      }
+      return oldSize - size_;
+    }
+    // Moves the elements whose keys are not less than key into the returned tree, in O(log n).
+    // Without Options::orderStatistic the moved elements are counted, which is linear in their number.
+    RBTree< K, T, Compare, Allocator, Options > split(const K& key)
+    {
+      return splitOff(key);
+    }
+    template < class Key, class C = Compare, class = typename C::is_transparent >
+    RBTree< K, T, Compare, Allocator, Options > split(const Key& key)
+    {
+      return splitOff(key);
+    }
+    // Appends right, all of whose keys must be greater than the ones here, in O(log n).
+    // Throws std::invalid_argument otherwise, leaving both trees as they were.
+    void join(RBTree< K, T, Compare, Allocator, Options >&& right)
+    {
+      if (!right.root_)
+      {
+        return;
+      }
+      purgeTombstones();
+      right.purgeTombstones();
+      if (root_ && !isLess(maxNode(root_)->value.first, minNode(right.root_)->value.first))
+      {
+        throw std::invalid_argument("Range is not strictly ascending\n");
+      }
+      std::size_t n = size_ + right.size_;
+      Subtree rightNodes = takeNodes(right);
+      adoptNodes(joinSubtrees(releaseNodes(), rightNodes), n);
+    }
+    // The same with pivot linked in between, its key greater than the ones here and less than those of right.
+    void join(const value_type& pivot, RBTree< K, T, Compare, Allocator, Options >&& right)
+    {
+      purgeTombstones();
+      right.purgeTombstones();
+      if ((root_ && !isLess(maxNode(root_)->value.first, pivot.first))
+          || (right.root_ && !isLess(pivot.first, minNode(right.root_)->value.first)))
+      {
+        throw std::invalid_argument("Range is not strictly ascending\n");
+      }
+      Node* newNode = createNode(Color::Red, nullptr, pivot);
+      std::size_t n = size_ + 1 + right.size_;
+      Subtree rightNodes;
+      try
+      {
+        rightNodes = takeNodes(right);
+      }
+      catch (...)
+      {
+        destroyNode(newNode);
+        throw;
+      }
+      adoptNodes(joinNodes(releaseNodes(), newNode, rightNodes), n);
+    }
+    // Set operations that take the nodes of other instead of copying them, in O(m log(n / m + 1)) work
+    // for trees of m <= n elements. Both trees are split around a root and the halves are combined recursively,
+    // on separate threads while they are above policy.grain. The comparator must not throw.
+    // Keeps the values here for keys present in both trees.
+    void unionWith(RBTree< K, T, Compare, Allocator, Options >&& other)
+    {
+      combineWith< SetOperation::Union >(other, 1, 0);
+    }
+    void unionWith(RBTree< K, T, Compare, Allocator, Options >&& other, ParallelPolicy policy)
+    {
+      combineWith< SetOperation::Union >(other, policy.nThreads, policy.grain);
+    }
+    // Keeps only the elements whose keys are also in other.
+    void intersectWith(RBTree< K, T, Compare, Allocator, Options >&& other)
+    {
+      combineWith< SetOperation::Intersection >(other, 1, 0);
+    }
+    void intersectWith(RBTree< K, T, Compare, Allocator, Options >&& other, ParallelPolicy policy)
+    {
+      combineWith< SetOperation::Intersection >(other, policy.nThreads, policy.grain);
+    }
+    // Erases the elements whose keys are in other.
+    void difference(RBTree< K, T, Compare, Allocator, Options >&& other)
+    {
+      combineWith< SetOperation::Difference >(other, 1, 0);
+    }
+    void difference(RBTree< K, T, Compare, Allocator, Options >&& other, ParallelPolicy policy)
+    {
+      combineWith< SetOperation::Difference >(other, policy.nThreads, policy.grain);
+    }
+    // Read-only copy searched without branches or pointer chasing, see FrozenRBTree.
+    FrozenRBTree< K, T, Compare, Allocator > freeze() const
+    {
+      return FrozenRBTree< K, T, Compare, Allocator >(begin(),
+        end(),
+        size(),
+        compare_,
+        NodeTraits::select_on_container_copy_construction(alloc_));
+    }
+    // Writes the sorted format of RBTreeSerialization.hpp, which MappedRBTree searches in place.
+    // Keys and values must be trivially copyable.
+    void serialize(std::ostream& out) const
+    {
+      detail::writeSerialized< K, T >(out, begin(), end(), size());
+    }
+    // Replaces the contents with what serialize() wrote, rebuilt in O(n) by assignSorted().
+    // Leaves the tree as it was if the stream does not hold a serialized tree of these types.
+    void deserialize(std::istream& in)
+    {
+      detail::SerializedBlock< K, T > block = detail::readSerialized< K, T >(in);
+      RBTree< K, T, Compare, Allocator, Options > loaded(compare_, alloc_);
+      if constexpr (detail::HasReserve< NodeAllocator >::value)
+      {
+        loaded.alloc_.reserve(block.count);
+      }
+      loaded.assignSorted(block.begin(), block.end());
+      Finger::forgetFinger();
+      std::swap(root_, loaded.root_);
+      std::swap(size_, loaded.size_);
+      Graveyard::swapTombstones(loaded);
+    }
+    bool isRBTree() const
+    {
+      if (root_->color() != Color::Black)
+      {
+        return false;
+      }
+      return isWeakRBTree(root_);
+    }
+    void walkByLevels(std::ostream& out) const
+    {
+      if (!root_)
+      {
+        return;
+      }
+      std::queue< Node* > queue;
+      queue.push(root_);
+      while (!queue.empty())
+      {
+        Node* current = queue.front();
+        queue.pop();
+        out << current->value.first << ' ';
+        if (current->left)
+        {
+          queue.push(current->left);
+        }
+        if (current->right)
+        {
+          queue.push(current->right);
+        }
+      }
+    }
+    iterator begin()
+    {
+      return iterator(liveFrom(minNode(root_)));
+    }
+    const_iterator begin() const
+    {
+      return const_iterator(liveFrom(minNode(root_)));
+    }
+    const_iterator cbegin() const
+    {
+      return begin();
+    }
+    iterator end()
+    {
+      return iterator(nullptr);
+    }
+    const_iterator end() const
+    {
+      return const_iterator(nullptr);
+    }
+    const_iterator cend() const
+    {
+      return const_iterator(nullptr);
+    }
+
+  private:
+    using Color = detail::Color;
+    using NodeAllocator = typename std::allocator_traits< Allocator >::template rebind_alloc< Node >;
+    using NodeTraits = std::allocator_traits< NodeAllocator >;
+    static constexpr bool IS_THREE_WAY = detail::IsThreeWay< Compare, K >::value;
+    static constexpr std::size_t BATCH_LANES = 16;
+
+    // A detached subtree with a black root, and its black height: the number of black nodes on a way down to a leaf.
+    struct Subtree
+    {
+      Node* root;
+      int height;
+    };
+    struct SplitResult
+    {
+      Subtree less;
+      Node* equal;
+      Subtree greater;
+    };
+    enum class SetOperation
+    {
+      Union,
+      Intersection,
+      Difference
+    };
+    // Nodes left out of a set operation, threaded through right.
+    struct Discarded
+    {
+      Node* head;
+      Node* tail;
+      std::size_t count;
+      void push(Node* node) noexcept
+      {
+        node->right = nullptr;
+        (tail ? tail->right : head) = node;
+        tail = node;
+        ++count;
+      }
+      void splice(Discarded& other) noexcept
+      {
+        if (other.head)
+        {
+          (tail ? tail->right : head) = other.head;
+          tail = other.tail;
+          count += other.count;
+        }
+      }
+    };
+    // Where a key is or would be linked: existing is set when the key is already present.
+    struct InsertPosition
+    {
+      Node* parent;
+      bool isLeft;
+      Node* existing;
+      // A tombstone of key, which the new node replaces.
+      Node* tombstone = nullptr;
+    };
+
+    template < class... Args >
+    Node* createNode(Args&&... args)
+    {
+      Node* node = NodeTraits::allocate(alloc_, 1);
+      Counter::countAllocation();
+      try
+      {
+        ::new (static_cast< void* >(node)) Node(std::forward< Args >(args)...);
+      }
+      catch (...)
+      {
+        NodeTraits::deallocate(alloc_, node, 1);
+        Counter::countDeallocation();
+        throw;
+      }
+      return node;
+    }
+    void destroyNode(Node* target) noexcept
+    {
+      if (Finger::isFinger(target))
+      {
+        Finger::forgetFinger();
+      }
+      if (target == Graveyard::purgeCursor())
+      {
+        Graveyard::setPurgeCursor(nullptr);
+      }
+      target->~Node();
+      NodeTraits::deallocate(alloc_, target, 1);
+      Counter::countDeallocation();
+    }
+    void copyFrom(Node* src, std::size_t n)
+    {
+      if (!src)
+      {
+        return;
+      }
+      if constexpr (detail::HasReserve< NodeAllocator >::value)
+      {
+        alloc_.reserve(n);
+      }
+      try
+      {
+        auto make = [this](const Node* from, Node* parent) {
+          return copyMeta(from, createNode(from->color(), parent, from->value));
+        };
+        root_ = make(src, nullptr);
+        size_ = 1;
+        copyTree(src, root_, [&](const Node* from, Node* parent) {
+          Node* node = make(from, parent);
+          ++size_;
+          return node;
+        });
+      }
+      catch (...)
+      {
+        clear();
+        throw;
+      }
+    }
+    Node* copyMeta(const Node* from, Node* to) const
+    {
+      if constexpr (Options::orderStatistic)
+      {
+        to->size = from->size;
+      }
+      if constexpr (HAS_AUGMENT)
+      {
+        to->aggregate = from->aggregate;
+      }
+      to->setDead(isTombstone(from));
+      return to;
+    }
+    // Constructs the copy of the n-node subtree from into preallocated slots, in preorder.
+    // Either the whole subtree is constructed or nothing is left constructed.
+    void copyParallel(const Node* from, Node* parent, Node** slots, std::size_t n, unsigned nThreads, std::size_t grain)
+    {
+      if (nThreads <= 1 || n < grain)
+      {
+        std::size_t nConstructed = 0;
+        auto place = [&](const Node* source, Node* nodeParent) {
+          Node* node = ::new (static_cast< void* >(slots[nConstructed])) Node(source->color(), nodeParent, source->value);
+          ++nConstructed;
+          return copyMeta(source, node);
+        };
+        try
+        {
+          copyTree(from, place(from, parent), place);
+        }
+        catch (...)
+        {
+          destroyConstructed(slots, nConstructed);
+          throw;
+        }
+        return;
+      }
+      Node* to = copyMeta(from, ::new (static_cast< void* >(slots[0])) Node(from->color(), parent, from->value));
+      std::size_t nLeft = countNodes(from->left);
+      std::size_t nRight = n - 1 - nLeft;
+      to->left = from->left ? slots[1] : nullptr;
+      to->right = from->right ? slots[1 + nLeft] : nullptr;
+      unsigned nLeftThreads = nThreads / 2;
+      detail::ForkJoinResult result = detail::forkJoin(
+        [&] {
+          if (from->left)
+          {
+            copyParallel(from->left, to, slots + 1, nLeft, nLeftThreads, grain);
+          }
+        },
+        [&] {
+          if (from->right)
+          {
+            copyParallel(from->right, to, slots + 1 + nLeft, nRight, nThreads - nLeftThreads, grain);
+          }
+        });
+      if (result.first || result.second)
+      {
+        if (!result.first)
+        {
+          destroyConstructed(slots + 1, nLeft);
+        }
+        if (!result.second)
+        {
+          destroyConstructed(slots + 1 + nLeft, nRight);
+        }
+        to->~Node();
+        result.rethrow();
+      }
+    }
+    void destroyConstructed(Node** slots, std::size_t n) noexcept
+    {
+      for (std::size_t i = 0; i < n; ++i)
+      {
+        slots[i]->~Node();
+      }
+    }
+    std::size_t countNodes(const Node* target) const
+    {
+      if constexpr (Options::orderStatistic)
+      {
+        return sizeOf(target);
+      }
+      else
+      {
+        return target ? 1 + countNodes(target->left) + countNodes(target->right) : 0;
+      }
+    }
+    // Copies the subtrees of from under to, creating nodes in preorder.
+    template < class Make >
+    void copyTree(const Node* from, Node* to, Make&& make)
+    {
+      const Node* stop = from->parent();
+      auto gotoMinCopying = [&] {
+        while (from->left)
+        {
+          from = from->left;
+          to->left = make(from, to);
+          to = to->left;
+        }
+      };
+      gotoMinCopying();
+      while (from != stop)
+      {
+        if (from->right)
+        {
+          from = from->right;
+          to->right = make(from, to);
+          to = to->right;
+          gotoMinCopying();
+        }
+        else
+        {
+          const Node* candidate = from->parent();
+          while (candidate != stop && candidate->right == from)
+          {
+            from = candidate;
+            to = to->parent();
+            candidate = candidate->parent();
+          }
+          from = candidate;
+          to = to->parent();
+        }
+      }
+    }
+    template < class... Args >
+    Node* insertNode(const InsertPosition& position, Args&&... args)
+    {
+      return linkNode(position, createNode(Color::Red, nullptr, std::forward< Args >(args)...));
+    }
+    std::pair< iterator, bool > emplaceNode(const InsertPosition& position, Node* newNode)
+    {
+      if (position.existing)
+      {
+        destroyNode(newNode);
+        return { iterator(position.existing), false };
+      }
+      return { iterator(linkNode(position, newNode)), true };
+    }
+    Node* linkNode(const InsertPosition& position, Node* newNode)
+    {
+      assert(!position.existing);
+      if constexpr (Options::tombstones)
+      {
+        if (position.tombstone)
+        {
+          return replaceTombstone(position.tombstone, newNode);
+        }
+      }
+      ++size_;
+      updateNode(newNode);
+      newNode->setParent(position.parent);
+      if (!position.parent)
+      {
+        newNode->setColor(Color::Black);
+        root_ = newNode;
+        return newNode;
+      }
+      newNode->setColor(Color::Red);
+      if (position.isLeft)
+      {
+        position.parent->left = newNode;
+      }
+      else
+      {
+        position.parent->right = newNode;
+      }
+      updatePath(position.parent);
+      insertFixup(newNode);
+      return newNode;
+    }
+    // Makes the tree out of the list of n nodes threaded through right.
+    void relinkSorted(Node* head, std::size_t n)
+    {
+      int redDepth = 0;
+      while ((n + 1) >> (redDepth + 1))
+      {
+        ++redDepth;
+      }
+      root_ = linkSorted(head, n, 0, redDepth);
+      if (root_)
+      {
+        root_->setParent(nullptr);
+      }
+      size_ = n;
+    }
+    // Hands every node to f in key order and leaves the tree empty. f may reuse left and right of its node.
+    template < class F >
+    void drainInOrder(F&& f)
+    {
+      Finger::forgetFinger();
+      Graveyard::forgetTombstones();
+      Node* stack[MAX_HEIGHT];
+      std::size_t top = 0;
+      for (Node* current = root_; current || top;)
+      {
+        for (; current; current = current->left)
+        {
+          stack[top++] = current;
+        }
+        current = stack[--top];
+        Node* right = current->right;
+        f(current);
+        current = right;
+      }
+      root_ = nullptr;
+      size_ = 0;
+    }
+    // Whether m separate descents would cost more than one linear pass over the tree.
+    bool isBulkCheaper(std::size_t m) const noexcept
+    {
+      std::size_t depth = 1;
+      while (size_ >> depth)
+      {
+        ++depth;
+      }
+      return m * depth >= size_;
+    }
+    // Lowest ancestor of finger whose subtree spans key, for a key not less than the one of finger.
+    // Walking up from the previous position costs O(log d) for keys d positions apart.
+    template < class Key >
+    Node* spanningAncestor(Node* finger, const Key& key) const
+    {
+      for (Node* parent = finger->parent(); parent; parent = finger->parent())
+      {
+        if (parent->left == finger && isLess(key, parent->value.first))
+        {
+          break;
+        }
+        finger = parent;
+      }
+      return finger;
+    }
+    // Lowest ancestor of the finger, itself included, whose subtree spans key, or the root without a finger.
+    // upper gets the least ancestor greater than key when the subtree may hold only keys less than it.
+    template < class Key >
+    Node* fingerStart(const Key& key, Node*& upper) const
+    {
+      Node* current = Finger::finger();
+      if (!current)
+      {
+        return root_;
+      }
+      bool isBefore = isLess(key, current->value.first);
+      if (!isBefore && !isLess(current->value.first, key))
+      {
+        return current;
+      }
+      for (Node* parent = current->parent(); parent; parent = current->parent())
+      {
+        if (isBefore && parent->right == current && isLess(parent->value.first, key))
+        {
+          break;
+        }
+        if (!isBefore && parent->left == current && isLess(key, parent->value.first))
+        {
+          upper = parent;
+          break;
+        }
+        current = parent;
+      }
+      return current;
+    }
+    template < class Key >
+    RBTree< K, T, Compare, Allocator, Options > splitOff(const Key& key)
+    {
+      RBTree< K, T, Compare, Allocator, Options > right(compare_, alloc_);
+      if (!root_)
+      {
+        return right;
+      }
+      purgeTombstones();
+      std::size_t n = size_;
+      SplitResult parts = splitNodes(releaseNodes(), key);
+      Subtree greater = parts.equal ? joinNodes({ nullptr, 0 }, parts.equal, parts.greater) : parts.greater;
+      std::size_t nRight = countNodes(greater.root);
+      adoptNodes(parts.less, n - nRight);
+      right.adoptNodes(greater, nRight);
+      return right;
+    }
+    template < SetOperation OP >
+    void combineWith(RBTree< K, T, Compare, Allocator, Options >& other, unsigned nThreads, std::size_t grain)
+    {
+      purgeTombstones();
+      other.purgeTombstones();
+      std::size_t n = size_ + other.size_;
+      Subtree otherNodes = takeNodes(other);
+      Discarded discarded{ nullptr, nullptr, 0 };
+      Subtree result = combineNodes< OP >(releaseNodes(), otherNodes, discarded, nThreads, grain);
+      adoptNodes(result, n - discarded.count);
+      while (discarded.head)
+      {
+        Node* next = discarded.head->right;
+        destroyNode(discarded.head);
+        discarded.head = next;
+      }
+    }
+    // The nodes of lhs come first: they are the pivots, and the ones kept for keys in both trees.
+    // Nodes that do not make it into the result are only set aside, the allocator may not be called concurrently.
+    template < SetOperation OP >
+    Subtree combineNodes(Subtree lhs, Subtree rhs, Discarded& discarded, unsigned nThreads, std::size_t grain)
+    {
+      if (!lhs.root || !rhs.root)
+      {
+        if (OP == SetOperation::Union)
+        {
+          return lhs.root ? lhs : rhs;
+        }
+        discardTree(rhs.root, discarded);
+        if (OP == SetOperation::Intersection)
+        {
+          discardTree(lhs.root, discarded);
+          return { nullptr, 0 };
+        }
+        return lhs;
+      }
+      Node* pivot = lhs.root;
+      Subtree lhsLeft = detachSubtree(pivot->left, lhs.height - 1);
+      Subtree lhsRight = detachSubtree(pivot->right, lhs.height - 1);
+      SplitResult parts = splitNodes(rhs, pivot->value.first);
+      Subtree left;
+      Subtree right;
+      if (nThreads > 1 && isAboveGrain(std::max(lhs.height, rhs.height), grain))
+      {
+        unsigned nLeftThreads = nThreads / 2;
+        Discarded leftDiscarded{ nullptr, nullptr, 0 };
+        // Joins rotate around the root of the tree they run in, so the fork works in a tree of its own.
+        RBTree< K, T, Compare, Allocator, Options > worker(compare_, alloc_);
+        detail::ForkJoinResult result = detail::forkJoin(
+          [&] {
+            left = worker.combineNodes< OP >(lhsLeft, parts.less, leftDiscarded, nLeftThreads, grain);
+            worker.root_ = nullptr;
+          },
+          [&] {
+            right = combineNodes< OP >(lhsRight, parts.greater, discarded, nThreads - nLeftThreads, grain);
+          });
+        result.rethrow();
+        discarded.splice(leftDiscarded);
+      }
+      else
+      {
+        left = combineNodes< OP >(lhsLeft, parts.less, discarded, 1, grain);
+        right = combineNodes< OP >(lhsRight, parts.greater, discarded, 1, grain);
+      }
+      if (parts.equal)
+      {
+        discarded.push(parts.equal);
+      }
+      if (OP == SetOperation::Union || (OP == SetOperation::Intersection) == (parts.equal != nullptr))
+      {
+        return joinNodes(left, pivot, right);
+      }
+      discarded.push(pivot);
+      return joinSubtrees(left, right);
+    }
+    // A subtree of black height h has at least 2^h - 1 nodes.
+    template < class U, class Fold, class Combine >
+    U reduceParallel(Node* root, int height, const U& init, Fold& fold, Combine& combine, unsigned nThreads,
+      std::size_t grain) const
+    {
+      bool isLarge = false;
+      if constexpr (Options::orderStatistic)
+      {
+        isLarge = root && root->size > grain;
+      }
+      else
+      {
+        isLarge = root && isAboveGrain(height, grain);
+      }
+      if (nThreads <= 1 || !isLarge)
+      {
+        U result = init;
+        visitAll< false >(root, [&](value_type& value) {
+          result = fold(std::move(result), value);
+        });
+        return result;
+      }
+      unsigned nLeftThreads = nThreads / 2;
+      if constexpr (Options::orderStatistic)
+      {
+        std::size_t nLeft = root->left ? root->left->size : 0;
+        nLeftThreads = static_cast< unsigned >(nThreads * nLeft / root->size);
+        nLeftThreads = nLeftThreads < 1 ? 1 : nLeftThreads > nThreads - 1 ? nThreads - 1 : nLeftThreads;
+      }
+      int childHeight = height - (root->color() == Color::Black);
+      U left = init;
+      U right = init;
+      detail::ForkJoinResult result = detail::forkJoin(
+        [&] {
+          left = reduceParallel(root->left, childHeight, init, fold, combine, nLeftThreads, grain);
+        },
+        [&] {
+          right = reduceParallel(root->right, childHeight, init, fold, combine, nThreads - nLeftThreads, grain);
+        });
+      result.rethrow();
+      if (!isTombstone(root))
+      {
+        left = combine(std::move(left), fold(U(init), root->value));
+      }
+      return combine(std::move(left), std::move(right));
+    }
+    static bool isAboveGrain(int height, std::size_t grain) noexcept
+    {
+      return height >= std::numeric_limits< std::size_t >::digits || (std::size_t(1) << height) > grain;
+    }
+    void discardTree(Node* root, Discarded& discarded) const noexcept
+    {
+      if (root)
+      {
+        Node* right = root->right;
+        discardTree(root->left, discarded);
+        discarded.push(root);
+        discardTree(right, discarded);
+      }
+    }
+    int blackHeight(const Node* root) const noexcept
+    {
+      int height = 0;
+      for (; root; root = root->left)
+      {
+        height += root->color() == Color::Black;
+      }
+      return height;
+    }
+    // Cuts a child off its parent, blackening a red root.
+    Subtree detachSubtree(Node* root, int height) const noexcept
+    {
+      if (root)
+      {
+        root->setParent(nullptr);
+        if (root->color() == Color::Red)
+        {
+          root->setColor(Color::Black);
+          ++height;
+        }
+      }
+      return { root, height };
+    }
+    // Subtrees hold no tombstones: their operations purge them first.
+    Subtree releaseNodes() noexcept
+    {
+      assert(!Graveyard::nTombstones());
+      Finger::forgetFinger();
+      Subtree tree{ root_, blackHeight(root_) };
+      root_ = nullptr;
+      size_ = 0;
+      return tree;
+    }
+    void adoptNodes(Subtree tree, std::size_t n) noexcept
+    {
+      Finger::forgetFinger();
+      root_ = tree.root;
+      size_ = n;
+    }
+    // Releases the nodes of other, copied first if they are owned by an allocator that cannot free them here.
+    Subtree takeNodes(RBTree< K, T, Compare, Allocator, Options >& other)
+    {
+      if constexpr (!NodeTraits::is_always_equal::value)
+      {
+        if (alloc_ != other.alloc_)
+        {
+          RBTree< K, T, Compare, Allocator, Options > copy(other, alloc_);
+          other.clear();
+          return copy.releaseNodes();
+        }
+      }
+      return other.releaseNodes();
+    }
+    // Links left < pivot < right in O(|h(left) - h(right)| + 1): the pivot becomes red on the inner spine
+    // of the higher tree, at the first black node as high as the lower tree, and the usual insert fixup follows.
+    // The higher tree is fixed up as the root of this one, whatever it held.
+    Subtree joinNodes(Subtree left, Node* pivot, Subtree right)
+    {
+      if (left.height == right.height)
+      {
+        pivot->left = left.root;
+        pivot->right = right.root;
+        for (Node* child : { left.root, right.root })
+        {
+          if (child)
+          {
+            child->setParent(pivot);
+          }
+        }
+        pivot->setParent(nullptr);
+        pivot->setColor(Color::Black);
+        updateNode(pivot);
+        return { pivot, left.height + 1 };
+      }
+      bool isLeftHigher = left.height > right.height;
+      Subtree higher = isLeftHigher ? left : right;
+      Subtree lower = isLeftHigher ? right : left;
+      Node* parent = nullptr;
+      Node* current = higher.root;
+      for (int height = higher.height; colorOf(current) == Color::Red || height > lower.height;)
+      {
+        height -= colorOf(current) == Color::Black;
+        parent = current;
+        current = current->child(!isLeftHigher);
+      }
+      pivot->left = isLeftHigher ? current : lower.root;
+      pivot->right = isLeftHigher ? lower.root : current;
+      for (Node* child : { current, lower.root })
+      {
+        if (child)
+        {
+          child->setParent(pivot);
+        }
+      }
+      (isLeftHigher ? parent->right : parent->left) = pivot;
+      pivot->setParent(parent);
+      pivot->setColor(Color::Red);
+      updateNode(pivot);
+      updatePath(parent);
+      root_ = higher.root;
+      bool isTaller = insertFixup(pivot);
+      return { root_, higher.height + isTaller };
+    }
+    Subtree joinSubtrees(Subtree left, Subtree right)
+    {
+      if (!left.root || !right.root)
+      {
+        return left.root ? left : right;
+      }
+      Node* first = nullptr;
+      Subtree rest = detachFirst(right, first);
+      return joinNodes(left, first, rest);
+    }
+    Subtree detachFirst(Subtree tree, Node*& first)
+    {
+      Node* current = tree.root;
+      Subtree right = detachSubtree(current->right, tree.height - 1);
+      if (!current->left)
+      {
+        first = current;
+        return right;
+      }
+      Subtree rest = detachFirst(detachSubtree(current->left, tree.height - 1), first);
+      return joinNodes(rest, current, right);
+    }
+    // Splits around key, joining the subtrees hanging off the search path back together on either side.
+    // The heights of consecutive joins telescope, so the whole split is O(log n).
+    template < class Key >
+    SplitResult splitNodes(Subtree tree, const Key& key)
+    {
+      if (!tree.root)
+      {
+        return { tree, nullptr, tree };
+      }
+      Node* current = tree.root;
+      Subtree left = detachSubtree(current->left, tree.height - 1);
+      Subtree right = detachSubtree(current->right, tree.height - 1);
+      if (isLess(current->value.first, key))
+      {
+        SplitResult parts = splitNodes(right, key);
+        parts.less = joinNodes(left, current, parts.less);
+        return parts;
+      }
+      if (isLess(key, current->value.first))
+      {
+        SplitResult parts = splitNodes(left, key);
+        parts.greater = joinNodes(parts.greater, current, right);
+        return parts;
+      }
+      return { left, current, right };
+    }
+    // Turns the first n nodes of a right-linked list into a balanced subtree.
+    // Levels above redDepth are complete, so only the nodes of the last level are red.
+    Node* linkSorted(Node*& head, std::size_t n, int depth, int redDepth)
+    {
+      if (n == 0)
+      {
+        return nullptr;
+      }
+      std::size_t nLeft = (n - 1) / 2;
+      Node* left = linkSorted(head, nLeft, depth + 1, redDepth);
+      Node* current = head;
+      head = head->right;
+      current->left = left;
+      if (left)
+      {
+        left->setParent(current);
+      }
+      current->right = linkSorted(head, n - nLeft - 1, depth + 1, redDepth);
+      if (current->right)
+      {
+        current->right->setParent(current);
+      }
+      current->setColor(depth == redDepth ? Color::Red : Color::Black);
+      updateNode(current);
+      return current;
+    }
+    // Returns whether the black height of the tree has grown, the red having been pushed up to the root.
+    bool insertFixup(Node* target)
+    {
+      while (colorOf(target->parent()) == Color::Red)
+      {
+        Counter::countInsertFixupStep();
+        bool isParentLeft = target->parent() == target->parent()->parent()->left;
+        Node* grandpa = target->parent()->parent();
+        Node* uncle = grandpa->child(!isParentLeft);
+        if (colorOf(uncle) == Color::Red)
+        {
+          target->parent()->setColor(Color::Black);
+          uncle->setColor(Color::Black);
+          grandpa->setColor(Color::Red);
+          target = grandpa;
+        }
+        else
+        {
+          if ((target == target->parent()->right) == isParentLeft)
+          {
+            target = target->parent();
+            rotate(target, isParentLeft);
+          }
+          target->parent()->setColor(Color::Black);
+          target->parent()->parent()->setColor(Color::Red);
+          rotate(target->parent()->parent(), !isParentLeft);
+        }
+      }
+      bool isTaller = root_->color() == Color::Red;
+      root_->setColor(Color::Black);
+      return isTaller;
+    }
+    void eraseNode(Node* target)
+    {
+      unlinkNode(target);
+      destroyNode(target);
+    }
+    // Erases target, or with Options::tombstones marks it and purges a few tombstones instead.
+    void eraseEntry(Node* target)
+    {
+      if constexpr (Options::tombstones)
+      {
+        target->setDead(true);
+        updatePath(target);
+        Graveyard::addTombstones(1);
+        purgeSome();
+        if (2 * Graveyard::nTombstones() > size_)
+        {
+          purgeTombstones();
+        }
+      }
+      else
+      {
+        eraseNode(target);
+      }
+    }
+    // Takes the next Options::purgeStep nodes of the sweep, wrapping around, and erases the tombstones among them.
+    void purgeSome()
+    {
+      Node* current = Graveyard::purgeCursor();
+      for (std::size_t k = 0; k < Options::purgeStep && Graveyard::nTombstones(); ++k)
+      {
+        current = current ? current : minNode(root_);
+        Node* next = iterator::successor(current);
+        if (current->isDead())
+        {
+          Graveyard::removeTombstone();
+          eraseNode(current);
+        }
+        current = next;
+      }
+      Graveyard::setPurgeCursor(current);
+    }
+    // Relinks the live nodes in O(n), without any rotation.
+    void purgeTombstones() noexcept
+    {
+      if (!Graveyard::nTombstones())
+      {
+        return;
+      }
+      Node* head = nullptr;
+      Node* tail = nullptr;
+      std::size_t n = 0;
+      drainInOrder([&](Node* node) {
+        if (node->isDead())
+        {
+          destroyNode(node);
+          return;
+        }
+        (tail ? tail->right : head) = node;
+        tail = node;
+        ++n;
+      });
+      relinkSorted(head, n);
+    }
+    // Puts newNode in the place of the tombstone of its key, so that nothing rebalances.
+    Node* replaceTombstone(Node* tombstone, Node* newNode)
+    {
+      newNode->setParent(tombstone->parent());
+      newNode->setColor(tombstone->color());
+      newNode->left = tombstone->left;
+      newNode->right = tombstone->right;
+      for (Node* child : { newNode->left, newNode->right })
+      {
+        if (child)
+        {
+          child->setParent(newNode);
+        }
+      }
+      updateParentNode(tombstone, newNode);
+      updatePath(newNode);
+      if (tombstone == Graveyard::purgeCursor())
+      {
+        Graveyard::setPurgeCursor(newNode);
       }
+      Graveyard::removeTombstone();
+      destroyNode(tombstone);
+      return newNode;
     }
-    Node* insertNode(Node* candidate, const K& key, const T& value)
+    static bool isTombstone(const Node* node) noexcept
     {
-      if (!candidate)
+      return Options::tombstones && node->isDead();
+    }
+    // The first node from node on that is not a tombstone.
+    static Node* liveFrom(Node* node) noexcept
+    {
+      while (node && isTombstone(node))
       {
-        root_ = new Node{ std::make_pair(key, value), Color::Black };
-        return root_;
+        node = iterator::successor(node);
       }
-      else if (areKeysEqual(key, candidate->value.first))
+      return node;
+    }
+    // The tree splits at from and at to, the nodes in between are set aside and the two ends joined around to.
+    Node* eraseSplitting(Node* from, Node* to)
+    {
+      std::size_t n = size_;
+      SplitResult low = splitNodes(releaseNodes(), from->value.first);
+      Discarded discarded{ nullptr, nullptr, 0 };
+      discarded.push(low.equal);
+      Subtree kept = low.less;
+      if (to)
       {
-        return nullptr;
+        SplitResult high = splitNodes(low.greater, to->value.first);
+        discardTree(high.less.root, discarded);
+        kept = joinNodes(low.less, high.equal, high.greater);
       }
-      Node* newNode = new Node{ std::make_pair(key, value), Color::Red, candidate };
-      if (compare_(candidate->value.first, key))
+      else
       {
-        candidate->right = newNode;
+        discardTree(low.greater.root, discarded);
       }
-      else
+      adoptNodes(kept, n - discarded.count);
+      while (discarded.head)
       {
-        candidate->left = newNode;
+        Node* next = discarded.head->right;
+        destroyNode(discarded.head);
+        discarded.head = next;
       }
-      insertFixup(newNode);
-      return newNode;
+      return to;
     }
-    void insertFixup(Node* target)
+    node_type extractNode(Node* target)
     {
-      while (colorOf(target->p) == Color::Red)
+      if (!target)
       {
-        bool isParentLeft = target->p == target->p->p->left;
-        Node* grandpa = target->p->p;
-        Node* uncle = grandpa->child(!isParentLeft);
-        if (colorOf(uncle) == Color::Red)
-        {
-          target->p->color = Color::Black;
-          uncle->color = Color::Black;
-          grandpa->color = Color::Red;
-          target = grandpa;
-        }
-        else
-        {
-          if ((target == target->p->right) == isParentLeft)
-          {
-            target = target->p;
-            rotate(target, isParentLeft);
-          }
-          target->p->color = Color::Black;
-          target->p->p->color = Color::Red;
-          rotate(target->p->p, !isParentLeft);
-        }
+        return node_type();
       }
-      root_->color = Color::Black;
+      node_type handle(target, alloc_);
+      unlinkNode(target);
+      return handle;
     }
-    void eraseNode(Node* target)
+    // Makes an unlinked node ready for linkNode().
+    static Node* resetNode(Node* target) noexcept
+    {
+      target->left = nullptr;
+      target->right = nullptr;
+      target->setParent(nullptr);
+      if constexpr (Options::orderStatistic)
+      {
+        target->size = 1;
+      }
+      if constexpr (HAS_AUGMENT)
+      {
+        target->aggregate = ownAggregate(target);
+      }
+      return target;
+    }
+    // Takes target out of the tree and rebalances, leaving the node alive.
+    void unlinkNode(Node* target)
     {
       assert(target);
-      Color erasedColor = target->color;
-      Node* brokenNode = target->p;
-      bool isLeftBroken = target == root_ || target == target->p->left;
+      if (target == Graveyard::purgeCursor())
+      {
+        Graveyard::setPurgeCursor(iterator::successor(target));
+      }
+      Color erasedColor = target->color();
+      Node* brokenNode = target->parent();
+      bool isLeftBroken = target == root_ || target == target->parent()->left;
       int nBranches = (target->left != nullptr) + (target->right != nullptr);
       switch (nBranches)
       {
@@ -321,39 +2064,53 @@ namespace demidenko
       case 1:
       {
         Node* candidate = target->child(target->left);
-        candidate->p = target->p;
+        candidate->setParent(target->parent());
         updateParentNode(target, candidate);
         break;
       }
       case 2:
       {
         Node* candidate = minNode(target->right);
-        erasedColor = candidate->color;
+        erasedColor = candidate->color();
         brokenNode = candidate;
         isLeftBroken = false;
         if (candidate != target->right)
         {
+          brokenNode = candidate->parent();
           isLeftBroken = true;
-          candidate->p->left = candidate->right;
+          candidate->parent()->left = candidate->right;
           if (candidate->right)
           {
-            candidate->right->p = candidate->p;
+            candidate->right->setParent(candidate->parent());
           }
-          target->right->p = candidate;
+          target->right->setParent(candidate);
           candidate->right = target->right;
         }
-        target->left->p = candidate;
+        target->left->setParent(candidate);
         candidate->left = target->left;
-        candidate->p = target->p;
-        candidate->color = target->color;
+        candidate->setParent(target->parent());
+        candidate->setColor(target->color());
         updateParentNode(target, candidate);
         break;
       }
       }
-      delete target;
+      if (Finger::isFinger(target))
+      {
+        Finger::forgetFinger();
+        Finger::setFinger(brokenNode);
+      }
+      --size_;
+      updatePath(brokenNode);
       if (erasedColor == Color::Black)
       {
-        eraseFixup(brokenNode, isLeftBroken);
+        if (brokenNode)
+        {
+          eraseFixup(brokenNode, isLeftBroken);
+        }
+        else if (root_)
+        {
+          root_->setColor(Color::Black);
+        }
       }
     }
     void eraseFixup(Node* target, bool isLeftBroken)
@@ -363,19 +2120,20 @@ namespace demidenko
       Node* brother = target->child(!isLeftBroken);
       while (target && colorOf(child) == Color::Black)
       {
+        Counter::countEraseFixupStep();
         if (colorOf(brother) == Color::Red)
         {
-          brother->color = Color::Black;
-          target->color = Color::Red;
+          brother->setColor(Color::Black);
+          target->setColor(Color::Red);
           rotate(target, isLeftBroken);
           brother = target->child(!isLeftBroken);
         }
         assert(brother);
         if (colorOf(brother->child(isLeftBroken)) == Color::Black && colorOf(brother->child(!isLeftBroken)) == Color::Black)
         {
-          brother->color = Color::Red;
-          isLeftBroken = target == root_ || target == target->p->child(isLeftBroken);
-          target = target->p;
+          brother->setColor(Color::Red);
+          isLeftBroken = target == root_ || target == target->parent()->left;
+          target = target->parent();
           if (target)
           {
             child = target->child(isLeftBroken);
@@ -386,39 +2144,39 @@ namespace demidenko
         {
           if (colorOf(brother->child(!isLeftBroken)) == Color::Black)
           {
-            brother->child(isLeftBroken)->color = Color::Black;
-            brother->color = Color::Red;
+            brother->child(isLeftBroken)->setColor(Color::Black);
+            brother->setColor(Color::Red);
             rotate(brother, !isLeftBroken);
             brother = target->child(!isLeftBroken);
           }
-          brother->color = target->color;
-          target->color = Color::Black;
+          brother->setColor(target->color());
+          target->setColor(Color::Black);
           assert(brother->child(!isLeftBroken));
-          brother->child(!isLeftBroken)->color = Color::Black;
+          brother->child(!isLeftBroken)->setColor(Color::Black);
           rotate(target, isLeftBroken);
           target = nullptr;
         }
       }
       if (target)
       {
-        target->child(isLeftBroken)->color = Color::Black;
+        target->child(isLeftBroken)->setColor(Color::Black);
       }
       else if (root_)
       {
-        root_->color = Color::Black;
+        root_->setColor(Color::Black);
       }
     }
     void updateParentNode(Node* oldNode, Node* newNode)
     {
-      if (oldNode->p)
+      if (oldNode->parent())
       {
-        if (compare_(oldNode->value.first, oldNode->p->value.first))
+        if (oldNode->parent()->left == oldNode)
         {
-          oldNode->p->left = newNode;
+          oldNode->parent()->left = newNode;
         }
         else
         {
-          oldNode->p->right = newNode;
+          oldNode->parent()->right = newNode;
         }
       }
       else
@@ -426,40 +2184,336 @@ namespace demidenko
         root_ = newNode;
       }
     }
-    Node* findNode(const K& key) const
+    // Every descent below makes a single comparison per level and checks equality once at the end.
+    template < class Key >
+    Node* findEqualNode(const Key& key) const
+    {
+      if constexpr (IS_THREE_WAY)
+      {
+        Node* current = root_;
+        if constexpr (Options::fingerSearch)
+        {
+          Node* upper = nullptr;
+          current = fingerStart(key, upper);
+        }
+        for (std::size_t depth = 1; current; ++depth)
+        {
+          Counter::countComparison();
+          Counter::countDepth(depth);
+          auto order = compare_(key, current->value.first);
+          if (order == 0)
+          {
+            Finger::setFinger(current);
+            return isTombstone(current) ? nullptr : current;
+          }
+          current = order < 0 ? current->left : current->right;
+        }
+        return nullptr;
+      }
+      else
+      {
+        Node* candidate = lowerBoundNode(key);
+        return candidate && !isLess(key, candidate->value.first) ? candidate : nullptr;
+      }
+    }
+    template < class ForwardIt, class F >
+    void findBatchNodes(ForwardIt first, ForwardIt last, F&& emit) const
+    {
+      ForwardIt keys[BATCH_LANES];
+      Node* current[BATCH_LANES];
+      Node* candidate[BATCH_LANES];
+      while (first != last)
+      {
+        std::size_t n = 0;
+        for (; n < BATCH_LANES && first != last; ++n, ++first)
+        {
+          keys[n] = first;
+          current[n] = root_;
+          candidate[n] = nullptr;
+        }
+        for (bool isActive = true; isActive;)
+        {
+          isActive = false;
+          for (std::size_t i = 0; i < n; ++i)
+          {
+            if (!current[i])
+            {
+              continue;
+            }
+            bool isRight = isLess(current[i]->value.first, *keys[i]);
+            candidate[i] = isRight ? candidate[i] : current[i];
+            current[i] = current[i]->child(!isRight);
+            detail::prefetch(reinterpret_cast< std::uintptr_t >(current[i]));
+            isActive = isActive || current[i];
+          }
+        }
+        for (std::size_t i = 0; i < n; ++i)
+        {
+          bool isFound = candidate[i] && !isLess(*keys[i], candidate[i]->value.first) && !isTombstone(candidate[i]);
+          emit(isFound ? candidate[i] : nullptr);
+        }
+      }
+    }
+    template < class Key >
+    Node* atNode(const Key& key) const
+    {
+      Node* candidate = findEqualNode(key);
+      if (!candidate)
+      {
+        throw std::out_of_range("There are no such element\n");
+      }
+      return candidate;
+    }
+    template < class Key >
+    Node* upperBoundNode(const Key& key) const
+    {
+      Node* current = root_;
+      Node* candidate = nullptr;
+      for (std::size_t depth = 1; current; ++depth)
+      {
+        Counter::countDepth(depth);
+        if (isLess(key, current->value.first))
+        {
+          candidate = current;
+          current = current->left;
+        }
+        else
+        {
+          current = current->right;
+        }
+      }
+      return liveFrom(candidate);
+    }
+    template < class Key >
+    std::pair< Node*, Node* > equalRangeNodes(const Key& key) const
     {
       Node* current = root_;
-      bool hasFound = root_ == nullptr;
-      while (!hasFound)
+      Node* upper = nullptr;
+      while (current)
+      {
+        if (isLess(current->value.first, key))
+        {
+          current = current->right;
+        }
+        else if (isLess(key, current->value.first))
+        {
+          upper = current;
+          current = current->left;
+        }
+        else
+        {
+          Node* next = liveFrom(current->right ? minNode(current->right) : upper);
+          return { isTombstone(current) ? next : current, next };
+        }
+      }
+      upper = liveFrom(upper);
+      return { upper, upper };
+    }
+    // An RB tree of n < 2^digits nodes is at most 2 * digits levels high.
+    static constexpr std::size_t MAX_HEIGHT = 2 * std::numeric_limits< std::size_t >::digits;
+    template < bool REVERSE, class F >
+    void visitAll(Node* root, F&& f) const
+    {
+      Node* stack[MAX_HEIGHT];
+      std::size_t top = 0;
+      auto pushSpine = [&](Node* current) {
+        for (; current; current = current->child(!REVERSE))
+        {
+          stack[top++] = current;
+        }
+      };
+      pushSpine(root);
+      while (top)
+      {
+        Node* current = stack[--top];
+        if (!isTombstone(current))
+        {
+          f(current->value);
+        }
+        pushSpine(current->child(REVERSE));
+      }
+    }
+    template < class F >
+    void visitRange(Node* root, const K& lo, const K& hi, F&& f) const
+    {
+      Node* stack[MAX_HEIGHT];
+      std::size_t top = 0;
+      for (Node* current = root; current;)
+      {
+        if (isLess(current->value.first, lo))
+        {
+          current = current->right;
+        }
+        else
+        {
+          stack[top++] = current;
+          current = current->left;
+        }
+      }
+      while (top)
       {
-        if (areKeysEqual(key, current->value.first))
+        Node* current = stack[--top];
+        if (!isLess(current->value.first, hi))
+        {
+          return;
+        }
+        if (!isTombstone(current))
+        {
+          f(current->value);
+        }
+        for (current = current->right; current; current = current->left)
         {
-          hasFound = true;
+          stack[top++] = current;
         }
-        else if (compare_(key, current->value.first))
+      }
+    }
+    template < class Key >
+    Node* lowerBoundNode(const Key& key) const
+    {
+      if constexpr (Options::fingerSearch)
+      {
+        Node* upper = nullptr;
+        Node* start = fingerStart(key, upper);
+        Node* bound = lowerBoundNode(key, start);
+        bound = bound ? bound : upper;
+        Finger::setFinger(bound);
+        return liveFrom(bound);
+      }
+      else
+      {
+        return liveFrom(lowerBoundNode(key, root_));
+      }
+    }
+    template < class Key >
+    Node* lowerBoundNode(const Key& key, Node* current) const
+    {
+      Node* candidate = nullptr;
+      for (std::size_t depth = 1; current; ++depth)
+      {
+        Counter::countDepth(depth);
+        if constexpr (IS_THREE_WAY)
         {
-          if (current->left)
+          Counter::countComparison();
+          auto order = compare_(current->value.first, key);
+          if (order == 0)
           {
-            current = current->left;
+            return current;
           }
-          else
+          if (order > 0)
           {
-            hasFound = true;
+            candidate = current;
           }
+          current = order < 0 ? current->right : current->left;
+        }
+        else if (isLess(current->value.first, key))
+        {
+          current = current->right;
         }
         else
         {
-          if (current->right)
+          candidate = current;
+          current = current->left;
+        }
+      }
+      return candidate;
+    }
+    // Checks the neighbours of hint first and falls back to the full descent.
+    template < class Key >
+    InsertPosition findHintedPosition(const_iterator hint, const Key& key) const
+    {
+      Node* next = hint.node_;
+      if (!next)
+      {
+        Node* last = maxNode(root_);
+        if (!last || isLess(last->value.first, key))
+        {
+          return { last, false, nullptr };
+        }
+      }
+      else if (isLess(key, next->value.first))
+      {
+        Node* prev = iterator::predesessor(next);
+        if (!prev || isLess(prev->value.first, key))
+        {
+          return next->left ? InsertPosition{ prev, false, nullptr } : InsertPosition{ next, true, nullptr };
+        }
+      }
+      else if (!isLess(next->value.first, key))
+      {
+        return withTombstone({ next, false, next });
+      }
+      else
+      {
+        Node* after = iterator::successor(next);
+        if (!after || isLess(key, after->value.first))
+        {
+          return next->right ? InsertPosition{ after, true, nullptr } : InsertPosition{ next, false, nullptr };
+        }
+      }
+      return findInsertPosition(key);
+    }
+    template < class Key >
+    InsertPosition findInsertPosition(const Key& key) const
+    {
+      if constexpr (Options::fingerSearch)
+      {
+        Node* upper = nullptr;
+        InsertPosition position = findInsertPosition(key, fingerStart(key, upper));
+        Finger::setFinger(position.existing ? position.existing : position.parent);
+        return position;
+      }
+      else
+      {
+        return findInsertPosition(key, root_);
+      }
+    }
+    // Descends from current, which must be the root or a subtree spanning key, as spanningAncestor() and
+    // fingerStart() find.
+    template < class Key >
+    InsertPosition findInsertPosition(const Key& key, Node* current) const
+    {
+      InsertPosition position{ nullptr, false, nullptr };
+      Node* candidate = nullptr;
+      for (std::size_t depth = 1; current; ++depth)
+      {
+        Counter::countDepth(depth);
+        position.parent = current;
+        if constexpr (IS_THREE_WAY)
+        {
+          Counter::countComparison();
+          auto order = compare_(key, current->value.first);
+          if (order == 0)
           {
-            current = current->right;
+            position.existing = current;
+            return withTombstone(position);
           }
-          else
+          position.isLeft = order < 0;
+        }
+        else
+        {
+          position.isLeft = isLess(key, current->value.first);
+          if (!position.isLeft)
           {
-            hasFound = true;
+            candidate = current;
           }
         }
+        current = current->child(position.isLeft);
       }
-      return current;
+      if (candidate && !isLess(candidate->value.first, key))
+      {
+        position.existing = candidate;
+      }
+      return withTombstone(position);
+    }
+    // A tombstone found is no existing node but one to replace.
+    InsertPosition withTombstone(InsertPosition position) const noexcept
+    {
+      if (position.existing && isTombstone(position.existing))
+      {
+        position.tombstone = position.existing;
+        position.existing = nullptr;
+      }
+      return position;
     }
     Node* minNode(Node* target) const
     {
@@ -473,6 +2527,18 @@ namespace demidenko
       }
       return target;
     }
+    Node* maxNode(Node* target) const
+    {
+      if (!target)
+      {
+        return nullptr;
+      }
+      while (target->right)
+      {
+        target = target->right;
+      }
+      return target;
+    }
     void rotate(Node* target, bool isLeft)
     {
       if (isLeft)
@@ -487,36 +2553,165 @@ namespace demidenko
     void rotateRight(Node* target)
     {
       assert(target->left);
+      Counter::countRotation();
       updateParentNode(target, target->left);
       Node* middle = target->left->right;
 
-      target->left->p = target->p;
+      target->left->setParent(target->parent());
       target->left->right = target;
 
-      target->p = target->left;
+      target->setParent(target->left);
       target->left = middle;
 
       if (middle)
       {
-        middle->p = target;
+        middle->setParent(target);
       }
+      updateNode(target);
+      updateNode(target->parent());
     }
     void rotateLeft(Node* target)
     {
       assert(target->right);
+      Counter::countRotation();
       updateParentNode(target, target->right);
       Node* middle = target->right->left;
 
-      target->right->p = target->p;
+      target->right->setParent(target->parent());
       target->right->left = target;
 
-      target->p = target->right;
+      target->setParent(target->right);
       target->right = middle;
 
       if (middle)
       {
-        middle->p = target;
+        middle->setParent(target);
+      }
+      updateNode(target);
+      updateNode(target->parent());
+    }
+    // Recomputes what a node keeps about its subtree from its children.
+    void updateNode(Node* target) const noexcept
+    {
+      if constexpr (Options::orderStatistic)
+      {
+        target->size = 1 + sizeOf(target->left) + sizeOf(target->right);
+      }
+      if constexpr (HAS_AUGMENT)
+      {
+        target->aggregate = Augment::combine(Augment::combine(aggregateOf(target->left), ownAggregate(target)),
+          aggregateOf(target->right));
+      }
+    }
+    void updatePath(Node* target) const noexcept
+    {
+      if constexpr (Options::orderStatistic || HAS_AUGMENT)
+      {
+        for (; target; target = target->parent())
+        {
+          updateNode(target);
+        }
+      }
+    }
+    std::size_t sizeOf(const Node* target) const noexcept
+    {
+      return target ? target->size : 0;
+    }
+    static aggregate_type aggregateOf(const Node* target) noexcept
+    {
+      return target ? target->aggregate : Augment::identity();
+    }
+    // What the element of target adds to the aggregates, nothing for a tombstone.
+    static aggregate_type ownAggregate(const Node* target) noexcept
+    {
+      return isTombstone(target) ? Augment::identity() : Augment::of(target->value);
+    }
+    // The first node of the subtree of root whose own aggregate satisfies pred, skipping the subtrees whose
+    // aggregate does not: the leftmost such descent, then on from where it stops.
+    template < class Pred >
+    Node* firstWhereNode(Node* root, Pred& pred) const
+    {
+      static_assert(HAS_AUGMENT, "aggregates need Options::Augment");
+      if (!root || !pred(root->aggregate))
+      {
+        return nullptr;
+      }
+      Node* current = root;
+      while (current->left && pred(current->left->aggregate))
+      {
+        current = current->left;
+      }
+      return nextWhereNode(current, pred, root);
+    }
+    // The same from position on within the subtree of root, the whole tree by default: position itself, its right
+    // subtree, then the ancestors it is left of, backtracking out of subtrees that hold no match.
+    template < class Pred >
+    Node* nextWhereNode(Node* position, Pred& pred, const Node* root = nullptr) const
+    {
+      static_assert(HAS_AUGMENT, "aggregates need Options::Augment");
+      for (Node* current = position; current; current = current->parent())
+      {
+        if (current == position || current->left == position)
+        {
+          if (!isTombstone(current) && pred(Augment::of(current->value)))
+          {
+            return current;
+          }
+          if (Node* found = firstWhereNode(current->right, pred))
+          {
+            return found;
+          }
+        }
+        if (current == root)
+        {
+          break;
+        }
+        position = current;
+      }
+      return nullptr;
+    }
+    Node* nthNode(std::size_t index) const
+    {
+      static_assert(Options::orderStatistic, "nth needs subtree sizes");
+      Node* current = root_;
+      while (current)
+      {
+        std::size_t nLeft = sizeOf(current->left);
+        if (index == nLeft)
+        {
+          return current;
+        }
+        if (index < nLeft)
+        {
+          current = current->left;
+        }
+        else
+        {
+          index -= nLeft + 1;
+          current = current->right;
+        }
+      }
+      return nullptr;
+    }
+    template < class Key >
+    std::size_t rankOf(const Key& key) const
+    {
+      static_assert(Options::orderStatistic, "rank needs subtree sizes");
+      std::size_t result = 0;
+      Node* current = root_;
+      while (current)
+      {
+        if (isLess(current->value.first, key))
+        {
+          result += sizeOf(current->left) + 1;
+          current = current->right;
+        }
+        else
+        {
+          current = current->left;
+        }
       }
+      return result;
     }
     // returns black height. 0 means error.
     int isWeakRBTree(const Node* target) const
@@ -525,11 +2720,18 @@ namespace demidenko
       {
         return 1;
       }
-      bool isRed = target->color == Color::Red;
+      bool isRed = target->color() == Color::Red;
       if (isRed && (colorOf(target->left) == Color::Red || colorOf(target->right) == Color::Red))
       {
         return 0;
       }
+      if constexpr (Options::orderStatistic)
+      {
+        if (target->size != 1 + sizeOf(target->left) + sizeOf(target->right))
+        {
+          return 0;
+        }
+      }
       int result = isWeakRBTree(target->right);
       if ((result == 0) || (result != isWeakRBTree(target->left)))
       {
@@ -541,20 +2743,37 @@ namespace demidenko
     {
       if (target)
       {
-        return target->color;
+        return target->color();
       }
       else
       {
         return Color::Black;
       }
     }
-    bool areKeysEqual(const K& first, const K& second) const
+    template < class First, class Second >
+    bool isLess(const First& first, const Second& second) const
     {
-      return !(compare_(first, second) || compare_(second, first));
+      Counter::countComparison();
+      if constexpr (IS_THREE_WAY)
+      {
+        return compare_(first, second) < 0;
+      }
+      else
+      {
+        return compare_(first, second);
+      }
     }
 
     Node* root_;
+    std::size_t size_;
     Compare compare_;
+    NodeAllocator alloc_;
   };
+  template < class K, class T, class Compare, class Allocator, class Options >
+  void swap(RBTree< K, T, Compare, Allocator, Options >& lhs, RBTree< K, T, Compare, Allocator, Options >& rhs) noexcept(
+    noexcept(lhs.swap(rhs)))
+  {
+    lhs.swap(rhs);
+  }
 }
 #endif
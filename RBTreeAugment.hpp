@@ -0,0 +1,55 @@
+#ifndef RBTREE_AUGMENT_HPP
+#define RBTREE_AUGMENT_HPP
+
+#include <limits>
+
+namespace demidenko
+{
+  // Monoids for Options::Augment. Besides value_type, an augment provides:
+  //   static value_type identity();
+  //   static value_type of(const std::pair< const K, T >& element);
+  //   static value_type combine(const value_type& lhs, const value_type& rhs);
+  // where combine is associative, not necessarily commutative, takes the elements of lhs as smaller keys,
+  // and neither of the three throws. Every node keeps the combination of its subtree.
+  struct NoAugment
+  {};
+  // Sum of the mapped values, for range sums.
+  template < class T >
+  struct ValueSum
+  {
+    using value_type = T;
+    static value_type identity() noexcept
+    {
+      return T();
+    }
+    template < class Pair >
+    static value_type of(const Pair& element) noexcept
+    {
+      return element.second;
+    }
+    static value_type combine(const value_type& lhs, const value_type& rhs) noexcept
+    {
+      return lhs + rhs;
+    }
+  };
+  // Greatest mapped value: the maximal end of an interval tree keyed by interval starts.
+  template < class T >
+  struct ValueMax
+  {
+    using value_type = T;
+    static value_type identity() noexcept
+    {
+      return std::numeric_limits< T >::lowest();
+    }
+    template < class Pair >
+    static value_type of(const Pair& element) noexcept
+    {
+      return element.second;
+    }
+    static value_type combine(const value_type& lhs, const value_type& rhs) noexcept
+    {
+      return lhs < rhs ? rhs : lhs;
+    }
+  };
+}
+#endif
@@ -8,43 +8,57 @@
 
 namespace demidenko
 {
-  template < class K, class T, class Compare >
+  template < class K, class T, class Compare, class Allocator, class Options >
   class RBTree;
 
-  template < class K, class T, class Compare, bool CONST >
+  template < class Node, bool CONST >
   class RBTreeIterator
   {
-    friend class RBTree< K, T, Compare >;
+    template < class, class, class, class, class >
+    friend class RBTree;
+    template < class, bool >
+    friend class RBTreeIterator;
 
   public:
     using difference_type = std::ptrdiff_t;
-    using value_type = std::conditional_t< CONST, const std::pair< const K, T >, std::pair< const K, T > >;
+    using value_type = std::conditional_t< CONST, const typename Node::value_type, typename Node::value_type >;
     using reference = value_type&;
     using pointer = value_type*;
     using iterator_category = std::bidirectional_iterator_tag;
 
     RBTreeIterator(const RBTreeIterator&) = default;
+    template < bool OTHER_CONST, class = std::enable_if_t< CONST && !OTHER_CONST > >
+    RBTreeIterator(const RBTreeIterator< Node, OTHER_CONST >& other):
+      node_(other.node_)
+    {}
     ~RBTreeIterator() = default;
-    RBTreeIterator< K, T, Compare, CONST >& operator=(const RBTreeIterator< K, T, Compare, CONST >&) = default;
-    RBTreeIterator< K, T, Compare, CONST >& operator++()
+    RBTreeIterator< Node, CONST >& operator=(const RBTreeIterator< Node, CONST >&) = default;
+    // Both skip the tombstones of Options::tombstones.
+    RBTreeIterator< Node, CONST >& operator++()
     {
-      node_ = successor(node_);
+      do
+      {
+        node_ = successor(node_);
+      } while (Node::HAS_TOMBSTONES && node_ && node_->isDead());
       return *this;
     }
-    RBTreeIterator< K, T, Compare, CONST > operator++(int)
+    RBTreeIterator< Node, CONST > operator++(int)
     {
-      RBTreeIterator< K, T, Compare, CONST > temp(*this);
+      RBTreeIterator< Node, CONST > temp(*this);
       ++*this;
       return temp;
     }
-    RBTreeIterator< K, T, Compare, CONST >& operator--()
+    RBTreeIterator< Node, CONST >& operator--()
     {
-      node_ = predesessor(node_);
+      do
+      {
+        node_ = predesessor(node_);
+      } while (Node::HAS_TOMBSTONES && node_ && node_->isDead());
       return *this;
     }
-    RBTreeIterator< K, T, Compare, CONST > operator--(int)
+    RBTreeIterator< Node, CONST > operator--(int)
     {
-      RBTreeIterator< K, T, Compare, CONST > temp(*this);
+      RBTreeIterator< Node, CONST > temp(*this);
       --*this;
       return temp;
     }
@@ -68,20 +82,19 @@ namespace demidenko
       return std::addressof(node_->value);
     }
 
-    bool operator==(const RBTreeIterator< K, T, Compare, CONST >& other) const
+    bool operator==(const RBTreeIterator< Node, CONST >& other) const
     {
       return node_ == other.node_;
     }
-    bool operator!=(const RBTreeIterator< K, T, Compare, CONST >& other) const
+    bool operator!=(const RBTreeIterator< Node, CONST >& other) const
     {
       return node_ != other.node_;
     }
 
   private:
-    using Node = detail::Node< K, T >;
     explicit RBTreeIterator(Node* node):
       node_(node){};
-    Node* successor(Node* target) const
+    static Node* successor(Node* target)
     {
       if (target->right)
       {
@@ -94,16 +107,16 @@ namespace demidenko
       }
       else
       {
-        Node* candidate = target->p;
+        Node* candidate = target->parent();
         while (candidate && candidate->right == target)
         {
           target = candidate;
-          candidate = candidate->p;
+          candidate = candidate->parent();
         }
         return candidate;
       }
     }
-    Node* predesessor(Node* target) const
+    static Node* predesessor(Node* target)
     {
       if (target->left)
       {
@@ -116,11 +129,11 @@ namespace demidenko
       }
       else
       {
-        Node* candidate = target->p;
+        Node* candidate = target->parent();
         while (candidate && candidate->left == target)
         {
           target = candidate;
-          candidate = candidate->p;
+          candidate = candidate->parent();
         }
         return candidate;
       }
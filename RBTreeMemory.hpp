@@ -0,0 +1,35 @@
+#ifndef RBTREE_MEMORY_HPP
+#define RBTREE_MEMORY_HPP
+
+#include <cstddef>
+
+namespace demidenko
+{
+  // Memory an RBTree holds, as reported by memoryUsage().
+  struct RBTreeMemory
+  {
+    std::size_t nodes;
+    // sizeof the node: the value, the links, the color and the padding between them.
+    std::size_t nodeBytes;
+    // Part of nodeBytes that holds nothing.
+    std::size_t paddingBytes;
+    // What the allocator takes per node, its own overhead included. Same as nodeBytes().
+    std::size_t blockBytes;
+    // The tree object and every byte its allocator holds for it, live nodes or not.
+    std::size_t totalBytes;
+    // Share of the memory held for nodes that holds none: free blocks and uncarved slab space of a pool.
+    double fragmentation;
+  };
+
+  namespace detail
+  {
+    // Heap block of an operator new of size bytes, laid out as glibc malloc does: a size word in front,
+    // rounded up to 16 bytes, 32 at least. Other heaps are close.
+    constexpr std::size_t heapBlockBytes(std::size_t size) noexcept
+    {
+      std::size_t block = (size + sizeof(std::size_t) + 15) / 16 * 16;
+      return block < 4 * sizeof(std::size_t) ? 4 * sizeof(std::size_t) : block;
+    }
+  }
+}
+#endif
@@ -1,7 +1,10 @@
 #ifndef RBTREE_NODE_HPP
 #define RBTREE_NODE_HPP
 
+#include <cstddef>
+#include <cstdint>
 #include <utility>
+#include "RBTreeAugment.hpp"
 
 namespace demidenko
 {
@@ -12,12 +15,230 @@ namespace demidenko
       Black,
       Red
     };
-    template < class K, class T >
-    struct Node
+    template < class Augment >
+    struct SubtreeAggregate
     {
-      std::pair< const K, T > value;
-      Color color;
-      Node* p = nullptr;
+      typename Augment::value_type aggregate = Augment::identity();
+    };
+    template <>
+    struct SubtreeAggregate< NoAugment >
+    {};
+    template < class Augment >
+    struct AggregateType
+    {
+      using type = typename Augment::value_type;
+    };
+    template <>
+    struct AggregateType< NoAugment >
+    {
+      using type = void;
+    };
+    template < bool SIZED >
+    struct SubtreeSize
+    {};
+    template <>
+    struct SubtreeSize< true >
+    {
+      std::size_t size = 1;
+    };
+    // The tombstone mark of Options::tombstones shares the storage of the color.
+    constexpr unsigned COLOR_MASK = 1;
+    constexpr unsigned DEAD_MASK = 2;
+    template < class Node, bool COMPACT >
+    class ParentLink
+    {
+    public:
+      ParentLink(Color color, Node* parent) noexcept:
+        parent_(parent),
+        color_(color)
+      {}
+      Node* parent() const noexcept
+      {
+        return parent_;
+      }
+      void setParent(Node* parent) noexcept
+      {
+        parent_ = parent;
+      }
+      Color color() const noexcept
+      {
+        return static_cast< Color >(static_cast< unsigned >(color_) & COLOR_MASK);
+      }
+      void setColor(Color color) noexcept
+      {
+        color_ = static_cast< Color >((static_cast< unsigned >(color_) & DEAD_MASK) | static_cast< unsigned >(color));
+      }
+      bool isDead() const noexcept
+      {
+        return static_cast< unsigned >(color_) & DEAD_MASK;
+      }
+      void setDead(bool isDead) noexcept
+      {
+        color_ = static_cast< Color >(static_cast< unsigned >(color()) | (isDead ? DEAD_MASK : 0));
+      }
+
+    private:
+      Node* parent_;
+      Color color_;
+    };
+    // Keeps the color and the tombstone mark in the lowest bits of the parent pointer.
+    template < class Node >
+    class ParentLink< Node, true >
+    {
+    public:
+      ParentLink(Color color, Node* parent) noexcept:
+        bits_(reinterpret_cast< std::uintptr_t >(parent) | static_cast< std::uintptr_t >(color))
+      {}
+      Node* parent() const noexcept
+      {
+        return reinterpret_cast< Node* >(bits_ & ~FLAG_MASK);
+      }
+      void setParent(Node* parent) noexcept
+      {
+        bits_ = reinterpret_cast< std::uintptr_t >(parent) | (bits_ & FLAG_MASK);
+      }
+      Color color() const noexcept
+      {
+        return static_cast< Color >(bits_ & COLOR_MASK);
+      }
+      void setColor(Color color) noexcept
+      {
+        bits_ = (bits_ & ~std::uintptr_t(COLOR_MASK)) | static_cast< std::uintptr_t >(color);
+      }
+      bool isDead() const noexcept
+      {
+        return bits_ & DEAD_MASK;
+      }
+      void setDead(bool isDead) noexcept
+      {
+        bits_ = (bits_ & ~std::uintptr_t(DEAD_MASK)) | (isDead ? DEAD_MASK : 0);
+      }
+
+    private:
+      static constexpr std::uintptr_t FLAG_MASK = COLOR_MASK | DEAD_MASK;
+      std::uintptr_t bits_;
+    };
+
+    // The node a tree with Options::fingerSearch found last, where its next search starts. Nothing without it.
+    template < class Node, bool ENABLED >
+    class FingerCache
+    {
+    protected:
+      Node* finger() const noexcept
+      {
+        return nullptr;
+      }
+      void setFinger(Node*) const noexcept
+      {}
+      bool isFinger(const Node*) const noexcept
+      {
+        return false;
+      }
+      void forgetFinger() const noexcept
+      {}
+    };
+    template < class Node >
+    class FingerCache< Node, true >
+    {
+    protected:
+      Node* finger() const noexcept
+      {
+        return finger_;
+      }
+      void setFinger(Node* node) const noexcept
+      {
+        finger_ = node ? node : finger_;
+      }
+      bool isFinger(const Node* node) const noexcept
+      {
+        return node == finger_;
+      }
+      void forgetFinger() const noexcept
+      {
+        finger_ = nullptr;
+      }
+
+    private:
+      mutable Node* finger_ = nullptr;
+    };
+
+    // The tombstones of a tree with Options::tombstones and the node its next purging step starts from.
+    template < class Node, bool ENABLED >
+    class Graveyard
+    {
+    protected:
+      std::size_t nTombstones() const noexcept
+      {
+        return 0;
+      }
+      void addTombstones(std::size_t) noexcept
+      {}
+      void removeTombstone() noexcept
+      {}
+      Node* purgeCursor() const noexcept
+      {
+        return nullptr;
+      }
+      void setPurgeCursor(Node*) noexcept
+      {}
+      void forgetTombstones() noexcept
+      {}
+      void swapTombstones(Graveyard&) noexcept
+      {}
+    };
+    template < class Node >
+    class Graveyard< Node, true >
+    {
+    protected:
+      std::size_t nTombstones() const noexcept
+      {
+        return nTombstones_;
+      }
+      void addTombstones(std::size_t n) noexcept
+      {
+        nTombstones_ += n;
+      }
+      void removeTombstone() noexcept
+      {
+        --nTombstones_;
+      }
+      Node* purgeCursor() const noexcept
+      {
+        return cursor_;
+      }
+      void setPurgeCursor(Node* node) noexcept
+      {
+        cursor_ = node;
+      }
+      void forgetTombstones() noexcept
+      {
+        nTombstones_ = 0;
+        cursor_ = nullptr;
+      }
+      void swapTombstones(Graveyard& other) noexcept
+      {
+        std::swap(nTombstones_, other.nTombstones_);
+        std::swap(cursor_, other.cursor_);
+      }
+
+    private:
+      std::size_t nTombstones_ = 0;
+      Node* cursor_ = nullptr;
+    };
+
+    template < class K, class T, class Options >
+    struct Node: SubtreeSize< Options::orderStatistic >,
+                 SubtreeAggregate< typename Options::Augment >,
+                 ParentLink< Node< K, T, Options >, Options::compactNodes >
+    {
+      using value_type = std::pair< const K, T >;
+      static constexpr bool HAS_TOMBSTONES = Options::tombstones;
+      template < class... Args >
+      Node(Color color, Node* parent, Args&&... args):
+        ParentLink< Node< K, T, Options >, Options::compactNodes >(color, parent),
+        value(std::forward< Args >(args)...)
+      {}
+      value_type value;
       Node* left = nullptr;
       Node* right = nullptr;
       Node* child(bool isLeft)
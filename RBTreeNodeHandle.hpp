@@ -0,0 +1,87 @@
+#ifndef RBTREE_NODE_HANDLE_HPP
+#define RBTREE_NODE_HANDLE_HPP
+
+#include <memory>
+#include <optional>
+#include <utility>
+
+namespace demidenko
+{
+  template < class K, class T, class Compare, class Allocator, class Options >
+  class RBTree;
+
+  // Owns a node extracted from an RBTree, with a copy of the allocator that frees it, until it is inserted again.
+  template < class Node, class NodeAllocator >
+  class RBTreeNodeHandle
+  {
+    template < class, class, class, class, class >
+    friend class RBTree;
+    using NodeTraits = std::allocator_traits< NodeAllocator >;
+
+  public:
+    using value_type = typename Node::value_type;
+    using key_type = typename value_type::first_type;
+    using mapped_type = typename value_type::second_type;
+
+    RBTreeNodeHandle() noexcept:
+      node_(nullptr)
+    {}
+    RBTreeNodeHandle(RBTreeNodeHandle< Node, NodeAllocator >&& src) noexcept:
+      node_(src.node_),
+      alloc_(std::move(src.alloc_))
+    {
+      src.node_ = nullptr;
+      src.alloc_.reset();
+    }
+    RBTreeNodeHandle(const RBTreeNodeHandle< Node, NodeAllocator >&) = delete;
+    RBTreeNodeHandle< Node, NodeAllocator >& operator=(RBTreeNodeHandle< Node, NodeAllocator >&& src) noexcept
+    {
+      std::swap(node_, src.node_);
+      std::swap(alloc_, src.alloc_);
+      return *this;
+    }
+    RBTreeNodeHandle< Node, NodeAllocator >& operator=(const RBTreeNodeHandle< Node, NodeAllocator >&) = delete;
+    ~RBTreeNodeHandle()
+    {
+      if (node_)
+      {
+        node_->~Node();
+        NodeTraits::deallocate(*alloc_, node_, 1);
+      }
+    }
+    bool empty() const noexcept
+    {
+      return node_ == nullptr;
+    }
+    explicit operator bool() const noexcept
+    {
+      return node_ != nullptr;
+    }
+    // Both need a non-empty handle.
+    key_type& key() const noexcept
+    {
+      return node_->value.first;
+    }
+    mapped_type& mapped() const noexcept
+    {
+      return node_->value.second;
+    }
+
+  private:
+    RBTreeNodeHandle(Node* node, const NodeAllocator& alloc):
+      node_(node),
+      alloc_(alloc)
+    {}
+    Node* release() noexcept
+    {
+      Node* node = node_;
+      node_ = nullptr;
+      alloc_.reset();
+      return node;
+    }
+
+    Node* node_;
+    std::optional< NodeAllocator > alloc_;
+  };
+}
+#endif
@@ -0,0 +1,53 @@
+#ifndef RBTREE_OPTIONS_HPP
+#define RBTREE_OPTIONS_HPP
+
+#include <cstddef>
+#include "RBTreeAugment.hpp"
+
+namespace demidenko
+{
+  // Compile-time switches of RBTree. Derive from DefaultOptions and hide the members to change.
+  struct DefaultOptions
+  {
+    // Keeps subtree sizes in the nodes, enabling nth and rank in O(log n).
+    static constexpr bool orderStatistic = false;
+    // Packs the color into the parent pointer, saving a word per node for most key and value types.
+    static constexpr bool compactNodes = false;
+    // Counts comparisons, rotations, fixup steps, allocations and the deepest descent, read through stats().
+    static constexpr bool collectStats = false;
+    // Starts each lookup from the node the previous one found, climbing only as far up as the key needs:
+    // O(log d) for a key d elements away. Lookups then write to the tree, so even they must not run concurrently.
+    static constexpr bool fingerSearch = false;
+    // Makes erase() only mark the node, postponing the rotations of the real erasure. Tombstones are purged
+    // purgeStep nodes of an in-order sweep per erasure, and all at once by an O(n) rebuild when they outnumber
+    // the live elements. A sweep of 2 or more nodes per erasure keeps them from piling up that far.
+    // Incompatible with orderStatistic, whose sizes would count the tombstones.
+    static constexpr bool tombstones = false;
+    static constexpr std::size_t purgeStep = 0;
+    // Monoid of RBTreeAugment.hpp aggregated over every subtree, enabling rangeAggregate and findFirstWhere
+    // in O(log n). Updated along the changed paths only. Writes to mapped values in place need updateAggregate.
+    using Augment = NoAugment;
+  };
+  struct OrderStatisticOptions: DefaultOptions
+  {
+    static constexpr bool orderStatistic = true;
+  };
+  struct CompactOptions: DefaultOptions
+  {
+    static constexpr bool compactNodes = true;
+  };
+  struct StatsOptions: DefaultOptions
+  {
+    static constexpr bool collectStats = true;
+  };
+  struct FingerOptions: DefaultOptions
+  {
+    static constexpr bool fingerSearch = true;
+  };
+  struct TombstoneOptions: DefaultOptions
+  {
+    static constexpr bool tombstones = true;
+    static constexpr std::size_t purgeStep = 4;
+  };
+}
+#endif
@@ -0,0 +1,94 @@
+#ifndef RBTREE_PARALLEL_HPP
+#define RBTREE_PARALLEL_HPP
+
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <system_error>
+#include <thread>
+#include <utility>
+
+namespace demidenko
+{
+  // How much parallelism an operation may use. Subtrees smaller than grain are handled serially.
+  struct ParallelPolicy
+  {
+    unsigned nThreads = std::thread::hardware_concurrency();
+    std::size_t grain = 1 << 14;
+  };
+
+  namespace detail
+  {
+    // Combines the results of reductions made only for their side effects.
+    struct KeepFirst
+    {
+      template < class U >
+      U operator()(U first, const U&) const
+      {
+        return first;
+      }
+    };
+    struct ForkJoinResult
+    {
+      std::exception_ptr first;
+      std::exception_ptr second;
+      void rethrow() const
+      {
+        if (first)
+        {
+          std::rethrow_exception(first);
+        }
+        if (second)
+        {
+          std::rethrow_exception(second);
+        }
+      }
+    };
+    // Runs first on a new thread and second on the calling one.
+    // Both are finished on return, whatever they have thrown.
+    template < class First, class Second >
+    ForkJoinResult forkJoin(First first, Second second)
+    {
+      ForkJoinResult result;
+      std::future< void > forked;
+      try
+      {
+        forked = std::async(std::launch::async, [&first] {
+          first();
+        });
+      }
+      catch (const std::system_error&)
+      {
+        try
+        {
+          first();
+        }
+        catch (...)
+        {
+          result.first = std::current_exception();
+        }
+      }
+      try
+      {
+        second();
+      }
+      catch (...)
+      {
+        result.second = std::current_exception();
+      }
+      if (forked.valid())
+      {
+        try
+        {
+          forked.get();
+        }
+        catch (...)
+        {
+          result.first = std::current_exception();
+        }
+      }
+      return result;
+    }
+  }
+}
+#endif
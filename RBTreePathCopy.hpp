@@ -0,0 +1,440 @@
+#ifndef RBTREE_PATH_COPY_HPP
+#define RBTREE_PATH_COPY_HPP
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "RBTreeNode.hpp"
+#include "RBTreeTraits.hpp"
+
+namespace demidenko
+{
+  namespace detail
+  {
+    template < bool COUNTED >
+    struct RefCount
+    {};
+    // Number of trees and nodes pointing to the node. Atomic, so that versions may be dropped on any thread.
+    template <>
+    struct RefCount< true >
+    {
+      std::atomic< std::size_t > refs{ 1 };
+    };
+    // Node of a tree whose published nodes are never changed: an update copies the nodes it passes through.
+    template < class K, class T, bool COUNTED >
+    struct PathNode: RefCount< COUNTED >
+    {
+      using value_type = std::pair< const K, T >;
+      template < class... Args >
+      PathNode(std::uint64_t version, Args&&... args):
+        value(std::forward< Args >(args)...),
+        version(version)
+      {}
+      value_type value;
+      PathNode* left = nullptr;
+      PathNode* right = nullptr;
+      // The update that made the node, the only one allowed to change it in place.
+      std::uint64_t version;
+      Color color = Color::Red;
+      PathNode*& child(bool isLeft) noexcept
+      {
+        return isLeft ? left : right;
+      }
+    };
+  }
+
+  template < class, class, class >
+  class PathCopyCore;
+
+  // Forward iterator keeping the pending ancestors on a stack, as there are no parent pointers to follow.
+  template < class Node >
+  class PathCopyIterator
+  {
+    template < class, class, class >
+    friend class PathCopyCore;
+
+  public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = const typename Node::value_type;
+    using reference = value_type&;
+    using pointer = value_type*;
+    using iterator_category = std::forward_iterator_tag;
+
+    PathCopyIterator():
+      top_(0)
+    {}
+    PathCopyIterator(const PathCopyIterator&) = default;
+    ~PathCopyIterator() = default;
+    PathCopyIterator< Node >& operator=(const PathCopyIterator< Node >&) = default;
+    PathCopyIterator< Node >& operator++()
+    {
+      pushSpine(stack_[--top_]->right);
+      return *this;
+    }
+    PathCopyIterator< Node > operator++(int)
+    {
+      PathCopyIterator< Node > temp(*this);
+      ++*this;
+      return temp;
+    }
+
+    value_type& operator*() const
+    {
+      return stack_[top_ - 1]->value;
+    }
+    value_type* operator->() const
+    {
+      return &stack_[top_ - 1]->value;
+    }
+
+    bool operator==(const PathCopyIterator< Node >& other) const
+    {
+      return top_ == other.top_ && (top_ == 0 || stack_[top_ - 1] == other.stack_[top_ - 1]);
+    }
+    bool operator!=(const PathCopyIterator< Node >& other) const
+    {
+      return !(*this == other);
+    }
+
+  private:
+    static constexpr std::size_t MAX_HEIGHT = 2 * std::numeric_limits< std::size_t >::digits;
+    void pushSpine(const Node* current)
+    {
+      for (; current; current = current->left)
+      {
+        stack_[top_++] = current;
+      }
+    }
+    const Node* stack_[MAX_HEIGHT];
+    std::size_t top_;
+  };
+
+  // Split and join of red-black trees that never change a node made by an earlier update.
+  // An update builds its tree out of fresh nodes and the untouched subtrees of the old one. It keeps a list of
+  // the old nodes it has replaced, for the owner to reclaim once the new root is published.
+  template < class Node, class Compare, class Allocator >
+  class PathCopyCore
+  {
+  protected:
+    using K = std::remove_const_t< typename Node::value_type::first_type >;
+    using Color = detail::Color;
+    using const_iterator = PathCopyIterator< Node >;
+    using NodeAllocator = typename std::allocator_traits< Allocator >::template rebind_alloc< Node >;
+    using NodeTraits = std::allocator_traits< NodeAllocator >;
+    static constexpr bool IS_THREE_WAY = detail::IsThreeWay< Compare, K >::value;
+
+    // A subtree and its black height: the number of black nodes on a way down to a leaf. The root may be red.
+    struct Subtree
+    {
+      Node* root;
+      int height;
+    };
+    struct SplitResult
+    {
+      Subtree less;
+      Node* equal;
+      Subtree greater;
+    };
+
+    PathCopyCore(Compare compare, const Allocator& alloc, std::uint64_t version = 0):
+      compare_(compare),
+      alloc_(alloc),
+      version_(version)
+    {}
+
+    // Runs build under a new version and returns the root it makes, black.
+    // On failure the fresh nodes are freed and the old tree is left as it was.
+    template < class Build >
+    Node* buildUpdate(Build&& build)
+    {
+      ++version_;
+      try
+      {
+        return blackRoot(build());
+      }
+      catch (...)
+      {
+        rollbackUpdate();
+        throw;
+      }
+    }
+    void rollbackUpdate() noexcept
+    {
+      for (Node* node : created_)
+      {
+        destroyNode(node);
+      }
+      created_.clear();
+      replaced_.clear();
+    }
+    bool isFresh(const Node* node) const noexcept
+    {
+      return node->version == version_;
+    }
+    Node* writable(Node* node)
+    {
+      if (isFresh(node))
+      {
+        return node;
+      }
+      Node* copy = createNode(node->value);
+      copy->left = node->left;
+      copy->right = node->right;
+      copy->color = node->color;
+      dropNode(node);
+      return copy;
+    }
+    // The node is left out of the new tree, its subtrees being taken over by the caller.
+    void dropNode(Node* node)
+    {
+      replaced_.push_back(node);
+    }
+    template < class... Args >
+    Node* createNode(Args&&... args)
+    {
+      created_.reserve(created_.size() + 1);
+      Node* newNode = NodeTraits::allocate(alloc_, 1);
+      try
+      {
+        NodeTraits::construct(alloc_, newNode, version_, std::forward< Args >(args)...);
+      }
+      catch (...)
+      {
+        NodeTraits::deallocate(alloc_, newNode, 1);
+        throw;
+      }
+      created_.push_back(newNode);
+      return newNode;
+    }
+    void destroyNode(Node* target) noexcept
+    {
+      NodeTraits::destroy(alloc_, target);
+      NodeTraits::deallocate(alloc_, target, 1);
+    }
+    Subtree wholeTree(Node* root) const noexcept
+    {
+      int height = 0;
+      for (const Node* current = root; current; current = current->left)
+      {
+        height += current->color == Color::Black;
+      }
+      return { root, height };
+    }
+    // The root of a published tree is black.
+    Node* blackRoot(Node* root)
+    {
+      if (colorOf(root) == Color::Red)
+      {
+        root = writable(root);
+        root->color = Color::Black;
+      }
+      return root;
+    }
+    // Links left < pivot < right, copying only the spine of the higher tree down to the height of the lower one.
+    Subtree joinNodes(Subtree left, Node* pivot, Subtree right)
+    {
+      assert(isFresh(pivot));
+      if (left.height != right.height)
+      {
+        Subtree& lower = left.height < right.height ? left : right;
+        if (colorOf(lower.root) == Color::Red)
+        {
+          lower.root = writable(lower.root);
+          lower.root->color = Color::Black;
+          ++lower.height;
+        }
+      }
+      if (left.height == right.height)
+      {
+        pivot->left = left.root;
+        pivot->right = right.root;
+        bool isRed = colorOf(left.root) == Color::Black && colorOf(right.root) == Color::Black;
+        pivot->color = isRed ? Color::Red : Color::Black;
+        return { pivot, left.height + !isRed };
+      }
+      bool isLeftSpine = left.height < right.height;
+      Subtree higher = isLeftSpine ? right : left;
+      Node* root = joinSpine(higher.root, higher.height, pivot, isLeftSpine ? left : right, isLeftSpine);
+      if (root->color == Color::Red && colorOf(root->child(isLeftSpine)) == Color::Red)
+      {
+        root->color = Color::Black;
+        return { root, higher.height + 1 };
+      }
+      return { root, higher.height };
+    }
+    // Descends the inner spine to the first black node as high as the lower tree and hangs pivot there, red.
+    // On the way back a red-red pair is rotated away one level above it, like the insert fixup would.
+    Node* joinSpine(Node* tall, int height, Node* pivot, Subtree lower, bool isLeftSpine)
+    {
+      if (colorOf(tall) == Color::Black && height == lower.height)
+      {
+        pivot->child(isLeftSpine) = lower.root;
+        pivot->child(!isLeftSpine) = tall;
+        pivot->color = Color::Red;
+        return pivot;
+      }
+      Node* current = writable(tall);
+      int childHeight = height - (current->color == Color::Black);
+      Node* inner = joinSpine(current->child(isLeftSpine), childHeight, pivot, lower, isLeftSpine);
+      current->child(isLeftSpine) = inner;
+      if (current->color == Color::Black && inner->color == Color::Red
+          && colorOf(inner->child(isLeftSpine)) == Color::Red)
+      {
+        assert(isFresh(inner->child(isLeftSpine)));
+        inner->child(isLeftSpine)->color = Color::Black;
+        current->child(isLeftSpine) = inner->child(!isLeftSpine);
+        inner->child(!isLeftSpine) = current;
+        return inner;
+      }
+      return current;
+    }
+    Subtree joinSubtrees(Subtree left, Subtree right)
+    {
+      if (!left.root || !right.root)
+      {
+        return left.root ? left : right;
+      }
+      Node* first = nullptr;
+      Subtree rest = detachFirst(right, first);
+      return joinNodes(left, writable(first), rest);
+    }
+    Subtree detachFirst(Subtree tree, Node*& first)
+    {
+      Node* current = tree.root;
+      int childHeight = tree.height - (current->color == Color::Black);
+      Subtree right{ current->right, childHeight };
+      if (!current->left)
+      {
+        first = current;
+        return right;
+      }
+      Subtree rest = detachFirst({ current->left, childHeight }, first);
+      return joinNodes(rest, writable(current), right);
+    }
+    // The equal node, if any, is handed back as it was: the caller either drops it or reuses it.
+    template < class Key >
+    SplitResult splitNodes(Subtree tree, const Key& key)
+    {
+      if (!tree.root)
+      {
+        return { tree, nullptr, tree };
+      }
+      Node* current = tree.root;
+      int childHeight = tree.height - (current->color == Color::Black);
+      Subtree left{ current->left, childHeight };
+      Subtree right{ current->right, childHeight };
+      if (isLess(current->value.first, key))
+      {
+        SplitResult parts = splitNodes(right, key);
+        parts.less = joinNodes(left, writable(current), parts.less);
+        return parts;
+      }
+      if (isLess(key, current->value.first))
+      {
+        SplitResult parts = splitNodes(left, key);
+        parts.greater = joinNodes(parts.greater, writable(current), right);
+        return parts;
+      }
+      return { left, current, right };
+    }
+
+    template < class Key >
+    const Node* findEqualNode(const Node* root, const Key& key) const
+    {
+      const Node* candidate = nullptr;
+      while (root)
+      {
+        if (isLess(root->value.first, key))
+        {
+          root = root->right;
+        }
+        else
+        {
+          candidate = root;
+          root = root->left;
+        }
+      }
+      return candidate && !isLess(key, candidate->value.first) ? candidate : nullptr;
+    }
+    const_iterator beginAt(const Node* root) const
+    {
+      const_iterator result;
+      result.pushSpine(root);
+      return result;
+    }
+    template < bool UPPER, class Key >
+    const_iterator boundAt(const Node* root, const Key& key) const
+    {
+      const_iterator result;
+      while (root)
+      {
+        if (UPPER ? !isLess(key, root->value.first) : isLess(root->value.first, key))
+        {
+          root = root->right;
+        }
+        else
+        {
+          result.stack_[result.top_++] = root;
+          root = root->left;
+        }
+      }
+      return result;
+    }
+    template < class Key >
+    const_iterator findAt(const Node* root, const Key& key) const
+    {
+      const_iterator result = boundAt< false >(root, key);
+      return result != const_iterator() && !isLess(key, result->first) ? result : const_iterator();
+    }
+    // Black height plus one of a valid subtree, 0 if it has a red-red pair or unequal black heights.
+    int isWeakRBTree(const Node* target) const
+    {
+      if (!target)
+      {
+        return 1;
+      }
+      bool isRed = target->color == Color::Red;
+      if (isRed && (colorOf(target->left) == Color::Red || colorOf(target->right) == Color::Red))
+      {
+        return 0;
+      }
+      int result = isWeakRBTree(target->right);
+      if ((result == 0) || (result != isWeakRBTree(target->left)))
+      {
+        return 0;
+      }
+      return result + !isRed;
+    }
+    Color colorOf(const Node* target) const noexcept
+    {
+      return target ? target->color : Color::Black;
+    }
+    template < class First, class Second >
+    bool isLess(const First& first, const Second& second) const
+    {
+      if constexpr (IS_THREE_WAY)
+      {
+        return compare_(first, second) < 0;
+      }
+      else
+      {
+        return compare_(first, second);
+      }
+    }
+
+    Compare compare_;
+    NodeAllocator alloc_;
+    std::uint64_t version_;
+    // Bookkeeping of the running update, empty between updates.
+    std::vector< Node* > created_;
+    std::vector< Node* > replaced_;
+  };
+}
+#endif
@@ -0,0 +1,265 @@
+#ifndef RBTREE_POOL_HPP
+#define RBTREE_POOL_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+namespace demidenko
+{
+  // Memory held by the arena of a PoolAllocator.
+  struct PoolUsage
+  {
+    // Size of a block, 0 when blocks of the allocator's type come from operator new instead.
+    std::size_t blockBytes;
+    std::size_t liveBlocks;
+    // Bytes of every slab, whether carved into blocks or not.
+    std::size_t slabBytes;
+    // Allocations served by operator new, outside of the slabs.
+    std::size_t fallbacks;
+  };
+
+  namespace detail
+  {
+    // Pool of equally sized blocks carved out of large slabs.
+    // Block size and alignment are fixed by the first allocation.
+    class NodeArena
+    {
+    public:
+      explicit NodeArena(std::size_t slabBlocks):
+        free_(nullptr),
+        cursor_(nullptr),
+        slabEnd_(nullptr),
+        blockSize_(0),
+        blockAlign_(0),
+        slabBlocks_(slabBlocks ? slabBlocks : 1),
+        reserved_(0),
+        fallbacks_(0),
+        liveBlocks_(0),
+        slabBytes_(0)
+      {}
+      NodeArena(const NodeArena&) = delete;
+      NodeArena& operator=(const NodeArena&) = delete;
+      ~NodeArena()
+      {
+        dropSlabs();
+      }
+      bool fits(std::size_t size, std::size_t align)
+      {
+        if (blockSize_ == 0)
+        {
+          blockAlign_ = align < alignof(FreeBlock) ? alignof(FreeBlock) : align;
+          blockSize_ = roundUp(size < sizeof(FreeBlock) ? sizeof(FreeBlock) : size, blockAlign_);
+        }
+        return size <= blockSize_ && align <= blockAlign_ && blockAlign_ <= alignof(std::max_align_t);
+      }
+      void* allocate()
+      {
+        if (free_ && reserved_ == 0)
+        {
+          FreeBlock* block = free_;
+          free_ = block->next;
+          ++liveBlocks_;
+          return block;
+        }
+        if (cursor_ == slabEnd_)
+        {
+          addSlab(slabBlocks_);
+        }
+        void* block = cursor_;
+        cursor_ += blockSize_;
+        reserved_ -= reserved_ != 0;
+        ++liveBlocks_;
+        return block;
+      }
+      void deallocate(void* block) noexcept
+      {
+        --liveBlocks_;
+        pushFree(block);
+      }
+      void noteFallback(bool isAllocated) noexcept
+      {
+        isAllocated ? ++fallbacks_ : --fallbacks_;
+      }
+      // Makes the next n allocations take consecutive blocks of a single slab, ahead of the free list.
+      void reserve(std::size_t n)
+      {
+        if (blockSize_ == 0)
+        {
+          return;
+        }
+        if (static_cast< std::size_t >(slabEnd_ - cursor_) / blockSize_ < n)
+        {
+          // The remainder of the old slab waits on the free list until the reservation is used up.
+          while (cursor_ != slabEnd_)
+          {
+            pushFree(cursor_);
+            cursor_ += blockSize_;
+          }
+          addSlab(n > slabBlocks_ ? n : slabBlocks_);
+        }
+        reserved_ = n;
+      }
+      // Frees every block at once. Impossible while blocks live outside of the slabs.
+      bool release() noexcept
+      {
+        if (fallbacks_ != 0)
+        {
+          return false;
+        }
+        dropSlabs();
+        slabs_.clear();
+        liveBlocks_ = 0;
+        slabBytes_ = 0;
+        free_ = nullptr;
+        cursor_ = nullptr;
+        slabEnd_ = nullptr;
+        reserved_ = 0;
+        return true;
+      }
+      PoolUsage usage() const noexcept
+      {
+        return { blockSize_, liveBlocks_, slabBytes_, fallbacks_ };
+      }
+
+    private:
+      struct FreeBlock
+      {
+        FreeBlock* next;
+      };
+      static std::size_t roundUp(std::size_t size, std::size_t align)
+      {
+        return (size + align - 1) / align * align;
+      }
+      void pushFree(void* block) noexcept
+      {
+        free_ = ::new (block) FreeBlock{ free_ };
+      }
+      void addSlab(std::size_t nBlocks)
+      {
+        slabs_.reserve(slabs_.size() + 1);
+        char* slab = static_cast< char* >(::operator new(nBlocks * blockSize_));
+        slabs_.push_back(slab);
+        slabBytes_ += nBlocks * blockSize_;
+        cursor_ = slab;
+        slabEnd_ = slab + nBlocks * blockSize_;
+      }
+      void dropSlabs() noexcept
+      {
+        for (char* slab : slabs_)
+        {
+          ::operator delete(slab);
+        }
+      }
+
+      std::vector< char* > slabs_;
+      FreeBlock* free_;
+      char* cursor_;
+      char* slabEnd_;
+      std::size_t blockSize_;
+      std::size_t blockAlign_;
+      std::size_t slabBlocks_;
+      std::size_t reserved_;
+      std::size_t fallbacks_;
+      std::size_t liveBlocks_;
+      std::size_t slabBytes_;
+    };
+  }
+
+  // Stateful allocator serving single objects from a shared slab arena.
+  // Copies share the arena, copies of containers get a fresh one.
+  template < class T >
+  class PoolAllocator
+  {
+    template < class U >
+    friend class PoolAllocator;
+
+  public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::false_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    static constexpr std::size_t DEFAULT_SLAB_BLOCKS = 4096;
+
+    explicit PoolAllocator(std::size_t slabBlocks = DEFAULT_SLAB_BLOCKS):
+      arena_(std::make_shared< detail::NodeArena >(slabBlocks)),
+      slabBlocks_(slabBlocks)
+    {}
+    // No move operations: a moved-from allocator must stay usable.
+    PoolAllocator(const PoolAllocator&) noexcept = default;
+    PoolAllocator& operator=(const PoolAllocator&) noexcept = default;
+    template < class U >
+    PoolAllocator(const PoolAllocator< U >& other) noexcept:
+      arena_(other.arena_),
+      slabBlocks_(other.slabBlocks_)
+    {}
+
+    T* allocate(std::size_t n)
+    {
+      if (n == 1 && arena_->fits(sizeof(T), alignof(T)))
+      {
+        return static_cast< T* >(arena_->allocate());
+      }
+      T* result = static_cast< T* >(::operator new(n * sizeof(T)));
+      arena_->noteFallback(true);
+      return result;
+    }
+    void deallocate(T* target, std::size_t n) noexcept
+    {
+      if (n == 1 && arena_->fits(sizeof(T), alignof(T)))
+      {
+        arena_->deallocate(target);
+        return;
+      }
+      ::operator delete(target);
+      arena_->noteFallback(false);
+    }
+    void reserve(std::size_t n)
+    {
+      if (arena_->fits(sizeof(T), alignof(T)))
+      {
+        arena_->reserve(n);
+      }
+    }
+    // Drops the whole arena without visiting the blocks.
+    // Succeeds only when no other allocator shares the arena.
+    bool release() noexcept
+    {
+      return arena_.use_count() == 1 && arena_->release();
+    }
+    // Usage of the whole arena, shared with every copy and rebound copy of this allocator.
+    PoolUsage memoryUsage() const
+    {
+      PoolUsage usage = arena_->usage();
+      if (!arena_->fits(sizeof(T), alignof(T)))
+      {
+        usage.blockBytes = 0;
+      }
+      return usage;
+    }
+    PoolAllocator select_on_container_copy_construction() const
+    {
+      return PoolAllocator(slabBlocks_);
+    }
+
+    template < class U >
+    bool operator==(const PoolAllocator< U >& other) const noexcept
+    {
+      return arena_ == other.arena_;
+    }
+    template < class U >
+    bool operator!=(const PoolAllocator< U >& other) const noexcept
+    {
+      return arena_ != other.arena_;
+    }
+
+  private:
+    std::shared_ptr< detail::NodeArena > arena_;
+    std::size_t slabBlocks_;
+  };
+}
+#endif
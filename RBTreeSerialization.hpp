@@ -0,0 +1,239 @@
+#ifndef RBTREE_SERIALIZATION_HPP
+#define RBTREE_SERIALIZATION_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <istream>
+#include <limits>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace demidenko
+{
+  namespace detail
+  {
+    // On-disk format of a sorted map of trivially copyable keys and values, in native byte order:
+    // this header, the strictly ascending keys from offset sizeof(SerializedHeader), then the values in the same
+    // order from valuesOffset. Keeping keys apart packs more of them per page for the searches of a mapped view.
+    struct SerializedHeader
+    {
+      char magic[4];
+      std::uint32_t byteOrder;
+      std::uint32_t keyBytes;
+      std::uint32_t valueBytes;
+      std::uint64_t count;
+      std::uint64_t valuesOffset;
+    };
+    constexpr char SERIALIZED_MAGIC[4] = { 'D', 'R', 'B', 'T' };
+    // Reads back as another number on a machine of the other byte order.
+    constexpr std::uint32_t SERIALIZED_BYTE_ORDER = 0x01020304;
+
+    template < class K, class T >
+    constexpr void checkSerializable() noexcept
+    {
+      static_assert(std::is_trivially_copyable< K >::value && std::is_trivially_copyable< T >::value,
+        "serialization needs trivially copyable keys and values");
+      static_assert(alignof(K) <= sizeof(SerializedHeader) && alignof(T) <= sizeof(SerializedHeader),
+        "serialization needs keys and values aligned to the header size at most");
+    }
+    template < class K, class T >
+    std::uint64_t serializedValuesOffset(std::uint64_t count) noexcept
+    {
+      std::uint64_t keysEnd = sizeof(SerializedHeader) + count * sizeof(K);
+      return (keysEnd + alignof(T) - 1) / alignof(T) * alignof(T);
+    }
+    // Checks the header against K and T and returns the bytes the whole map takes with it.
+    template < class K, class T >
+    std::uint64_t checkSerializedHeader(const SerializedHeader& header)
+    {
+      std::uint64_t maxCount = (std::numeric_limits< std::uint64_t >::max() - 2 * sizeof(SerializedHeader))
+        / (sizeof(K) + sizeof(T));
+      if (std::memcmp(header.magic, SERIALIZED_MAGIC, sizeof(SERIALIZED_MAGIC)) != 0
+          || header.byteOrder != SERIALIZED_BYTE_ORDER || header.keyBytes != sizeof(K) || header.valueBytes != sizeof(T)
+          || header.count > maxCount || header.valuesOffset != serializedValuesOffset< K, T >(header.count))
+      {
+        throw std::invalid_argument("Stream holds no serialized tree of these types\n");
+      }
+      return header.valuesOffset + header.count * sizeof(T);
+    }
+    template < class U >
+    U loadObject(const char* bytes) noexcept
+    {
+      alignas(U) unsigned char storage[sizeof(U)];
+      std::memcpy(storage, bytes, sizeof(U));
+      return *std::launder(reinterpret_cast< U* >(storage));
+    }
+
+    // Writes the n pairs of the ascending range [first, last), which is walked twice.
+    template < class K, class T, class ForwardIt >
+    void writeSerialized(std::ostream& out, ForwardIt first, ForwardIt last, std::size_t n)
+    {
+      checkSerializable< K, T >();
+      SerializedHeader header{};
+      std::memcpy(header.magic, SERIALIZED_MAGIC, sizeof(SERIALIZED_MAGIC));
+      header.byteOrder = SERIALIZED_BYTE_ORDER;
+      header.keyBytes = sizeof(K);
+      header.valueBytes = sizeof(T);
+      header.count = n;
+      header.valuesOffset = serializedValuesOffset< K, T >(n);
+      out.write(reinterpret_cast< const char* >(&header), sizeof(header));
+      char buffer[4096];
+      std::size_t used = 0;
+      auto put = [&](const void* bytes, std::size_t size) {
+        if (used + size > sizeof(buffer))
+        {
+          out.write(buffer, static_cast< std::streamsize >(used));
+          used = 0;
+        }
+        if (size > sizeof(buffer))
+        {
+          out.write(static_cast< const char* >(bytes), static_cast< std::streamsize >(size));
+          return;
+        }
+        std::memcpy(buffer + used, bytes, size);
+        used += size;
+      };
+      for (ForwardIt current = first; current != last; ++current)
+      {
+        put(std::addressof(current->first), sizeof(K));
+      }
+      const char padding[sizeof(SerializedHeader)] = {};
+      put(padding, static_cast< std::size_t >(header.valuesOffset - sizeof(header) - n * sizeof(K)));
+      for (; first != last; ++first)
+      {
+        put(std::addressof(first->second), sizeof(T));
+      }
+      out.write(buffer, static_cast< std::streamsize >(used));
+      if (!out)
+      {
+        throw std::runtime_error("Could not write the tree\n");
+      }
+    }
+  }
+
+  // Walks the keys and values of a serialized map, yielding copies of its pairs.
+  template < class K, class T >
+  class SerializedIterator
+  {
+  public:
+    using difference_type = std::ptrdiff_t;
+    using value_type = std::pair< const K, T >;
+    using reference = value_type;
+    // Holds the pair it points to.
+    struct pointer
+    {
+      const value_type* operator->() const noexcept
+      {
+        return &value;
+      }
+      value_type value;
+    };
+    using iterator_category = std::input_iterator_tag;
+
+    SerializedIterator() noexcept:
+      keys_(nullptr),
+      values_(nullptr),
+      index_(0)
+    {}
+    SerializedIterator(const char* keys, const char* values, std::size_t index) noexcept:
+      keys_(keys),
+      values_(values),
+      index_(index)
+    {}
+    value_type operator*() const noexcept
+    {
+      return value_type(key(), value());
+    }
+    pointer operator->() const noexcept
+    {
+      return pointer{ **this };
+    }
+    K key() const noexcept
+    {
+      return detail::loadObject< K >(keys_ + index_ * sizeof(K));
+    }
+    T value() const noexcept
+    {
+      return detail::loadObject< T >(values_ + index_ * sizeof(T));
+    }
+    std::size_t index() const noexcept
+    {
+      return index_;
+    }
+    SerializedIterator< K, T >& operator++() noexcept
+    {
+      ++index_;
+      return *this;
+    }
+    SerializedIterator< K, T > operator++(int) noexcept
+    {
+      SerializedIterator< K, T > temp(*this);
+      ++index_;
+      return temp;
+    }
+    bool operator==(const SerializedIterator< K, T >& other) const noexcept
+    {
+      return index_ == other.index_ && keys_ == other.keys_;
+    }
+    bool operator!=(const SerializedIterator< K, T >& other) const noexcept
+    {
+      return !(*this == other);
+    }
+
+  private:
+    const char* keys_;
+    const char* values_;
+    std::size_t index_;
+  };
+
+  namespace detail
+  {
+    // The serialized map of the stream, header checked, as one block of bytes.
+    template < class K, class T >
+    struct SerializedBlock
+    {
+      SerializedIterator< K, T > begin() const noexcept
+      {
+        return SerializedIterator< K, T >(bytes.data() + sizeof(SerializedHeader), bytes.data() + valuesOffset, 0);
+      }
+      SerializedIterator< K, T > end() const noexcept
+      {
+        return SerializedIterator< K, T >(bytes.data() + sizeof(SerializedHeader), bytes.data() + valuesOffset, count);
+      }
+      std::vector< char > bytes;
+      std::size_t count;
+      std::size_t valuesOffset;
+    };
+    template < class K, class T >
+    SerializedBlock< K, T > readSerialized(std::istream& in)
+    {
+      checkSerializable< K, T >();
+      SerializedHeader header{};
+      if (!in.read(reinterpret_cast< char* >(&header), sizeof(header)))
+      {
+        throw std::invalid_argument("Stream holds no serialized tree of these types\n");
+      }
+      std::uint64_t total = checkSerializedHeader< K, T >(header);
+      if (total > std::numeric_limits< std::size_t >::max())
+      {
+        throw std::invalid_argument("Stream holds no serialized tree of these types\n");
+      }
+      SerializedBlock< K, T > block{ std::vector< char >(static_cast< std::size_t >(total)),
+        static_cast< std::size_t >(header.count),
+        static_cast< std::size_t >(header.valuesOffset) };
+      std::memcpy(block.bytes.data(), &header, sizeof(header));
+      if (!in.read(block.bytes.data() + sizeof(header), static_cast< std::streamsize >(total - sizeof(header))))
+      {
+        throw std::invalid_argument("Stream holds no serialized tree of these types\n");
+      }
+      return block;
+    }
+  }
+}
+#endif
@@ -0,0 +1,298 @@
+#ifndef RBTREE_SIMD_HPP
+#define RBTREE_SIMD_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <type_traits>
+#if defined(__SSE2__) || defined(__AVX2__) || defined(_M_X64)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace demidenko
+{
+  namespace detail
+  {
+    inline unsigned countBits(unsigned mask) noexcept
+    {
+#if defined(__GNUC__)
+      return static_cast< unsigned >(__builtin_popcount(mask));
+#else
+      unsigned result = 0;
+      for (; mask; mask &= mask - 1)
+      {
+        ++result;
+      }
+      return result;
+#endif
+    }
+
+    inline unsigned countTrailingZeros(std::size_t value) noexcept
+    {
+#if defined(__GNUC__)
+      return value ? static_cast< unsigned >(__builtin_ctzll(value)) : 64;
+#else
+      unsigned result = 0;
+      for (; result < 64 && !(value & 1); value >>= 1)
+      {
+        ++result;
+      }
+      return result;
+#endif
+    }
+    // Only a hint: the address may lie outside of any object.
+    inline void prefetch(std::uintptr_t address) noexcept
+    {
+#if defined(__GNUC__)
+      __builtin_prefetch(reinterpret_cast< const void* >(address));
+#elif defined(__SSE2__) || defined(_M_X64)
+      _mm_prefetch(reinterpret_cast< const char* >(address), _MM_HINT_T0);
+#else
+      static_cast< void >(address);
+#endif
+    }
+
+    template < class K, std::size_t SIZE, bool SIGNED >
+    using IntegerKey = std::enable_if_t< std::is_integral< K >::value && !std::is_same< K, bool >::value
+                                         && sizeof(K) == SIZE && std::is_signed< K >::value == SIGNED >;
+
+    // COUNT keys compared at once: notGreater(keys, key) is the number of keys[0, COUNT) that are not greater than key.
+    // COUNT is zero for types the target has no vector comparison for.
+    template < class K, class = void >
+    struct SimdLanes
+    {
+      static constexpr std::size_t COUNT = 0;
+    };
+#if defined(__AVX2__)
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 4, true > >
+    {
+      static constexpr std::size_t COUNT = 8;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        __m256i values = _mm256_loadu_si256(reinterpret_cast< const __m256i* >(keys));
+        __m256i greater = _mm256_cmpgt_epi32(values, _mm256_set1_epi32(static_cast< int >(key)));
+        return COUNT - countBits(static_cast< unsigned >(_mm256_movemask_ps(_mm256_castsi256_ps(greater))));
+      }
+    };
+    // Unsigned lanes are compared as signed ones after flipping the sign bit.
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 4, false > >
+    {
+      static constexpr std::size_t COUNT = 8;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        __m256i bias = _mm256_set1_epi32(static_cast< int >(0x80000000u));
+        __m256i values = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast< const __m256i* >(keys)), bias);
+        __m256i needle = _mm256_xor_si256(_mm256_set1_epi32(static_cast< int >(key)), bias);
+        __m256i greater = _mm256_cmpgt_epi32(values, needle);
+        return COUNT - countBits(static_cast< unsigned >(_mm256_movemask_ps(_mm256_castsi256_ps(greater))));
+      }
+    };
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 8, true > >
+    {
+      static constexpr std::size_t COUNT = 4;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        __m256i values = _mm256_loadu_si256(reinterpret_cast< const __m256i* >(keys));
+        __m256i greater = _mm256_cmpgt_epi64(values, _mm256_set1_epi64x(static_cast< long long >(key)));
+        return COUNT - countBits(static_cast< unsigned >(_mm256_movemask_pd(_mm256_castsi256_pd(greater))));
+      }
+    };
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 8, false > >
+    {
+      static constexpr std::size_t COUNT = 4;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        __m256i bias = _mm256_set1_epi64x(static_cast< long long >(0x8000000000000000ull));
+        __m256i values = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast< const __m256i* >(keys)), bias);
+        __m256i needle = _mm256_xor_si256(_mm256_set1_epi64x(static_cast< long long >(key)), bias);
+        __m256i greater = _mm256_cmpgt_epi64(values, needle);
+        return COUNT - countBits(static_cast< unsigned >(_mm256_movemask_pd(_mm256_castsi256_pd(greater))));
+      }
+    };
+    template <>
+    struct SimdLanes< float >
+    {
+      static constexpr std::size_t COUNT = 8;
+      static unsigned notGreater(const float* keys, float key) noexcept
+      {
+        __m256 greater = _mm256_cmp_ps(_mm256_loadu_ps(keys), _mm256_set1_ps(key), _CMP_GT_OQ);
+        return COUNT - countBits(static_cast< unsigned >(_mm256_movemask_ps(greater)));
+      }
+    };
+    template <>
+    struct SimdLanes< double >
+    {
+      static constexpr std::size_t COUNT = 4;
+      static unsigned notGreater(const double* keys, double key) noexcept
+      {
+        __m256d greater = _mm256_cmp_pd(_mm256_loadu_pd(keys), _mm256_set1_pd(key), _CMP_GT_OQ);
+        return COUNT - countBits(static_cast< unsigned >(_mm256_movemask_pd(greater)));
+      }
+    };
+#elif defined(__SSE2__)
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 4, true > >
+    {
+      static constexpr std::size_t COUNT = 4;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        __m128i values = _mm_loadu_si128(reinterpret_cast< const __m128i* >(keys));
+        __m128i greater = _mm_cmpgt_epi32(values, _mm_set1_epi32(static_cast< int >(key)));
+        return COUNT - countBits(static_cast< unsigned >(_mm_movemask_ps(_mm_castsi128_ps(greater))));
+      }
+    };
+    // Unsigned lanes are compared as signed ones after flipping the sign bit.
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 4, false > >
+    {
+      static constexpr std::size_t COUNT = 4;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        __m128i bias = _mm_set1_epi32(static_cast< int >(0x80000000u));
+        __m128i values = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast< const __m128i* >(keys)), bias);
+        __m128i needle = _mm_xor_si128(_mm_set1_epi32(static_cast< int >(key)), bias);
+        __m128i greater = _mm_cmpgt_epi32(values, needle);
+        return COUNT - countBits(static_cast< unsigned >(_mm_movemask_ps(_mm_castsi128_ps(greater))));
+      }
+    };
+#if defined(__SSE4_2__)
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 8, true > >
+    {
+      static constexpr std::size_t COUNT = 2;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        __m128i values = _mm_loadu_si128(reinterpret_cast< const __m128i* >(keys));
+        __m128i greater = _mm_cmpgt_epi64(values, _mm_set1_epi64x(static_cast< long long >(key)));
+        return COUNT - countBits(static_cast< unsigned >(_mm_movemask_pd(_mm_castsi128_pd(greater))));
+      }
+    };
+#endif
+    template <>
+    struct SimdLanes< float >
+    {
+      static constexpr std::size_t COUNT = 4;
+      static unsigned notGreater(const float* keys, float key) noexcept
+      {
+        __m128 greater = _mm_cmpgt_ps(_mm_loadu_ps(keys), _mm_set1_ps(key));
+        return COUNT - countBits(static_cast< unsigned >(_mm_movemask_ps(greater)));
+      }
+    };
+    template <>
+    struct SimdLanes< double >
+    {
+      static constexpr std::size_t COUNT = 2;
+      static unsigned notGreater(const double* keys, double key) noexcept
+      {
+        __m128d greater = _mm_cmpgt_pd(_mm_loadu_pd(keys), _mm_set1_pd(key));
+        return COUNT - countBits(static_cast< unsigned >(_mm_movemask_pd(greater)));
+      }
+    };
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    // Greater lanes are all ones: shifting them down to 1 and adding across gives their number.
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 4, true > >
+    {
+      static constexpr std::size_t COUNT = 4;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        int32x4_t values = vld1q_s32(reinterpret_cast< const std::int32_t* >(keys));
+        uint32x4_t greater = vcgtq_s32(values, vdupq_n_s32(static_cast< std::int32_t >(key)));
+        return COUNT - vaddvq_u32(vshrq_n_u32(greater, 31));
+      }
+    };
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 4, false > >
+    {
+      static constexpr std::size_t COUNT = 4;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        uint32x4_t values = vld1q_u32(reinterpret_cast< const std::uint32_t* >(keys));
+        uint32x4_t greater = vcgtq_u32(values, vdupq_n_u32(static_cast< std::uint32_t >(key)));
+        return COUNT - vaddvq_u32(vshrq_n_u32(greater, 31));
+      }
+    };
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 8, true > >
+    {
+      static constexpr std::size_t COUNT = 2;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        int64x2_t values = vld1q_s64(reinterpret_cast< const std::int64_t* >(keys));
+        uint64x2_t greater = vcgtq_s64(values, vdupq_n_s64(static_cast< std::int64_t >(key)));
+        return COUNT - static_cast< unsigned >(vaddvq_u64(vshrq_n_u64(greater, 63)));
+      }
+    };
+    template < class K >
+    struct SimdLanes< K, IntegerKey< K, 8, false > >
+    {
+      static constexpr std::size_t COUNT = 2;
+      static unsigned notGreater(const K* keys, K key) noexcept
+      {
+        uint64x2_t values = vld1q_u64(reinterpret_cast< const std::uint64_t* >(keys));
+        uint64x2_t greater = vcgtq_u64(values, vdupq_n_u64(static_cast< std::uint64_t >(key)));
+        return COUNT - static_cast< unsigned >(vaddvq_u64(vshrq_n_u64(greater, 63)));
+      }
+    };
+    template <>
+    struct SimdLanes< float >
+    {
+      static constexpr std::size_t COUNT = 4;
+      static unsigned notGreater(const float* keys, float key) noexcept
+      {
+        uint32x4_t greater = vcgtq_f32(vld1q_f32(keys), vdupq_n_f32(key));
+        return COUNT - vaddvq_u32(vshrq_n_u32(greater, 31));
+      }
+    };
+    template <>
+    struct SimdLanes< double >
+    {
+      static constexpr std::size_t COUNT = 2;
+      static unsigned notGreater(const double* keys, double key) noexcept
+      {
+        uint64x2_t greater = vcgtq_f64(vld1q_f64(keys), vdupq_n_f64(key));
+        return COUNT - static_cast< unsigned >(vaddvq_u64(vshrq_n_u64(greater, 63)));
+      }
+    };
+#endif
+
+    // Vector search is only equivalent to the comparator when it is the built-in less-than on arithmetic keys.
+    template < class K, class Compare >
+    struct IsSimdSearchable:
+      std::integral_constant< bool,
+        SimdLanes< K >::COUNT != 0
+          && (std::is_same< Compare, std::less< K > >::value || std::is_same< Compare, std::less<> >::value) >
+    {};
+
+    // Number of keys in the ascending keys[0, n) that are not greater than key, that is, its upper bound.
+    // Stops at the first block holding a greater key.
+    template < class K >
+    std::size_t countNotGreater(const K* keys, std::size_t n, K key) noexcept
+    {
+      std::size_t i = 0;
+      if constexpr (SimdLanes< K >::COUNT != 0)
+      {
+        for (; i + SimdLanes< K >::COUNT <= n; i += SimdLanes< K >::COUNT)
+        {
+          unsigned count = SimdLanes< K >::notGreater(keys + i, key);
+          if (count != SimdLanes< K >::COUNT)
+          {
+            return i + count;
+          }
+        }
+      }
+      while (i < n && !(key < keys[i]))
+      {
+        ++i;
+      }
+      return i;
+    }
+  }
+}
+#endif
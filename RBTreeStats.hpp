@@ -0,0 +1,85 @@
+#ifndef RBTREE_STATS_HPP
+#define RBTREE_STATS_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace demidenko
+{
+  // What an RBTree built with Options::collectStats has done since it was made or its stats were reset.
+  struct RBTreeStats
+  {
+    // Key comparisons of every descent, bound and batch.
+    std::uint64_t comparisons = 0;
+    std::uint64_t rotations = 0;
+    // Iterations of the rebalancing loops, each recoloring or rotating one level.
+    std::uint64_t insertFixupSteps = 0;
+    std::uint64_t eraseFixupSteps = 0;
+    std::uint64_t allocations = 0;
+    std::uint64_t deallocations = 0;
+    // Levels of the deepest descent of a lookup or an insertion.
+    std::size_t maxDepth = 0;
+  };
+
+  namespace detail
+  {
+    // Counts nothing and takes no space: the calls inline to nothing.
+    template < bool ENABLED >
+    class StatsCounter
+    {
+    protected:
+      void countComparison() const noexcept
+      {}
+      void countRotation() const noexcept
+      {}
+      void countInsertFixupStep() const noexcept
+      {}
+      void countEraseFixupStep() const noexcept
+      {}
+      void countAllocation() const noexcept
+      {}
+      void countDeallocation(std::uint64_t = 1) const noexcept
+      {}
+      void countDepth(std::size_t) const noexcept
+      {}
+    };
+    // Plain counters, mutable so that lookups count too. They make even the const members of the tree unsafe
+    // to call from several threads at once.
+    template <>
+    class StatsCounter< true >
+    {
+    protected:
+      void countComparison() const noexcept
+      {
+        ++stats_.comparisons;
+      }
+      void countRotation() const noexcept
+      {
+        ++stats_.rotations;
+      }
+      void countInsertFixupStep() const noexcept
+      {
+        ++stats_.insertFixupSteps;
+      }
+      void countEraseFixupStep() const noexcept
+      {
+        ++stats_.eraseFixupSteps;
+      }
+      void countAllocation() const noexcept
+      {
+        ++stats_.allocations;
+      }
+      void countDeallocation(std::uint64_t n = 1) const noexcept
+      {
+        stats_.deallocations += n;
+      }
+      void countDepth(std::size_t depth) const noexcept
+      {
+        stats_.maxDepth = depth > stats_.maxDepth ? depth : stats_.maxDepth;
+      }
+
+      mutable RBTreeStats stats_;
+    };
+  }
+}
+#endif
@@ -0,0 +1,43 @@
+#ifndef RBTREE_TRAITS_HPP
+#define RBTREE_TRAITS_HPP
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+namespace demidenko
+{
+  namespace detail
+  {
+    template < class Alloc, class = void >
+    struct HasRelease: std::false_type
+    {};
+    template < class Alloc >
+    struct HasRelease< Alloc, std::void_t< decltype(std::declval< Alloc& >().release()) > >: std::true_type
+    {};
+    template < class Order, class = void >
+    struct IsOrdering: std::false_type
+    {};
+    template < class Order >
+    struct IsOrdering< Order,
+      std::enable_if_t< !std::is_convertible< Order, bool >::value, std::void_t< decltype(std::declval< Order >() < 0) > > >:
+      std::true_type
+    {};
+    template < class Alloc, class = void >
+    struct HasReserve: std::false_type
+    {};
+    template < class Alloc >
+    struct HasReserve< Alloc, std::void_t< decltype(std::declval< Alloc& >().reserve(std::size_t())) > >: std::true_type
+    {};
+    template < class Alloc, class = void >
+    struct HasMemoryUsage: std::false_type
+    {};
+    template < class Alloc >
+    struct HasMemoryUsage< Alloc, std::void_t< decltype(std::declval< const Alloc& >().memoryUsage()) > >: std::true_type
+    {};
+    // Comparators returning an ordering (std::compare_three_way and alike) instead of bool.
+    template < class Compare, class K >
+    using IsThreeWay = IsOrdering< std::invoke_result_t< const Compare&, const K&, const K& > >;
+  }
+}
+#endif
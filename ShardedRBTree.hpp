@@ -0,0 +1,300 @@
+#ifndef SHARDED_RBTREE_HPP
+#define SHARDED_RBTREE_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "RBTree.hpp"
+
+namespace demidenko
+{
+  namespace detail
+  {
+    // Iterates over the objects a range of pointers points to.
+    template < class Value >
+    class IndirectIterator
+    {
+    public:
+      using difference_type = std::ptrdiff_t;
+      using value_type = Value;
+      using reference = const Value&;
+      using pointer = const Value*;
+      using iterator_category = std::forward_iterator_tag;
+
+      explicit IndirectIterator(const Value* const* current):
+        current_(current)
+      {}
+      IndirectIterator< Value >& operator++()
+      {
+        ++current_;
+        return *this;
+      }
+      IndirectIterator< Value > operator++(int)
+      {
+        IndirectIterator< Value > temp(*this);
+        ++current_;
+        return temp;
+      }
+      const Value& operator*() const
+      {
+        return **current_;
+      }
+      const Value* operator->() const
+      {
+        return *current_;
+      }
+      bool operator==(const IndirectIterator< Value >& other) const
+      {
+        return current_ == other.current_;
+      }
+      bool operator!=(const IndirectIterator< Value >& other) const
+      {
+        return current_ != other.current_;
+      }
+
+    private:
+      const Value* const* current_;
+    };
+  }
+
+  // Map spread by key hash over independent RBTrees, each behind a reader-writer lock of its own,
+  // so that writers to different shards do not contend. Ordered traversals merge the shards.
+  template < class K,
+    class T,
+    class Compare = std::less< K >,
+    class Hash = std::hash< K >,
+    class Allocator = std::allocator< std::pair< const K, T > >,
+    class Options = DefaultOptions >
+  class ShardedRBTree
+  {
+    static_assert(!Options::fingerSearch, "shared readers cannot move the finger of a tree");
+    static_assert(!Options::collectStats, "shared readers cannot bump the plain counters of a tree");
+
+  public:
+    using Tree = RBTree< K, T, Compare, Allocator, Options >;
+    using value_type = typename Tree::value_type;
+    using key_type = const K;
+    using mapped_type = T;
+    using allocator_type = Allocator;
+
+    explicit ShardedRBTree(std::size_t nShards = std::thread::hardware_concurrency(),
+      Compare compare = Compare(),
+      Hash hash = Hash(),
+      const Allocator& alloc = Allocator()):
+      compare_(compare),
+      hash_(hash)
+    {
+      shards_.reserve(nShards ? nShards : 1);
+      do
+      {
+        shards_.push_back(std::make_unique< Shard >(compare, alloc));
+      }
+      while (shards_.size() < nShards);
+    }
+    ShardedRBTree(const ShardedRBTree< K, T, Compare, Hash, Allocator, Options >&) = delete;
+    ShardedRBTree< K, T, Compare, Hash, Allocator, Options >& operator=(
+      const ShardedRBTree< K, T, Compare, Hash, Allocator, Options >&) = delete;
+    virtual ~ShardedRBTree() = default;
+    std::size_t shardCount() const noexcept
+    {
+      return shards_.size();
+    }
+    // Sum of the shard sizes, each read under its lock; not a snapshot while writers run.
+    std::size_t size() const
+    {
+      std::size_t result = 0;
+      for (const std::unique_ptr< Shard >& shard : shards_)
+      {
+        std::shared_lock< std::shared_mutex > lock(shard->mutex);
+        result += shard->tree.size();
+      }
+      return result;
+    }
+    bool empty() const
+    {
+      return size() == 0;
+    }
+    void clear()
+    {
+      for (const std::unique_ptr< Shard >& shard : shards_)
+      {
+        std::unique_lock< std::shared_mutex > lock(shard->mutex);
+        shard->tree.clear();
+      }
+    }
+    bool insert(const K& key, const T& value)
+    {
+      Shard& shard = shardOf(key);
+      std::unique_lock< std::shared_mutex > lock(shard.mutex);
+      return shard.tree.insert(key, value);
+    }
+    template < class... Args >
+    bool tryEmplace(const K& key, Args&&... args)
+    {
+      Shard& shard = shardOf(key);
+      std::unique_lock< std::shared_mutex > lock(shard.mutex);
+      return shard.tree.tryEmplace(key, std::forward< Args >(args)...).second;
+    }
+    bool erase(const K& key)
+    {
+      Shard& shard = shardOf(key);
+      std::unique_lock< std::shared_mutex > lock(shard.mutex);
+      return shard.tree.erase(key);
+    }
+    int count(const K& key) const
+    {
+      const Shard& shard = shardOf(key);
+      std::shared_lock< std::shared_mutex > lock(shard.mutex);
+      return shard.tree.count(key);
+    }
+    // A copy, as a reference would outlive the lock.
+    T at(const K& key) const
+    {
+      const Shard& shard = shardOf(key);
+      std::shared_lock< std::shared_mutex > lock(shard.mutex);
+      return shard.tree.at(key);
+    }
+    // Groups the batch by shard and hands each group to RBTree::insertBatch under one lock.
+    template < class ForwardIt >
+    std::size_t insertBatch(ForwardIt first, ForwardIt last)
+    {
+      using Value = typename std::iterator_traits< ForwardIt >::value_type;
+      std::vector< std::vector< const Value* > > groups = groupByShard(first, last, [](const Value& value) -> const K& {
+        return value.first;
+      });
+      std::size_t result = 0;
+      for (std::size_t i = 0; i < shards_.size(); ++i)
+      {
+        if (!groups[i].empty())
+        {
+          std::unique_lock< std::shared_mutex > lock(shards_[i]->mutex);
+          result += shards_[i]->tree.insertBatch(detail::IndirectIterator< Value >(groups[i].data()),
+            detail::IndirectIterator< Value >(groups[i].data() + groups[i].size()));
+        }
+      }
+      return result;
+    }
+    template < class ForwardIt >
+    std::size_t eraseBatch(ForwardIt first, ForwardIt last)
+    {
+      std::vector< std::vector< const K* > > groups = groupByShard(first, last, [](const K& key) -> const K& {
+        return key;
+      });
+      std::size_t result = 0;
+      for (std::size_t i = 0; i < shards_.size(); ++i)
+      {
+        if (!groups[i].empty())
+        {
+          std::unique_lock< std::shared_mutex > lock(shards_[i]->mutex);
+          result += shards_[i]->tree.eraseBatch(detail::IndirectIterator< K >(groups[i].data()),
+            detail::IndirectIterator< K >(groups[i].data() + groups[i].size()));
+        }
+      }
+      return result;
+    }
+    // Calls f for every element in key order, merging the shards with a heap of their cursors.
+    // All shards are read-locked meanwhile, so f sees one consistent state and must not write to this map.
+    template < class F >
+    void forEach(F&& f) const
+    {
+      std::vector< std::shared_lock< std::shared_mutex > > locks;
+      locks.reserve(shards_.size());
+      for (const std::unique_ptr< Shard >& shard : shards_)
+      {
+        locks.emplace_back(shard->mutex);
+      }
+      using Cursor = std::pair< typename Tree::const_iterator, typename Tree::const_iterator >;
+      std::vector< Cursor > heap;
+      heap.reserve(shards_.size());
+      for (const std::unique_ptr< Shard >& shard : shards_)
+      {
+        if (!shard->tree.empty())
+        {
+          heap.emplace_back(shard->tree.begin(), shard->tree.end());
+        }
+      }
+      auto isLater = [this](const Cursor& lhs, const Cursor& rhs) {
+        return isLess(rhs.first->first, lhs.first->first);
+      };
+      std::make_heap(heap.begin(), heap.end(), isLater);
+      while (!heap.empty())
+      {
+        std::pop_heap(heap.begin(), heap.end(), isLater);
+        Cursor& cursor = heap.back();
+        f(*cursor.first);
+        if (++cursor.first == cursor.second)
+        {
+          heap.pop_back();
+        }
+        else
+        {
+          std::push_heap(heap.begin(), heap.end(), isLater);
+        }
+      }
+    }
+
+  private:
+    static constexpr std::size_t CACHE_LINE = 64;
+    // Allocated on its own and aligned, so that the locks of neighbouring shards never share a cache line.
+    struct alignas(CACHE_LINE) Shard
+    {
+      Shard(Compare compare, const Allocator& alloc):
+        tree(compare, alloc)
+      {}
+      mutable std::shared_mutex mutex;
+      Tree tree;
+    };
+
+    // Fibonacci hashing spreads the low-entropy hashes of std::hash over the shards.
+    std::size_t shardIndex(const K& key) const
+    {
+      std::uint64_t hash = static_cast< std::uint64_t >(hash_(key)) * 0x9E3779B97F4A7C15ull;
+      return static_cast< std::size_t >((hash >> 32) % shards_.size());
+    }
+    Shard& shardOf(const K& key)
+    {
+      return *shards_[shardIndex(key)];
+    }
+    const Shard& shardOf(const K& key) const
+    {
+      return *shards_[shardIndex(key)];
+    }
+    template < class ForwardIt, class KeyOf >
+    std::vector< std::vector< const typename std::iterator_traits< ForwardIt >::value_type* > > groupByShard(ForwardIt first,
+      ForwardIt last,
+      KeyOf keyOf) const
+    {
+      std::vector< std::vector< const typename std::iterator_traits< ForwardIt >::value_type* > > groups(shards_.size());
+      for (; first != last; ++first)
+      {
+        groups[shardIndex(keyOf(*first))].push_back(std::addressof(*first));
+      }
+      return groups;
+    }
+    template < class First, class Second >
+    bool isLess(const First& first, const Second& second) const
+    {
+      if constexpr (detail::IsThreeWay< Compare, K >::value)
+      {
+        return compare_(first, second) < 0;
+      }
+      else
+      {
+        return compare_(first, second);
+      }
+    }
+
+    std::vector< std::unique_ptr< Shard > > shards_;
+    Compare compare_;
+    Hash hash_;
+  };
+}
+#endif
@@ -1,40 +1,356 @@
+#include <algorithm>
 #include <chrono>
-#include <fstream>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
 #include <iostream>
-#include <iterator>
-#include <numeric>
+#include <map>
+#include <memory>
+#include <string>
 #include <vector>
 #include "RBTree.hpp"
 
-const int SKIP = 10'000;
+// Times RBTree against std::map on int keys over sizes from 1K up to the first argument, 1M by default,
+// and prints ns/op with its percentiles, and bytes per element. Operations are timed in batches, so the clock adds nothing to them.
+// The second argument, if given, prints only the cases whose names contain it.
+//   bench [maxSize] [case]
+namespace
+{
+  using Clock = std::chrono::steady_clock;
+
+  // Heap bytes of every live std::map node, counted the way RBTree::memoryUsage() counts its own.
+  std::size_t mapHeapBytes = 0;
+  template < class T >
+  struct CountingAllocator
+  {
+    using value_type = T;
+    CountingAllocator() = default;
+    template < class U >
+    CountingAllocator(const CountingAllocator< U >&) noexcept
+    {}
+    T* allocate(std::size_t n)
+    {
+      mapHeapBytes += demidenko::detail::heapBlockBytes(n * sizeof(T));
+      return std::allocator< T >().allocate(n);
+    }
+    void deallocate(T* target, std::size_t n) noexcept
+    {
+      mapHeapBytes -= demidenko::detail::heapBlockBytes(n * sizeof(T));
+      std::allocator< T >().deallocate(target, n);
+    }
+    template < class U >
+    bool operator==(const CountingAllocator< U >&) const noexcept
+    {
+      return true;
+    }
+    template < class U >
+    bool operator!=(const CountingAllocator< U >&) const noexcept
+    {
+      return false;
+    }
+  };
+
+  using Tree = demidenko::RBTree< int, int >;
+  using Map = std::map< int, int, std::less< int >, CountingAllocator< std::pair< const int, int > > >;
+
+  // Operations per timed sample.
+  constexpr std::size_t BATCH = 256;
+  // Elements walked or copied by a repeated whole-tree case at most, spread over its repetitions.
+  constexpr std::size_t WHOLE_TREE_BUDGET = 20'000'000;
+
+  std::uint64_t sink = 0;
+
+  struct Result
+  {
+    double mean;
+    double p50;
+    double p90;
+    double p99;
+  };
+  Result summarize(std::vector< double > samples, double mean)
+  {
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double percentile) {
+      return samples[static_cast< std::size_t >(percentile * static_cast< double >(samples.size() - 1))];
+    };
+    return { mean, at(0.5), at(0.9), at(0.99) };
+  }
+  // Calls op(i) for every i < n, timing batches of BATCH calls: the percentiles are the ones of their ns/op.
+  template < class F >
+  Result timeEach(std::size_t n, F&& op)
+  {
+    std::vector< double > samples;
+    samples.reserve(n / BATCH + 1);
+    Clock::duration total{};
+    for (std::size_t first = 0; first < n; first += BATCH)
+    {
+      std::size_t last = std::min(n, first + BATCH);
+      Clock::time_point start = Clock::now();
+      for (std::size_t i = first; i < last; ++i)
+      {
+        op(i);
+      }
+      Clock::duration elapsed = Clock::now() - start;
+      total += elapsed;
+      samples.push_back(std::chrono::duration< double, std::nano >(elapsed).count() / static_cast< double >(last - first));
+    }
+    return summarize(std::move(samples), std::chrono::duration< double, std::nano >(total).count() / static_cast< double >(n));
+  }
+  // Runs a whole-tree operation over n elements several times, each run making one sample of its ns per element.
+  template < class F >
+  Result timeWhole(std::size_t n, F&& run)
+  {
+    std::size_t nRuns = std::max< std::size_t >(1, std::min< std::size_t >(50, WHOLE_TREE_BUDGET / n));
+    std::vector< double > samples;
+    double total = 0;
+    for (std::size_t i = 0; i < nRuns; ++i)
+    {
+      double elapsed = std::chrono::duration< double, std::nano >(run()).count() / static_cast< double >(n);
+      total += elapsed;
+      samples.push_back(elapsed);
+    }
+    return summarize(std::move(samples), total / static_cast< double >(nRuns));
+  }
+
+  std::uint64_t splitMix(std::uint64_t& state)
+  {
+    std::uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+  }
+  void shuffle(std::vector< int >& keys, std::uint64_t seed)
+  {
+    for (std::size_t i = keys.size(); i > 1; --i)
+    {
+      std::swap(keys[i - 1], keys[splitMix(seed) % i]);
+    }
+  }
+  // Ranks drawn with probability proportional to 1 / rank^theta, in O(1) each after an O(n) setup,
+  // as in Gray et al., "Quickly generating billion-record synthetic databases".
+  std::vector< std::size_t > zipfRanks(std::size_t n, std::size_t count, double theta, std::uint64_t seed)
+  {
+    double zetaN = 0;
+    for (std::size_t i = 1; i <= n; ++i)
+    {
+      zetaN += 1 / std::pow(static_cast< double >(i), theta);
+    }
+    double zeta2 = 1 + 1 / std::pow(2.0, theta);
+    double alpha = 1 / (1 - theta);
+    double eta = (1 - std::pow(2.0 / static_cast< double >(n), 1 - theta)) / (1 - zeta2 / zetaN);
+    std::vector< std::size_t > ranks;
+    ranks.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      double u = static_cast< double >(splitMix(seed) >> 11) * 0x1.0p-53;
+      double uz = u * zetaN;
+      std::size_t rank = 0;
+      if (uz >= 1)
+      {
+        rank = uz < zeta2 ? 1 : static_cast< std::size_t >(static_cast< double >(n) * std::pow(eta * u - eta + 1, alpha));
+      }
+      ranks.push_back(std::min(rank, n - 1));
+    }
+    return ranks;
+  }
+
+  // Keys of one size. Every present key is even, so that odd ones miss.
+  struct Input
+  {
+    explicit Input(std::size_t n):
+      ascending(n),
+      random(n)
+    {
+      for (std::size_t i = 0; i < n; ++i)
+      {
+        ascending[i] = static_cast< int >(2 * i);
+      }
+      random = ascending;
+      shuffle(random, n);
+      hits = random;
+      shuffle(hits, n + 1);
+      misses = hits;
+      for (int& key : misses)
+      {
+        ++key;
+      }
+      zipf.reserve(n);
+      for (std::size_t rank : zipfRanks(n, n, 0.99, n + 2))
+      {
+        zipf.push_back(random[rank]);
+      }
+    }
+    std::vector< int > ascending;
+    std::vector< int > random;
+    std::vector< int > hits;
+    std::vector< int > misses;
+    std::vector< int > zipf;
+  };
+
+  bool insert(Tree& tree, int key)
+  {
+    return tree.insert(key, key);
+  }
+  bool insert(Map& map, int key)
+  {
+    return map.emplace(key, key).second;
+  }
+  void append(Tree& tree, int key)
+  {
+    tree.insert(tree.cend(), key, key);
+  }
+  void append(Map& map, int key)
+  {
+    map.emplace_hint(map.cend(), key, key);
+  }
+  Tree::const_iterator lowerBound(const Tree& tree, int key)
+  {
+    return tree.lowerBound(key);
+  }
+  Map::const_iterator lowerBound(const Map& map, int key)
+  {
+    return map.lower_bound(key);
+  }
+  std::size_t memoryBytes(const Tree& tree)
+  {
+    return tree.memoryUsage().totalBytes;
+  }
+  // The only map alive when called.
+  std::size_t memoryBytes(const Map& map)
+  {
+    return sizeof(map) + mapHeapBytes;
+  }
+
+  struct Report
+  {
+    void print(const std::string& name, std::size_t n, const Result& tree, const Result& map) const
+    {
+      if (filter && name.find(filter) == std::string::npos)
+      {
+        return;
+      }
+      std::cout << std::left << std::setw(16) << name << std::right << std::setw(11) << n << std::fixed
+                << std::setprecision(1);
+      for (const Result* result : { &tree, &map })
+      {
+        std::cout << std::setw(9) << result->mean << std::setw(8) << result->p50 << std::setw(8) << result->p90
+                  << std::setw(8) << result->p99;
+      }
+      std::cout << std::setw(8) << std::setprecision(2) << tree.mean / map.mean << '\n';
+    }
+    void printBytes(std::size_t n, double tree, double map) const
+    {
+      if (filter && std::string("bytes/element").find(filter) == std::string::npos)
+      {
+        return;
+      }
+      std::cout << std::left << std::setw(16) << "bytes/element" << std::right << std::setw(11) << n << std::fixed
+                << std::setprecision(1) << std::setw(9) << tree << std::setw(24) << "" << std::setw(9) << map
+                << std::setw(24) << "" << std::setw(8) << std::setprecision(2) << tree / map << '\n';
+    }
+    const char* filter;
+  };
+
+  // Every case of one container at one size.
+  struct Results
+  {
+    Result sequential;
+    Result random;
+    Result zipf;
+    Result sorted;
+    Result hit;
+    Result miss;
+    Result lowerBound;
+    Result iteration;
+    Result copy;
+    Result erase;
+    double bytesPerElement;
+  };
+  template < class Container >
+  Results run(const Input& input)
+  {
+    std::size_t n = input.random.size();
+    Results results{};
+    {
+      Container sequential;
+      results.sequential = timeEach(n, [&](std::size_t i) {
+        insert(sequential, input.ascending[i]);
+      });
+      Container zipf;
+      results.zipf = timeEach(n, [&](std::size_t i) {
+        sink += insert(zipf, input.zipf[i]);
+      });
+      Container sorted;
+      results.sorted = timeEach(n, [&](std::size_t i) {
+        append(sorted, input.ascending[i]);
+      });
+    }
+    Container container;
+    results.random = timeEach(n, [&](std::size_t i) {
+      insert(container, input.random[i]);
+    });
+    results.bytesPerElement = static_cast< double >(memoryBytes(container)) / static_cast< double >(n);
+    results.hit = timeEach(n, [&](std::size_t i) {
+      sink += container.count(input.hits[i]);
+    });
+    results.miss = timeEach(n, [&](std::size_t i) {
+      sink += container.count(input.misses[i]);
+    });
+    results.lowerBound = timeEach(n, [&](std::size_t i) {
+      auto bound = lowerBound(container, input.misses[i]);
+      sink += bound == container.end() ? 0 : static_cast< std::uint64_t >(bound->second);
+    });
+    results.iteration = timeWhole(n, [&] {
+      Clock::time_point start = Clock::now();
+      for (const auto& value : container)
+      {
+        sink += static_cast< std::uint64_t >(value.second);
+      }
+      return Clock::now() - start;
+    });
+    results.copy = timeWhole(n, [&] {
+      Clock::time_point start = Clock::now();
+      std::unique_ptr< Container > copy = std::make_unique< Container >(container);
+      Clock::duration elapsed = Clock::now() - start;
+      sink += copy->size();
+      return elapsed;
+    });
+    results.erase = timeEach(n, [&](std::size_t i) {
+      sink += container.erase(input.hits[i]);
+    });
+    return results;
+  }
+}
+
 int main(int argc, char** argv)
 {
-  if (argc != 3)
-  {
-    return 1;
-  }
-  std::ofstream fill{ argv[1], std::ios_base::app };
-  std::ofstream search{ argv[2], std::ios_base::app };
-  demidenko::RBTree< int, int > tree;
-  unsigned long long luckyNumber = 0;
-  using InputIt = std::istream_iterator< int >;
-  int current = -1;
-  for (auto i = InputIt{ std::cin }; i != InputIt{}; ++i, ++current)
-  {
-    auto start = std::chrono::high_resolution_clock::now();
-    tree.insert(*i, 0);
-    if (current % SKIP != 0)
-    {
-      continue;
-    }
-    auto end = std::chrono::high_resolution_clock::now();
-    auto duration = std::chrono::duration_cast< std::chrono::nanoseconds >(end - start).count();
-    fill << current << ' ' << duration << '\n';
-    start = std::chrono::high_resolution_clock::now();
-    luckyNumber += tree.find(std::rand());
-    end = std::chrono::high_resolution_clock::now();
-    duration = std::chrono::duration_cast< std::chrono::nanoseconds >(end - start).count();
-    search << current << ' ' << duration << '\n';
-  }
-  std::cout << "Lucky number: " << luckyNumber << '\n';
+  std::size_t maxSize = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 1'000'000;
+  Report report{ argc > 2 ? argv[2] : nullptr };
+  std::cout << std::left << std::setw(16) << "case" << std::right << std::setw(11) << "size";
+  for (const char* container : { "RBTree", "map" })
+  {
+    std::cout << std::setw(9) << container << std::setw(8) << "p50" << std::setw(8) << "p90" << std::setw(8) << "p99";
+  }
+  std::cout << std::setw(8) << "ratio" << "\n";
+  for (std::size_t n = 1000; n <= maxSize; n *= 10)
+  {
+    Input input(n);
+    Results tree = run< Tree >(input);
+    Results map = run< Map >(input);
+    report.print("insert/seq", n, tree.sequential, map.sequential);
+    report.print("insert/random", n, tree.random, map.random);
+    report.print("insert/zipf", n, tree.zipf, map.zipf);
+    report.print("insert/sorted", n, tree.sorted, map.sorted);
+    report.print("find/hit", n, tree.hit, map.hit);
+    report.print("find/miss", n, tree.miss, map.miss);
+    report.print("lowerBound", n, tree.lowerBound, map.lowerBound);
+    report.print("iterate", n, tree.iteration, map.iteration);
+    report.print("copy", n, tree.copy, map.copy);
+    report.print("erase", n, tree.erase, map.erase);
+    report.printBytes(n, tree.bytesPerElement, map.bytesPerElement);
+  }
+  std::cerr << "checksum " << sink << '\n';
+  return 0;
 }
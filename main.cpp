@@ -1,8 +1,29 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <cstdio>
+#if __has_include(<compare>)
+#include <compare>
+#endif
+#include <fstream>
 #include <iostream>
 #include <iterator>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "BTreeMap.hpp"
+#include "ConcurrentRBTree.hpp"
+#include "MappedRBTree.hpp"
+#include "PersistentRBTree.hpp"
 #include "RBTree.hpp"
+#include "RBTreePool.hpp"
+#include "ShardedRBTree.hpp"
 
 void test(const char* testName, bool isSuccess)
 {
@@ -200,6 +221,2012 @@ void testIterators()
   // const demidenko::RBTree< int, int > consttree;
   // consttree.begin()->second = 9;
 }
+void testPoolAllocator()
+{
+  std::cout << "Pool allocator test\n";
+  using PoolTree = demidenko::RBTree< int, int, std::less< int >, demidenko::PoolAllocator< std::pair< const int, int > > >;
+  PoolTree tree(demidenko::PoolAllocator< std::pair< const int, int > >(16));
+  for (int i = 0; i < 1000; ++i)
+  {
+    tree.insert((i * 7919) % 1000, i);
+  }
+  testRB(tree);
+  for (int i = 0; i < 1000; i += 3)
+  {
+    tree.erase(i);
+  }
+  testRB(tree);
+  PoolTree copied(tree);
+  test("pool copy is equal", std::equal(tree.begin(), tree.end(), copied.begin()));
+  test("pool copy has own arena", copied.get_allocator() != tree.get_allocator());
+  tree.clear();
+  test("cleared pool tree is empty", tree.begin() == tree.end());
+  tree.insert(1, 1);
+  test("pool reused after clear", tree.count(1) && !tree.count(2));
+  PoolTree moved(std::move(copied));
+  testRB(moved);
+  copied.insert(5, 5);
+  test("moved-from pool tree is usable", copied.count(5));
+
+  demidenko::PoolAllocator< long > pool(16);
+  std::vector< long* > blocks;
+  for (int i = 0; i < 10; ++i)
+  {
+    blocks.push_back(pool.allocate(1));
+  }
+  for (int i = 0; i < 10; i += 2)
+  {
+    pool.deallocate(blocks[i], 1);
+  }
+  bool isContiguous = true;
+  for (std::size_t n : { 4, 40 })
+  {
+    pool.reserve(n);
+    long* first = pool.allocate(1);
+    blocks.push_back(first);
+    for (std::size_t i = 1; i < n; ++i)
+    {
+      blocks.push_back(pool.allocate(1));
+      isContiguous = isContiguous && blocks.back() == first + i;
+    }
+  }
+  // Then the free list again, topped by the rest of the first slab.
+  long* reused = pool.allocate(1);
+  blocks.push_back(reused);
+  test("reserved blocks are contiguous", isContiguous && reused == blocks[10] + 5);
+  for (std::size_t i = 0; i < blocks.size(); ++i)
+  {
+    if (i >= 10 || i % 2)
+    {
+      pool.deallocate(blocks[i], 1);
+    }
+  }
+}
+void testTransparentLookup()
+{
+  std::cout << "Transparent lookup test\n";
+  demidenko::RBTree< std::string, int, std::less<> > tree;
+  for (const char* word : { "pear", "apple", "plum", "fig", "kiwi" })
+  {
+    tree.insert(word, static_cast< int >(std::string_view(word).size()));
+  }
+  test("count by const char*", tree.count("plum") && !tree.count("grape"));
+  test("at by string_view", tree.at(std::string_view("apple")) == 5);
+  test("find by string_view", tree.find(std::string_view("fig")) != tree.end());
+  test("find missing", tree.find("banana") == tree.end());
+  test("lowerBound by const char*", tree.lowerBound("b")->first == "fig");
+  test("lowerBound past the end", tree.lowerBound("z") == tree.end());
+}
+void testRandomOperations()
+{
+  std::cout << "Random operations test\n";
+  demidenko::RBTree< int, int > tree;
+  std::map< int, int > reference;
+  unsigned seed = 12345;
+  bool isValid = true;
+  for (int i = 0; i < 20000 && isValid; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = (seed >> 8) % 512;
+    if ((seed >> 4) % 3)
+    {
+      isValid = tree.insert(key, i) == reference.insert({ key, i }).second;
+    }
+    else
+    {
+      isValid = tree.erase(key) == (reference.erase(key) != 0);
+    }
+    isValid = isValid && (reference.empty() || tree.isRBTree());
+  }
+  test("random operations keep RB invariants", isValid);
+  test("random operations match std::map", std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+  test("size matches std::map", tree.size() == reference.size());
+}
+struct CountingLess
+{
+  bool operator()(int lhs, int rhs) const
+  {
+    ++*counter;
+    return lhs < rhs;
+  }
+  int* counter;
+};
+void testSingleComparisonDescent()
+{
+  std::cout << "Single comparison descent test\n";
+  int comparisons = 0;
+  demidenko::RBTree< int, int, CountingLess > tree(CountingLess{ &comparisons });
+  for (int i = 0; i < 1023; ++i)
+  {
+    tree.insert(i, i);
+  }
+  testRB(tree);
+  bool isCheap = true;
+  for (int i = -1; i < 1024; i += 7)
+  {
+    comparisons = 0;
+    tree.count(i);
+    isCheap = isCheap && comparisons <= 21;
+  }
+  test("count compares once per level", isCheap);
+  comparisons = 0;
+  tree.insert(2000, 0);
+  test("insert compares once per level", comparisons <= 21);
+  comparisons = 0;
+  tree.erase(500);
+  test("erase compares once per level", comparisons <= 21);
+  testRB(tree);
+#ifdef __cpp_lib_three_way_comparison
+  demidenko::RBTree< int, int, std::compare_three_way > threeWay;
+  for (int i : { 5, 3, 8, 1, 4, 7, 9 })
+  {
+    threeWay.insert(i, i * 10);
+  }
+  testRB(threeWay);
+  test("three-way find", threeWay.at(4) == 40 && !threeWay.count(6));
+  test("three-way lowerBound", threeWay.lowerBound(6)->first == 7);
+  test("three-way duplicate insert", !threeWay.insert(8, 0));
+  threeWay.erase(5);
+  testRB(threeWay);
+  test("three-way erase", !threeWay.count(5) && threeWay.count(4));
+#endif
+}
+void testEmplaceAndHints()
+{
+  std::cout << "Emplace and hinted insert test\n";
+  demidenko::RBTree< int, std::unique_ptr< int > > owners;
+  test("tryEmplace moves value", owners.tryEmplace(1, std::make_unique< int >(10)).second);
+  test("emplace moves pair", owners.emplace(2, std::make_unique< int >(20)).second);
+  test("emplace existing", !owners.emplace(2, nullptr).second && *owners.at(2) == 20);
+  test("tryEmplace existing", !owners.tryEmplace(1, nullptr).second && *owners.at(1) == 10);
+  owners[3] = std::make_unique< int >(30);
+  test("subscript default-constructs in place", *owners.at(3) == 30);
+
+  int comparisons = 0;
+  demidenko::RBTree< int, int, CountingLess > sorted(CountingLess{ &comparisons });
+  bool isCheap = true;
+  for (int i = 0; i < 1000; ++i)
+  {
+    comparisons = 0;
+    sorted.insert(sorted.end(), i, i);
+    isCheap = isCheap && comparisons <= 1;
+  }
+  testRB(sorted);
+  test("append with end() hint compares once", isCheap);
+  auto hint = sorted.cbegin();
+  for (int i = -1; i > -100; --i)
+  {
+    hint = sorted.insert(hint, i, i);
+  }
+  testRB(sorted);
+  test("prepend with previous hint", sorted.begin()->first == -99);
+  auto wrongHint = sorted.insert(sorted.begin(), 500, 0);
+  test("wrong hint finds existing", wrongHint->first == 500 && wrongHint->second == 500);
+  sorted.emplaceHint(sorted.find(700), 2000, 1);
+  sorted.insert(sorted.find(700), 1500, 1);
+  testRB(sorted);
+  test("wrong hint still inserts", sorted.count(2000) && sorted.count(1500));
+}
+void testAssignSorted()
+{
+  std::cout << "Sorted bulk build test\n";
+  bool isValid = true;
+  for (int n = 0; n < 70; ++n)
+  {
+    std::vector< std::pair< int, int > > values;
+    for (int i = 0; i < n; ++i)
+    {
+      values.emplace_back(i * 2, i);
+    }
+    demidenko::RBTree< int, int > tree;
+    tree.insert(-5, 0);
+    tree.assignSorted(values.begin(), values.end());
+    isValid = isValid && (n == 0 ? tree.begin() == tree.end() : tree.isRBTree());
+    isValid = isValid && std::equal(tree.begin(), tree.end(), values.begin(), values.end(), [](auto& lhs, auto& rhs) {
+      return lhs.first == rhs.first && lhs.second == rhs.second;
+    });
+  }
+  test("bulk build is balanced and ordered", isValid);
+  using PoolTree = demidenko::RBTree< int, int, std::less< int >, demidenko::PoolAllocator< std::pair< const int, int > > >;
+  PoolTree pooled;
+  std::map< int, int > source{ { 1, 1 }, { 2, 2 }, { 3, 3 }, { 4, 4 }, { 5, 5 } };
+  pooled.assignSorted(source.begin(), source.end());
+  testRB(pooled);
+  pooled.insert(6, 6);
+  pooled.erase(1);
+  testRB(pooled);
+  std::pair< int, int > unsorted[]{ { 1, 0 }, { 3, 0 }, { 2, 0 } };
+  bool hasThrown = false;
+  try
+  {
+    pooled.assignSorted(std::begin(unsorted), std::end(unsorted));
+  }
+  catch (const std::invalid_argument&)
+  {
+    hasThrown = true;
+  }
+  test("unsorted range is rejected", hasThrown && pooled.begin() == pooled.end());
+}
+struct ThrowingValue
+{
+  ThrowingValue() = default;
+  ThrowingValue(const ThrowingValue&)
+  {
+    if (budget-- == 0)
+    {
+      throw std::runtime_error("copy budget exhausted");
+    }
+  }
+  static std::atomic< int > budget;
+};
+std::atomic< int > ThrowingValue::budget{ -1 };
+void testCopy()
+{
+  std::cout << "Copy test\n";
+  demidenko::RBTree< int, int > tree;
+  for (int i = 0; i < 5000; ++i)
+  {
+    tree.insert((i * 7919) % 5000, i);
+  }
+  demidenko::RBTree< int, int > parallelCopy(tree, demidenko::ParallelPolicy{ 4, 64 });
+  testRB(parallelCopy);
+  test("parallel copy is equal", std::equal(tree.begin(), tree.end(), parallelCopy.begin(), parallelCopy.end()));
+  parallelCopy.insert(-1, 0);
+  parallelCopy.erase(2500);
+  testRB(parallelCopy);
+  demidenko::RBTree< int, int > empty;
+  demidenko::RBTree< int, int > emptyCopy(empty, demidenko::ParallelPolicy{ 4, 0 });
+  demidenko::RBTree< int, int > ungrainedCopy(tree, demidenko::ParallelPolicy{ 4, 0 });
+  emptyCopy.insert(1, 1);
+  test("parallel copy without a grain", emptyCopy.size() == 1 && ungrainedCopy.isRBTree()
+    && std::equal(tree.begin(), tree.end(), ungrainedCopy.begin(), ungrainedCopy.end()));
+
+  demidenko::RBTree< int, ThrowingValue > throwing;
+  for (int i = 0; i < 1000; ++i)
+  {
+    throwing.tryEmplace(i);
+  }
+  bool hasThrown = false;
+  ThrowingValue::budget = 500;
+  try
+  {
+    demidenko::RBTree< int, ThrowingValue > copy(throwing);
+  }
+  catch (const std::runtime_error&)
+  {
+    hasThrown = true;
+  }
+  test("failed copy rethrows", hasThrown);
+  hasThrown = false;
+  ThrowingValue::budget = 700;
+  try
+  {
+    demidenko::RBTree< int, ThrowingValue > copy(throwing, demidenko::ParallelPolicy{ 4, 16 });
+  }
+  catch (const std::runtime_error&)
+  {
+    hasThrown = true;
+  }
+  ThrowingValue::budget = -1;
+  test("failed parallel copy rethrows", hasThrown);
+}
+void testOrderStatistic()
+{
+  std::cout << "Order statistic test\n";
+  using OrderTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::OrderStatisticOptions >;
+  OrderTree tree;
+  std::map< int, int > reference;
+  unsigned seed = 777;
+  bool isValid = true;
+  for (int i = 0; i < 5000 && isValid; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = (seed >> 8) % 256;
+    if ((seed >> 4) % 3)
+    {
+      tree.insert(key, i);
+      reference.insert({ key, i });
+    }
+    else
+    {
+      tree.erase(key);
+      reference.erase(key);
+    }
+    isValid = tree.size() == reference.size() && (reference.empty() || tree.isRBTree());
+  }
+  test("sizes survive random operations", isValid);
+  std::size_t index = 0;
+  for (auto iter = reference.begin(); iter != reference.end() && isValid; ++iter, ++index)
+  {
+    isValid = tree.nth(index)->first == iter->first && tree.rank(iter->first) == index;
+  }
+  test("nth and rank match std::map", isValid);
+  test("nth past the end", tree.nth(tree.size()) == tree.end());
+  test("rank of missing key", tree.rank(1000) == tree.size() && tree.rank(-1) == 0);
+  std::vector< std::pair< int, int > > values;
+  for (int i = 0; i < 100; ++i)
+  {
+    values.emplace_back(i, i);
+  }
+  tree.assignSorted(values.begin(), values.end());
+  testRB(tree);
+  OrderTree copied(tree, demidenko::ParallelPolicy{ 2, 8 });
+  testRB(copied);
+  test("copy keeps sizes", copied.size() == 100 && copied.nth(42)->first == 42 && copied.rank(50) == 50);
+}
+void testRanges()
+{
+  std::cout << "Range query test\n";
+  demidenko::RBTree< int, int > tree;
+  for (int i = 0; i < 100; i += 2)
+  {
+    tree.insert(i, i);
+  }
+  test("upperBound of existing", tree.upperBound(10)->first == 12);
+  test("upperBound of missing", tree.upperBound(11)->first == 12);
+  test("upperBound past the end", tree.upperBound(98) == tree.end());
+  auto range = tree.equalRange(20);
+  test("equalRange of existing", range.first->first == 20 && range.second->first == 22);
+  range = tree.equalRange(21);
+  test("equalRange of missing", range.first == range.second && range.first->first == 22);
+  test("countInRange", tree.countInRange(10, 20) == 5 && tree.countInRange(11, 12) == 0 && tree.countInRange(50, 10) == 0);
+  std::vector< int > keys;
+  tree.forEachInRange(91, 1000, [&](const std::pair< const int, int >& value) {
+    keys.push_back(value.first);
+  });
+  test("forEachInRange visits in order", keys == std::vector< int >{ 92, 94, 96, 98 });
+  tree.forEachInRange(0, 4, [](std::pair< const int, int >& value) {
+    value.second = -1;
+  });
+  test("forEachInRange gives mutable access", tree.at(0) == -1 && tree.at(2) == -1 && tree.at(4) == 4);
+  using OrderTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::OrderStatisticOptions >;
+  OrderTree ordered;
+  ordered.assignSorted(tree.begin(), tree.end());
+  test("countInRange by rank", ordered.countInRange(10, 20) == 5 && ordered.countInRange(-5, 1000) == 50);
+}
+void testForEach()
+{
+  std::cout << "Bulk traversal test\n";
+  demidenko::RBTree< int, int > tree;
+  std::vector< int > expected;
+  for (int i = 0; i < 300; ++i)
+  {
+    tree.insert((i * 37) % 300, i);
+    expected.push_back(i);
+  }
+  std::vector< int > keys;
+  tree.forEach([&](std::pair< const int, int >& value) {
+    keys.push_back(value.first);
+    value.second = 0;
+  });
+  test("forEach visits in order", keys == expected);
+  keys.clear();
+  const auto& constTree = tree;
+  constTree.forEachReverse([&](const std::pair< const int, int >& value) {
+    keys.push_back(value.first + value.second);
+  });
+  std::reverse(expected.begin(), expected.end());
+  test("forEachReverse visits in reverse order", keys == expected);
+  demidenko::RBTree< int, int > empty;
+  bool isVisited = false;
+  empty.forEach([&](auto&) {
+    isVisited = true;
+  });
+  test("forEach on empty tree", !isVisited);
+}
+// Orders by the table it carries, as collations do.
+struct TableLess
+{
+  bool operator()(int lhs, int rhs) const
+  {
+    return table->at(static_cast< std::size_t >(lhs)) < table->at(static_cast< std::size_t >(rhs));
+  }
+  std::shared_ptr< std::vector< int > > table;
+};
+void testMoveAndSwap()
+{
+  std::cout << "Move and swap test\n";
+  using TableTree = demidenko::RBTree< int, int, TableLess >;
+  std::shared_ptr< std::vector< int > > ascending = std::make_shared< std::vector< int > >();
+  std::shared_ptr< std::vector< int > > descending = std::make_shared< std::vector< int > >();
+  for (int i = 0; i < 100; ++i)
+  {
+    ascending->push_back(i);
+    descending->push_back(-i);
+  }
+  TableTree up(TableLess{ ascending });
+  TableTree down(TableLess{ descending });
+  for (int i = 0; i < 100; i += 3)
+  {
+    up.insert(i, i);
+    down.insert(i, -i);
+  }
+  TableTree moved(std::move(up));
+  moved.insert(1, 1);
+  test("moves keep the comparator", moved.begin()->first == 0 && std::next(moved.begin())->first == 1
+    && moved.count(99) && moved.isRBTree());
+  static_assert(noexcept(moved.swap(down)), "swap must not throw");
+  TableTree* storage = &moved;
+  swap(moved, down);
+  test("swap exchanges contents and comparators", storage == &moved && moved.begin()->first == 99
+    && moved.begin()->second == -99 && down.begin()->first == 0 && down.count(1) && moved.isRBTree() && down.isRBTree());
+  using PoolTree = demidenko::RBTree< int, int, std::less< int >, demidenko::PoolAllocator< std::pair< const int, int > > >;
+  PoolTree first;
+  PoolTree second;
+  first.insert(1, 1);
+  second.insert(2, 2);
+  std::swap(first, second);
+  second.insert(3, 3);
+  test("pool allocators swap along", first.count(2) && second.count(1) && second.count(3) && second.size() == 2);
+}
+void testCompactNodes()
+{
+  std::cout << "Compact node test\n";
+  using CompactTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::CompactOptions >;
+  using WideNode = demidenko::detail::Node< int, int, demidenko::DefaultOptions >;
+  using CompactNode = demidenko::detail::Node< int, int, demidenko::CompactOptions >;
+  test("compact node saves a word", sizeof(CompactNode) + sizeof(void*) == sizeof(WideNode));
+  CompactTree tree;
+  std::map< int, int > reference;
+  unsigned seed = 4242;
+  bool isValid = true;
+  for (int i = 0; i < 5000 && isValid; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = (seed >> 8) % 300;
+    if ((seed >> 4) % 3)
+    {
+      tree.insert(key, i);
+      reference.insert({ key, i });
+    }
+    else
+    {
+      tree.erase(key);
+      reference.erase(key);
+    }
+    isValid = reference.empty() || tree.isRBTree();
+  }
+  test("compact tree keeps RB invariants", isValid);
+  test("compact tree matches std::map", std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+  CompactTree copied(tree);
+  test("compact copy is equal", std::equal(tree.begin(), tree.end(), copied.begin(), copied.end()));
+}
+void testStats()
+{
+  std::cout << "Stats test\n";
+  using StatsTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::StatsOptions >;
+  test("disabled stats take no space", std::is_empty< demidenko::detail::StatsCounter< false > >::value);
+  StatsTree tree;
+  for (int i = 0; i < 1000; ++i)
+  {
+    tree.insert(i, i);
+  }
+  demidenko::RBTreeStats stats = tree.stats();
+  test("insertions count their work", stats.allocations == 1000 && stats.deallocations == 0 && stats.rotations > 0
+    && stats.insertFixupSteps > 0 && stats.comparisons > 1000 && stats.maxDepth >= 10 && stats.maxDepth <= 20);
+  tree.resetStats();
+  tree.count(500);
+  stats = tree.stats();
+  test("a lookup compares once per level", stats.comparisons > 0 && stats.comparisons <= stats.maxDepth + 1
+    && stats.rotations == 0 && stats.allocations == 0);
+  StatsTree copied(tree);
+  test("copies count from zero", copied.stats().allocations == 1000 && copied.stats().comparisons == 0);
+  for (int i = 0; i < 1000; i += 2)
+  {
+    tree.erase(i);
+  }
+  stats = tree.stats();
+  test("erasures count their work",
+    stats.deallocations == 500 && stats.eraseFixupSteps > 0 && stats.rotations > 0 && tree.isRBTree());
+}
+struct FingerStatsOptions: demidenko::DefaultOptions
+{
+  static constexpr bool fingerSearch = true;
+  static constexpr bool collectStats = true;
+};
+template < class Tree >
+bool matchesUnderFingers(Tree& tree)
+{
+  std::map< int, int > reference;
+  unsigned seed = 777;
+  int key = 0;
+  bool isValid = true;
+  for (int i = 0; i < 20000 && isValid; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    key = (seed >> 20) % 8 ? (key + static_cast< int >((seed >> 8) % 9) - 4 + 1024) % 1024 : (seed >> 8) % 1024;
+    switch ((seed >> 4) % 4)
+    {
+    case 0:
+      isValid = tree.insert(key, i) == reference.insert({ key, i }).second;
+      break;
+    case 1:
+      isValid = tree.erase(key) == (reference.erase(key) != 0);
+      break;
+    case 2:
+    {
+      auto bound = tree.lowerBound(key);
+      auto expected = reference.lower_bound(key);
+      isValid = (bound == tree.end()) == (expected == reference.end()) && (bound == tree.end() || *bound == *expected);
+      break;
+    }
+    default:
+      isValid = tree.count(key) == static_cast< int >(reference.count(key));
+    }
+  }
+  return isValid && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()) && tree.isRBTree();
+}
+void testFingerSearch()
+{
+  std::cout << "Finger search test\n";
+  test("disabled fingers take no space", std::is_empty< demidenko::detail::FingerCache< int, false > >::value);
+  using FingerTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    FingerStatsOptions >;
+  FingerTree tree;
+  test("local operations match std::map", matchesUnderFingers(tree));
+#ifdef __cpp_lib_three_way_comparison
+  demidenko::RBTree< int, int, std::compare_three_way, std::allocator< std::pair< const int, int > >,
+    FingerStatsOptions > threeWay;
+  test("local three-way operations match std::map", matchesUnderFingers(threeWay));
+#endif
+  tree.clear();
+  for (int i = 0; i < 1 << 16; ++i)
+  {
+    tree.insert(tree.end(), i, i);
+  }
+  tree.count(30000);
+  tree.resetStats();
+  bool isFound = true;
+  for (int i = 30001; i < 30101; ++i)
+  {
+    isFound = isFound && tree.count(i) == 1;
+  }
+  std::size_t nearby = tree.stats().comparisons;
+  tree.resetStats();
+  for (int i = 0; i < 100; ++i)
+  {
+    isFound = isFound && tree.count((i * 40503) % (1 << 16)) == 1;
+  }
+  test("nearby lookups compare less", isFound && nearby < tree.stats().comparisons / 2);
+  tree.erase(30100);
+  tree.extract(30099);
+  auto bound = tree.lowerBound(30099);
+  test("erasing the finger keeps lookups right", bound != tree.end() && bound->first == 30101 && tree.count(30098) == 1);
+  FingerTree moved(std::move(tree));
+  tree.clear();
+  test("moves and clears drop the finger", tree.count(30098) == 0 && moved.count(30098) == 1 && moved.isRBTree());
+}
+struct CompactTombstoneOptions: demidenko::TombstoneOptions
+{
+  static constexpr bool compactNodes = true;
+};
+struct LazyStatsOptions: demidenko::DefaultOptions
+{
+  static constexpr bool tombstones = true;
+  static constexpr bool collectStats = true;
+};
+void testTombstones()
+{
+  std::cout << "Tombstones test\n";
+  using TombstoneTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::TombstoneOptions >;
+  TombstoneTree tree;
+  std::map< int, int > reference;
+  unsigned seed = 4242;
+  bool isValid = true;
+  for (int i = 0; i < 20000 && isValid; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = (seed >> 8) % 512;
+    switch ((seed >> 4) % 5)
+    {
+    case 0:
+    case 1:
+      isValid = tree.insert(key, i) == reference.insert({ key, i }).second;
+      break;
+    case 2:
+      isValid = tree.erase(key) == (reference.erase(key) != 0);
+      break;
+    case 3:
+    {
+      auto position = tree.lowerBound(key);
+      auto expected = reference.lower_bound(key);
+      if (position != tree.end())
+      {
+        auto next = tree.erase(position);
+        expected = reference.erase(expected);
+        isValid = (next == tree.end()) == (expected == reference.end()) && (next == tree.end() || *next == *expected);
+      }
+      break;
+    }
+    default:
+    {
+      auto range = tree.equalRange(key);
+      auto expected = reference.equal_range(key);
+      isValid = tree.count(key) == static_cast< int >(reference.count(key))
+        && (range.second == tree.end() ? expected.second == reference.end() : *range.second == *expected.second)
+        && (range.first == range.second) == (expected.first == expected.second);
+    }
+    }
+  }
+  test("lazy erasures match std::map", isValid && tree.size() == reference.size()
+    && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()) && tree.isRBTree());
+  std::vector< std::pair< const int, int > > reversed;
+  for (auto current = tree.find(reference.rbegin()->first); current != tree.begin(); --current)
+  {
+    reversed.push_back(*current);
+  }
+  reversed.push_back(*tree.begin());
+  std::vector< std::pair< const int, int > > visited;
+  tree.forEachReverse([&](const std::pair< const int, int >& value) {
+    visited.push_back(value);
+  });
+  test("traversals skip tombstones both ways", std::equal(reversed.begin(), reversed.end(), reference.rbegin(), reference.rend())
+    && std::equal(visited.begin(), visited.end(), reference.rbegin(), reference.rend()));
+  test("sweeps keep tombstones few", tree.tombstones() * 4 < tree.size());
+
+  using LazyTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    LazyStatsOptions >;
+  LazyTree lazy;
+  for (int i = 0; i < 1000; ++i)
+  {
+    lazy.insert(i, i);
+  }
+  lazy.resetStats();
+  for (int i = 0; i < 1000; i += 2)
+  {
+    lazy.erase(i);
+  }
+  test("erasures only mark nodes", lazy.tombstones() == 500 && lazy.size() == 500
+    && lazy.stats().rotations == 0 && lazy.stats().deallocations == 0 && lazy.count(10) == 0 && lazy.find(10) == lazy.end());
+  test("tombstones are revived in place",
+    lazy.tryEmplace(10, 100).second && lazy.at(10) == 100 && lazy.tombstones() == 499 && lazy.stats().rotations == 0);
+  LazyTree copy(lazy);
+  test("copies keep tombstones", copy.tombstones() == 499 && std::equal(copy.begin(), copy.end(), lazy.begin(), lazy.end()));
+  lazy.erase(1);
+  bool isKept = lazy.tombstones() == 500;
+  lazy.erase(3);
+  test("outnumbering tombstones are purged at once",
+    isKept && lazy.tombstones() == 0 && lazy.size() == 499 && lazy.stats().rotations == 0 && lazy.isRBTree());
+  LazyTree right = copy.split(500);
+  test("splits purge tombstones first", copy.tombstones() == 0 && copy.size() == 251 && right.size() == 250
+    && copy.isRBTree() && right.isRBTree());
+  copy.join(std::move(right));
+  copy.erase(copy.find(11), copy.find(21));
+  copy.compact();
+  test("compaction relinks the live nodes", copy.tombstones() == 0 && copy.size() == 496 && copy.isRBTree()
+    && copy.lowerBound(11)->first == 21);
+
+  demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >, CompactTombstoneOptions >
+    compact;
+  for (int i = 0; i < 100; ++i)
+  {
+    compact.insert(i, i);
+  }
+  for (int i = 0; i < 100; i += 3)
+  {
+    compact.erase(i);
+  }
+  compact.insert(30, -30);
+  test("compact nodes keep the mark beside the color", compact.size() == 67 && compact.at(30) == -30
+    && compact.count(33) == 0 && compact.begin()->first == 1 && compact.isRBTree());
+}
+template < class Tree >
+bool reducesInOrder(Tree& tree, demidenko::ParallelPolicy policy)
+{
+  std::vector< int > keys = tree.parallelReduce(std::vector< int >(),
+    [](std::vector< int > result, const std::pair< const int, int >& value) {
+      result.push_back(value.first);
+      return result;
+    },
+    [](std::vector< int > lhs, const std::vector< int >& rhs) {
+      lhs.insert(lhs.end(), rhs.begin(), rhs.end());
+      return lhs;
+    },
+    policy);
+  std::vector< int > expected;
+  for (const auto& value : tree)
+  {
+    expected.push_back(value.first);
+  }
+  return keys == expected;
+}
+void testParallelTraversal()
+{
+  std::cout << "Parallel traversal test\n";
+  demidenko::RBTree< int, int > tree;
+  long long expectedSum = 0;
+  for (int i = 0; i < 20000; ++i)
+  {
+    int key = (i * 7919) % 20000;
+    tree.insert(key, i);
+    expectedSum += i;
+  }
+  demidenko::ParallelPolicy policy{ 4, 64 };
+  long long sum = tree.parallelReduce(0LL,
+    [](long long result, const std::pair< const int, int >& value) {
+      return result + value.second;
+    },
+    [](long long lhs, long long rhs) {
+      return lhs + rhs;
+    },
+    policy);
+  test("parallel sums match", sum == expectedSum);
+  test("order-sensitive reductions combine in order", reducesInOrder(tree, policy));
+  std::atomic< int > visited{ 0 };
+  tree.parallelForEach([&](std::pair< const int, int >& value) {
+    value.second = -value.first;
+    ++visited;
+  }, policy);
+  bool isNegated = true;
+  tree.forEach([&](const std::pair< const int, int >& value) {
+    isNegated = isNegated && value.second == -value.first;
+  });
+  test("parallel visits reach every element once", visited == 20000 && isNegated);
+  using OrderTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::OrderStatisticOptions >;
+  OrderTree ordered;
+  for (int i = 0; i < 5000; ++i)
+  {
+    ordered.insert(i, i);
+  }
+  test("exact pieces reduce in order", reducesInOrder(ordered, demidenko::ParallelPolicy{ 3, 16 }));
+  bool isThrown = false;
+  try
+  {
+    tree.parallelForEach([](const std::pair< const int, int >& value) {
+      if (value.first == 12345)
+      {
+        throw std::runtime_error("stop");
+      }
+    }, policy);
+  }
+  catch (const std::runtime_error&)
+  {
+    isThrown = true;
+  }
+  test("exceptions reach the caller", isThrown);
+}
+struct SumOptions: demidenko::DefaultOptions
+{
+  using Augment = demidenko::ValueSum< long long >;
+};
+struct IntervalOptions: demidenko::DefaultOptions
+{
+  using Augment = demidenko::ValueMax< int >;
+};
+// First and last key with their count, which does not commute.
+struct KeyEnds
+{
+  struct value_type
+  {
+    int first;
+    int last;
+    int count;
+  };
+  static value_type identity() noexcept
+  {
+    return { 0, 0, 0 };
+  }
+  static value_type of(const std::pair< const int, int >& element) noexcept
+  {
+    return { element.first, element.first, 1 };
+  }
+  static value_type combine(const value_type& lhs, const value_type& rhs) noexcept
+  {
+    return { lhs.count ? lhs.first : rhs.first, rhs.count ? rhs.last : lhs.last, lhs.count + rhs.count };
+  }
+};
+struct KeyEndsOptions: demidenko::OrderStatisticOptions
+{
+  using Augment = KeyEnds;
+};
+struct LazySumOptions: demidenko::TombstoneOptions
+{
+  using Augment = demidenko::ValueSum< long long >;
+};
+template < class Tree >
+bool sumsMatch(const Tree& tree, const std::map< int, long long >& reference, unsigned seed)
+{
+  bool isValid = tree.aggregate() == tree.rangeAggregate(-1, 1 << 30);
+  for (int i = 0; i < 200 && isValid; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int lo = (seed >> 8) % 600 - 50;
+    int hi = lo + (seed >> 20) % 300;
+    long long expected = 0;
+    for (auto current = reference.lower_bound(lo); current != reference.end() && current->first < hi; ++current)
+    {
+      expected += current->second;
+    }
+    isValid = tree.rangeAggregate(lo, hi) == expected;
+  }
+  return isValid;
+}
+void testAugmentation()
+{
+  std::cout << "Augmentation test\n";
+  using SumTree = demidenko::RBTree< int, long long, std::less< int >,
+    std::allocator< std::pair< const int, long long > >, SumOptions >;
+  SumTree tree;
+  std::map< int, long long > reference;
+  unsigned seed = 99;
+  for (int i = 0; i < 5000; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = (seed >> 8) % 512;
+    switch ((seed >> 4) % 4)
+    {
+    case 0:
+    case 1:
+      tree.insert(key, i);
+      reference.insert({ key, i });
+      break;
+    case 2:
+      tree.erase(key);
+      reference.erase(key);
+      break;
+    default:
+      tree[key] += 3;
+      tree.updateAggregate(tree.find(key));
+      reference[key] += 3;
+    }
+  }
+  test("range sums follow point updates", sumsMatch(tree, reference, 1) && tree.isRBTree());
+  SumTree right = tree.split(250);
+  bool isSplit = sumsMatch(right, std::map< int, long long >(reference.lower_bound(250), reference.end()), 2);
+  tree.join(std::move(right));
+  std::vector< std::pair< int, long long > > batch;
+  for (int i = 0; i < 300; i += 7)
+  {
+    batch.emplace_back(i, i);
+    reference.insert({ i, i });
+  }
+  tree.insertBatch(batch.begin(), batch.end());
+  std::vector< int > erased = { 3, 14, 15, 92, 65, 35 };
+  tree.eraseBatch(erased.begin(), erased.end());
+  for (int key : erased)
+  {
+    reference.erase(key);
+  }
+  tree.erase(tree.lowerBound(100), tree.lowerBound(400));
+  reference.erase(reference.lower_bound(100), reference.lower_bound(400));
+  SumTree copy(tree);
+  test("bulk operations keep the sums", isSplit && sumsMatch(tree, reference, 3) && sumsMatch(copy, reference, 4));
+
+  using EndsTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    KeyEndsOptions >;
+  EndsTree ends;
+  for (int i = 0; i < 1000; ++i)
+  {
+    ends.insert((i * 37) % 1000, i);
+  }
+  KeyEnds::value_type middle = ends.rangeAggregate(123, 877);
+  KeyEnds::value_type none = ends.rangeAggregate(500, 500);
+  test("aggregates combine in key order", middle.first == 123 && middle.last == 876 && middle.count == 754
+    && none.count == 0 && ends.rank(877) - ends.rank(123) == 754);
+
+  using IntervalTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    IntervalOptions >;
+  IntervalTree intervals;
+  std::vector< std::pair< int, int > > spans;
+  for (int i = 0; i < 400; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int start = (seed >> 8) % 10000;
+    int end = start + 1 + (seed >> 20) % 300;
+    if (intervals.insert(start, end))
+    {
+      spans.emplace_back(start, end);
+    }
+  }
+  bool isStabbed = true;
+  for (int point = 0; point < 10400 && isStabbed; point += 13)
+  {
+    auto ending = [point](int maxEnd) {
+      return maxEnd > point;
+    };
+    int expectedFirst = -1;
+    std::size_t expectedCount = 0;
+    for (const auto& span : spans)
+    {
+      if (span.first <= point && point < span.second)
+      {
+        expectedFirst = expectedFirst < 0 || span.first < expectedFirst ? span.first : expectedFirst;
+        ++expectedCount;
+      }
+    }
+    std::size_t count = 0;
+    auto first = intervals.findFirstWhere(ending);
+    for (auto current = first; current != intervals.end() && current->first <= point;
+         current = intervals.findFirstWhere(std::next(current), ending))
+    {
+      count += point < current->second;
+    }
+    bool isContained = first != intervals.end() && first->first <= point;
+    isStabbed = isContained == (expectedFirst >= 0) && (!isContained || first->first == expectedFirst)
+      && count == expectedCount;
+  }
+  test("intervals are stabbed through the maximal ends", isStabbed);
+
+  SumTree spikes;
+  for (int i = 0; i < 1000; ++i)
+  {
+    spikes.insert(i, i % 211 == 100 ? 50 + i / 100 : i % 10);
+  }
+  bool isBacktracked = true;
+  for (long long least : { 9, 10, 51, 55, 59, 60 })
+  {
+    auto reaching = [least](long long sum) {
+      return sum >= least;
+    };
+    auto expected = std::find_if(spikes.begin(), spikes.end(), [least](const std::pair< const int, long long >& e) {
+      return e.second >= least;
+    });
+    auto next = expected == spikes.end() ? expected : std::find_if(std::next(expected), spikes.end(),
+      [least](const std::pair< const int, long long >& e) {
+        return e.second >= least;
+      });
+    auto found = spikes.findFirstWhere(reaching);
+    isBacktracked = isBacktracked && found == expected
+      && (found == spikes.end() || spikes.findFirstWhere(std::next(found), reaching) == next);
+  }
+  test("sums backtrack out of subtrees without a match", isBacktracked);
+
+  using LazySumTree = demidenko::RBTree< int, long long, std::less< int >,
+    std::allocator< std::pair< const int, long long > >, LazySumOptions >;
+  LazySumTree lazy;
+  for (int i = 0; i < 100; ++i)
+  {
+    lazy.insert(i, i);
+  }
+  for (int i = 0; i < 100; i += 4)
+  {
+    lazy.erase(i);
+  }
+  lazy.insert(40, 1000);
+  test("tombstones add nothing to aggregates", lazy.aggregate() == 4950 - 1200 + 1000
+    && lazy.rangeAggregate(40, 41) == 1000 && lazy.rangeAggregate(0, 1) == 0);
+}
+void testMemoryUsage()
+{
+  std::cout << "Memory usage test\n";
+  demidenko::RBTree< int, int > tree;
+  for (int i = 0; i < 1000; ++i)
+  {
+    tree.insert(i, i);
+  }
+  demidenko::RBTreeMemory memory = tree.memoryUsage();
+  test("heap nodes include malloc overhead", memory.nodes == 1000 && memory.blockBytes == tree.nodeBytes()
+    && memory.blockBytes >= memory.nodeBytes + sizeof(std::size_t) && memory.blockBytes % 16 == 0
+    && memory.totalBytes == sizeof(tree) + 1000 * memory.blockBytes && memory.fragmentation == 0);
+  using CompactTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::CompactOptions >;
+  test("padding is reported", memory.paddingBytes == sizeof(int) && CompactTree().memoryUsage().paddingBytes == 0);
+
+  using PoolTree = demidenko::RBTree< int, int, std::less< int >, demidenko::PoolAllocator< std::pair< const int, int > > >;
+  PoolTree pooled(demidenko::PoolAllocator< std::pair< const int, int > >(1000));
+  for (int i = 0; i < 1000; ++i)
+  {
+    pooled.insert(i, i);
+  }
+  memory = pooled.memoryUsage();
+  test("pool nodes take a block", pooled.nodeBytes() == memory.nodeBytes && memory.fragmentation == 0
+    && memory.totalBytes == sizeof(pooled) + 1000 * memory.nodeBytes);
+  for (int i = 0; i < 1000; i += 4)
+  {
+    pooled.erase(i);
+  }
+  test("erasures fragment the pool", pooled.memoryUsage().fragmentation == 0.25
+    && pooled.memoryUsage().totalBytes == memory.totalBytes);
+}
+void testSerialization()
+{
+  std::cout << "Serialization test\n";
+  demidenko::RBTree< int, double > tree;
+  std::map< int, double > reference;
+  for (int i = 0; i < 5000; ++i)
+  {
+    int key = (i * 7919) % 5000 * 2;
+    tree.insert(key, key / 4.0);
+    reference.insert({ key, key / 4.0 });
+  }
+  std::stringstream stream;
+  tree.serialize(stream);
+  demidenko::RBTree< int, double > loaded;
+  loaded.insert(-1, 0);
+  loaded.deserialize(stream);
+  test("deserialized tree equals the original", loaded.size() == reference.size() && loaded.isRBTree()
+    && std::equal(loaded.begin(), loaded.end(), reference.begin(), reference.end()));
+  std::stringstream truncated(stream.str().substr(0, stream.str().size() - 1));
+  bool hasThrown = false;
+  try
+  {
+    demidenko::RBTree< int, float > mismatched;
+    std::stringstream copy(stream.str());
+    mismatched.deserialize(copy);
+  }
+  catch (const std::invalid_argument&)
+  {
+    hasThrown = true;
+  }
+  try
+  {
+    loaded.deserialize(truncated);
+    hasThrown = false;
+  }
+  catch (const std::invalid_argument&)
+  {
+    hasThrown = hasThrown && loaded.size() == reference.size();
+  }
+  test("bad streams are rejected", hasThrown);
+
+  const char* path = "serialization_test.bin";
+  {
+    std::ofstream file(path, std::ios::binary);
+    tree.serialize(file);
+  }
+  bool isValid = true;
+  {
+    demidenko::MappedRBTree< int, double > mapped(path);
+    isValid = mapped.size() == reference.size() && std::equal(mapped.begin(), mapped.end(), reference.begin(), reference.end());
+    for (int key = -1; key < 10001 && isValid; ++key)
+    {
+      std::map< int, double >::const_iterator lower = reference.lower_bound(key);
+      std::map< int, double >::const_iterator upper = reference.upper_bound(key);
+      isValid = mapped.count(key) == static_cast< int >(reference.count(key))
+        && (lower == reference.end() ? mapped.lowerBound(key) == mapped.end() : mapped.lowerBound(key)->first == lower->first)
+        && (upper == reference.end() ? mapped.upperBound(key) == mapped.end() : *mapped.upperBound(key) == *upper);
+    }
+    test("mapped view answers from the file", isValid && mapped.at(5000) == 1250.0 && mapped.find(5001) == mapped.end());
+  }
+  {
+    std::ofstream file(path, std::ios::binary);
+    demidenko::RBTree< int, double >().serialize(file);
+  }
+  demidenko::MappedRBTree< int, double > empty(path);
+  test("empty trees map too", empty.empty() && empty.begin() == empty.end() && !empty.count(0));
+  std::remove(path);
+}
+void testBTreeMap()
+{
+  std::cout << "B-tree map test\n";
+  demidenko::BTreeMap< int, int > tree;
+  std::map< int, int > reference;
+  unsigned seed = 777;
+  bool isValid = true;
+  for (int i = 0; i < 40000 && isValid; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = (seed >> 8) % 4096;
+    if ((seed >> 4) % 3)
+    {
+      isValid = tree.insert(key, i) == reference.insert({ key, i }).second;
+    }
+    else
+    {
+      isValid = tree.erase(key) == (reference.erase(key) != 0);
+    }
+    isValid = isValid && (i % 64 || tree.isBTree());
+  }
+  test("random operations keep B-tree invariants", isValid && tree.isBTree());
+  test("random operations match std::map", std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+  test("size matches std::map", tree.size() == reference.size());
+  std::vector< int > keys;
+  tree.forEachReverse([&](const std::pair< const int, int >& value) {
+    keys.push_back(value.first);
+  });
+  test("forEachReverse visits in reverse order", std::equal(keys.begin(), keys.end(), reference.rbegin(), reference.rend(),
+    [](int key, const std::pair< const int, int >& value) {
+      return key == value.first;
+    }));
+  test("lowerBound and upperBound match std::map",
+    tree.lowerBound(1000)->first == reference.lower_bound(1000)->first
+      && tree.upperBound(2000)->first == reference.upper_bound(2000)->first && tree.lowerBound(5000) == tree.end());
+  test("countInRange", tree.countInRange(100, 300) == static_cast< std::size_t >(std::distance(
+    reference.lower_bound(100), reference.lower_bound(300))));
+
+  demidenko::BTreeMap< int, int > copied(tree);
+  test("copy is equal", copied.isBTree() && std::equal(tree.begin(), tree.end(), copied.begin(), copied.end()));
+  for (const std::pair< const int, int >& value : reference)
+  {
+    copied.erase(value.first);
+  }
+  test("erasing everything empties the tree", copied.empty() && copied.begin() == copied.end() && copied.isBTree());
+  copied[7] = 70;
+  test("reusable after emptying", copied.at(7) == 70 && copied.size() == 1);
+
+  demidenko::BTreeMap< std::string, std::unique_ptr< int >, std::less<>,
+    demidenko::PoolAllocator< std::pair< const std::string, std::unique_ptr< int > > > >
+    owners;
+  for (int i = 0; i < 1000; ++i)
+  {
+    owners.tryEmplace(std::to_string(i), std::make_unique< int >(i));
+  }
+  test("move-only values in a pool", owners.isBTree() && *owners.at(std::string_view("512")) == 512);
+  // Entries one past a leaf: two leaves under an inner root, which the arena of the leaves must not hold.
+  demidenko::BTreeMap< int, int, std::less< int >, demidenko::PoolAllocator< std::pair< const int, int > > > split;
+  for (int i = 0; i < 256 / static_cast< int >(sizeof(std::pair< const int, int >)) + 1; ++i)
+  {
+    split.insert(i, i);
+  }
+  demidenko::PoolUsage leafUsage = split.get_allocator().memoryUsage();
+  demidenko::BTreeMap< int, int, std::less< int >, demidenko::PoolAllocator< std::pair< const int, int > > > moved(
+    std::move(split));
+  split = std::move(moved);
+  split.erase(0);
+  test("inner nodes have a pool of their own", leafUsage.liveBlocks == 2 && leafUsage.fallbacks == 0
+    && split.isBTree() && owners.get_allocator().memoryUsage().fallbacks == 0);
+  test("transparent lookup", owners.count("999") && owners.find(std::string_view("1000")) == owners.end());
+
+  demidenko::BTreeMap< int, ThrowingValue > throwing;
+  for (int i = 0; i < 1000; i += 2)
+  {
+    throwing.tryEmplace(i);
+  }
+  bool isIntact = false;
+  ThrowingValue::budget = 3;
+  for (int i = 1; i < 1000 && !isIntact; i += 2)
+  {
+    std::size_t size = throwing.size();
+    try
+    {
+      throwing.tryEmplace(i);
+    }
+    catch (const std::runtime_error&)
+    {
+      isIntact = throwing.size() == size && !throwing.count(i) && throwing.isBTree();
+    }
+  }
+  ThrowingValue::budget = -1;
+  test("failed split leaves the tree intact", isIntact);
+
+  demidenko::BTreeMap< int, ThrowingValue > source;
+  for (int i = 0; i < 2000; ++i)
+  {
+    source.tryEmplace(i);
+  }
+  bool isRethrown = true;
+  for (int budget : { 0, 1, 40, 500, 1000, 1999 })
+  {
+    bool hasThrown = false;
+    ThrowingValue::budget = budget;
+    try
+    {
+      demidenko::BTreeMap< int, ThrowingValue > copy(source);
+    }
+    catch (const std::runtime_error&)
+    {
+      hasThrown = true;
+    }
+    isRethrown = isRethrown && hasThrown;
+  }
+  ThrowingValue::budget = -1;
+  test("failed copy rethrows", isRethrown && source.size() == 2000 && source.isBTree());
+
+  bool isUnchanged = false;
+  ThrowingValue::budget = 2;
+  for (int i = 0; i < 2000 && !isUnchanged; i += 3)
+  {
+    std::size_t size = source.size();
+    try
+    {
+      source.erase(i);
+    }
+    catch (const std::runtime_error&)
+    {
+      isUnchanged = source.size() == size && source.count(i) && source.isBTree();
+    }
+  }
+  ThrowingValue::budget = -1;
+  for (int i = 0; i < 2000; ++i)
+  {
+    source.erase(i);
+  }
+  test("failed erase leaves the map unchanged", isUnchanged && source.isBTree() && source.begin() == source.end());
+}
+template < class K >
+bool matchesUpperBound(const std::vector< K >& keys)
+{
+  for (std::size_t n = 0; n <= keys.size(); ++n)
+  {
+    for (const K& key : keys)
+    {
+      std::size_t expected = std::upper_bound(keys.begin(), keys.begin() + n, key) - keys.begin();
+      if (demidenko::detail::countNotGreater(keys.data(), n, key) != expected)
+      {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+void testSimdSearch()
+{
+  std::cout << "SIMD key search test\n";
+  test("signed keys", matchesUpperBound(std::vector< int >{ -2000000000, -7, -1, 0, 3, 3, 9, 17, 40, 41, 100, 2000000000 }));
+  test("unsigned keys", matchesUpperBound(std::vector< unsigned >{ 0, 1, 5, 8, 100, 0x7fffffffu, 0x80000000u, 0x80000001u, 0xfffffff0u, 0xffffffffu }));
+  test("64-bit keys",
+    matchesUpperBound(std::vector< long long >{ -(1LL << 62), -5, 0, 1, 1LL << 40, 1LL << 62 })
+      && matchesUpperBound(std::vector< unsigned long long >{ 0, 5, 1ULL << 63, (1ULL << 63) + 1, ~0ULL }));
+  test("floating keys",
+    matchesUpperBound(std::vector< float >{ -1e30f, -2.5f, -0.0f, 0.5f, 1.0f, 3.25f, 7.0f, 8.0f, 1e30f })
+      && matchesUpperBound(std::vector< double >{ -1e300, -3.5, 0.0, 0.25, 2.0, 9.75, 1e300 }));
+  test("only plain less is vectorized",
+    demidenko::detail::IsSimdSearchable< int, std::less< int > >::value
+        == (demidenko::detail::SimdLanes< int >::COUNT != 0)
+      && !demidenko::detail::IsSimdSearchable< int, std::greater< int > >::value
+      && !demidenko::detail::IsSimdSearchable< std::string, std::less< std::string > >::value);
+
+  demidenko::BTreeMap< unsigned, int > tree;
+  demidenko::BTreeMap< double, int, std::greater< double > > descending;
+  std::map< unsigned, int > reference;
+  unsigned seed = 99;
+  for (int i = 0; i < 20000; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    unsigned key = seed & 0xfff0000fu;
+    if ((seed >> 5) % 4)
+    {
+      tree.insert(key, i);
+      descending.insert(key, i);
+      reference.insert({ key, i });
+    }
+    else
+    {
+      tree.erase(key);
+      descending.erase(key);
+      reference.erase(key);
+    }
+  }
+  test("vector search matches std::map", tree.isBTree() && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+  test("scalar search with std::greater", descending.isBTree() && descending.size() == reference.size()
+    && descending.begin()->first == reference.rbegin()->first);
+}
+void testFreeze()
+{
+  std::cout << "Frozen snapshot test\n";
+  for (int n : { 0, 1, 2, 3, 7, 8, 100, 1023, 1024, 1025 })
+  {
+    demidenko::RBTree< int, int > tree;
+    std::map< int, int > reference;
+    for (int i = 0; i < n; ++i)
+    {
+      tree.insert(i * 3, i);
+      reference.insert({ i * 3, i });
+    }
+    demidenko::FrozenRBTree< int, int > frozen = tree.freeze();
+    bool isValid = frozen.size() == reference.size()
+      && std::equal(frozen.begin(), frozen.end(), reference.begin(), reference.end())
+      && std::equal(std::make_reverse_iterator(frozen.end()), std::make_reverse_iterator(frozen.begin()),
+        reference.rbegin(), reference.rend());
+    for (int key = -2; key <= 3 * n + 1 && isValid; ++key)
+    {
+      std::map< int, int >::iterator lower = reference.lower_bound(key);
+      std::map< int, int >::iterator upper = reference.upper_bound(key);
+      isValid = frozen.count(key) == static_cast< int >(reference.count(key))
+        && (lower == reference.end() ? frozen.lowerBound(key) == frozen.end() : frozen.lowerBound(key)->first == lower->first)
+        && (upper == reference.end() ? frozen.upperBound(key) == frozen.end() : frozen.upperBound(key)->first == upper->first)
+        && (!reference.count(key) || frozen.at(key) == key / 3);
+    }
+    if (!isValid)
+    {
+      std::cout << "n = " << n << ": ";
+    }
+    test("frozen tree matches std::map", isValid);
+  }
+  demidenko::RBTree< std::string, int, std::less<> > words;
+  words.insert("pear", 1);
+  words.insert("apple", 2);
+  words.insert("fig", 3);
+  demidenko::FrozenRBTree< std::string, int, std::less<> > frozenWords = words.freeze();
+  demidenko::FrozenRBTree< std::string, int, std::less<> > copied(frozenWords);
+  test("frozen transparent lookup", copied.at(std::string_view("fig")) == 3 && copied.count("apple") && !copied.count("kiwi"));
+  bool hasThrown = false;
+  try
+  {
+    copied.at("kiwi");
+  }
+  catch (const std::out_of_range&)
+  {
+    hasThrown = true;
+  }
+  test("frozen at throws on missing key", hasThrown);
+  std::vector< std::pair< const int, int > > unsorted{ { 1, 0 }, { 3, 0 }, { 2, 0 } };
+  hasThrown = false;
+  try
+  {
+    demidenko::FrozenRBTree< int, int > bad(unsorted.begin(), unsorted.end());
+  }
+  catch (const std::invalid_argument&)
+  {
+    hasThrown = true;
+  }
+  test("frozen tree rejects unsorted range", hasThrown);
+  demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >, LazyStatsOptions > lazy;
+  for (int i = 0; i < 100; ++i)
+  {
+    lazy.insert(i, i);
+  }
+  for (int i = 0; i < 100; i += 3)
+  {
+    lazy.erase(i);
+  }
+  demidenko::FrozenRBTree< int, int > frozenLive = lazy.freeze();
+  test("frozen tree skips tombstones", lazy.tombstones() && frozenLive.size() == lazy.size()
+    && std::equal(frozenLive.begin(), frozenLive.end(), lazy.begin(), lazy.end()));
+}
+void testFindBatch()
+{
+  std::cout << "Batched lookup test\n";
+  demidenko::RBTree< int, int > tree;
+  for (int i = 0; i < 5000; ++i)
+  {
+    tree.insert((i * 7919) % 10007, i);
+  }
+  std::vector< int > keys;
+  for (int i = 0; i < 1000; ++i)
+  {
+    keys.push_back((i * 389) % 10100 - 50);
+  }
+  std::vector< demidenko::RBTree< int, int >::iterator > found;
+  tree.findBatch(keys.begin(), keys.end(), std::back_inserter(found));
+  bool isValid = found.size() == keys.size();
+  for (std::size_t i = 0; i < keys.size() && isValid; ++i)
+  {
+    isValid = found[i] == tree.find(keys[i]);
+  }
+  test("findBatch matches find", isValid);
+  found[0] = tree.end();
+  found.erase(tree.findBatch(keys.begin() + 1, keys.begin() + 2, found.begin()), found.end());
+  test("findBatch returns the end of the output", found.size() == 1 && found[0] == tree.find(keys[1]));
+
+  const demidenko::RBTree< std::string, int, std::less<> > words = []() {
+    demidenko::RBTree< std::string, int, std::less<> > result;
+    result.insert("fig", 1);
+    result.insert("plum", 2);
+    return result;
+  }();
+  const char* queries[]{ "plum", "kiwi", "fig" };
+  std::vector< demidenko::RBTree< std::string, int, std::less<> >::const_iterator > wordsFound;
+  words.findBatch(std::begin(queries), std::end(queries), std::back_inserter(wordsFound));
+  test("findBatch with transparent keys",
+    wordsFound.size() == 3 && wordsFound[0]->second == 2 && wordsFound[1] == words.end() && wordsFound[2]->second == 1);
+  demidenko::RBTree< int, int > empty;
+  found.clear();
+  empty.findBatch(keys.begin(), keys.end(), std::back_inserter(found));
+  test("findBatch on empty tree", found.size() == keys.size() && found.back() == empty.end());
+}
+void testBatchUpdates()
+{
+  std::cout << "Batched insert and erase test\n";
+  using OrderedTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::OrderStatisticOptions >;
+  OrderedTree tree;
+  std::map< int, int > reference;
+  unsigned seed = 2024;
+  bool isValid = true;
+  for (std::size_t batchSize : { 1, 5, 40, 3000, 10, 20000, 7, 100 })
+  {
+    std::vector< std::pair< int, int > > batch;
+    for (std::size_t i = 0; i < batchSize; ++i)
+    {
+      seed = seed * 1103515245 + 12345;
+      batch.push_back({ static_cast< int >((seed >> 8) % 30000), static_cast< int >(i) });
+    }
+    std::size_t inserted = 0;
+    for (const std::pair< int, int >& value : batch)
+    {
+      inserted += reference.insert(value).second;
+    }
+    isValid = isValid && tree.insertBatch(batch.begin(), batch.end()) == inserted && tree.isRBTree()
+      && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end());
+    std::vector< int > keys;
+    for (std::size_t i = 0; i < batchSize / 2; ++i)
+    {
+      seed = seed * 1103515245 + 12345;
+      keys.push_back(static_cast< int >((seed >> 8) % 30000));
+    }
+    std::size_t erased = 0;
+    for (int key : keys)
+    {
+      erased += reference.erase(key);
+    }
+    isValid = isValid && tree.eraseBatch(keys.begin(), keys.end()) == erased && (tree.empty() || tree.isRBTree())
+      && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end());
+  }
+  test("batches match std::map", isValid && tree.size() == reference.size());
+  test("batches keep subtree sizes", tree.nth(100)->first == std::next(reference.begin(), 100)->first);
+  std::vector< int > everything;
+  for (const std::pair< const int, int >& value : reference)
+  {
+    everything.push_back(value.first);
+  }
+  test("erasing everything", tree.eraseBatch(everything.begin(), everything.end()) == reference.size() && tree.empty());
+  std::vector< std::pair< int, int > > large;
+  for (int i = 0; i < 300000; ++i)
+  {
+    large.push_back({ (i * 4999) % 300000, i });
+  }
+  test("large batch", tree.insertBatch(large.begin(), large.end()) == large.size() && tree.isRBTree()
+    && tree.nth(123456)->first == 123456);
+
+  demidenko::RBTree< int, ThrowingValue > throwing;
+  for (int i = 0; i < 100; ++i)
+  {
+    throwing.tryEmplace(i * 2);
+  }
+  std::vector< std::pair< int, ThrowingValue > > values(50);
+  for (std::size_t i = 0; i < values.size(); ++i)
+  {
+    values[i].first = static_cast< int >(i * 2 + 1);
+  }
+  ThrowingValue::budget = static_cast< int >(values.size() / 2);
+  bool hasThrown = false;
+  try
+  {
+    throwing.insertBatch(values.begin(), values.end());
+  }
+  catch (const std::runtime_error&)
+  {
+    hasThrown = true;
+  }
+  ThrowingValue::budget = -1;
+  test("failed batch inserts nothing", hasThrown && throwing.size() == 100 && throwing.isRBTree() && !throwing.count(1));
+}
+template < class Tree >
+bool matchesMap(const Tree& tree, const std::map< int, int >& reference)
+{
+  if (tree.size() != reference.size() || !std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()))
+  {
+    return false;
+  }
+  if (tree.empty())
+  {
+    return true;
+  }
+  // Walks back through the parent links, checking the subtree sizes on the way.
+  auto current = tree.nth(tree.size() - 1);
+  std::size_t index = reference.size();
+  for (auto expected = reference.rbegin(); expected != reference.rend(); ++expected)
+  {
+    --index;
+    if (current->first != expected->first || tree.rank(expected->first) != index)
+    {
+      return false;
+    }
+    if (index)
+    {
+      --current;
+    }
+  }
+  return tree.isRBTree();
+}
+void testSetOperations()
+{
+  std::cout << "Join, split and set operations test\n";
+  using OrderedTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::OrderStatisticOptions >;
+  unsigned seed = 77;
+  auto randomMap = [&](std::size_t n, int range, int value) {
+    std::map< int, int > result;
+    while (result.size() < n)
+    {
+      seed = seed * 1103515245 + 12345;
+      result.insert({ static_cast< int >((seed >> 8) % range), value });
+    }
+    return result;
+  };
+  auto makeTree = [](const std::map< int, int >& values) {
+    OrderedTree tree;
+    tree.assignSorted(values.begin(), values.end());
+    return tree;
+  };
+
+  std::map< int, int > reference = randomMap(5000, 100000, 0);
+  OrderedTree tree = makeTree(reference);
+  bool isValid = true;
+  for (int key : { 50000, -1, 200000, reference.begin()->first, std::next(reference.begin(), 1234)->first })
+  {
+    OrderedTree right = tree.split(key);
+    std::map< int, int > referenceLeft(reference.begin(), reference.lower_bound(key));
+    std::map< int, int > referenceRight(reference.lower_bound(key), reference.end());
+    isValid = isValid && matchesMap(tree, referenceLeft) && matchesMap(right, referenceRight);
+    tree.join(std::move(right));
+    isValid = isValid && right.empty() && matchesMap(tree, reference);
+  }
+  test("split and join back", isValid);
+
+  OrderedTree small = makeTree(randomMap(3, 10, 1));
+  OrderedTree large = makeTree(randomMap(3000, 10000, 2));
+  small.split(small.begin()->first + 1);
+  int pivot = small.begin()->first + 1;
+  OrderedTree right = large.split(pivot + 1);
+  std::map< int, int > expected(small.begin(), small.end());
+  expected.insert(right.begin(), right.end());
+  expected[pivot] = 3;
+  small.join({ pivot, 3 }, std::move(right));
+  test("join around a pivot with uneven heights", matchesMap(small, expected));
+  bool hasThrown = false;
+  try
+  {
+    OrderedTree overlapping = makeTree(expected);
+    small.join(std::move(overlapping));
+  }
+  catch (const std::invalid_argument&)
+  {
+    hasThrown = true;
+  }
+  test("joining overlapping trees throws", hasThrown && matchesMap(small, expected));
+
+  for (unsigned nThreads : { 1u, 4u })
+  {
+    std::map< int, int > lhs = randomMap(20000, 60000, 1);
+    std::map< int, int > rhs = randomMap(nThreads == 1 ? 300 : 30000, 60000, 2);
+    demidenko::ParallelPolicy policy{ nThreads, 256 };
+    std::map< int, int > united = lhs;
+    united.insert(rhs.begin(), rhs.end());
+    std::map< int, int > common;
+    std::map< int, int > rest;
+    for (const std::pair< const int, int >& value : lhs)
+    {
+      (rhs.count(value.first) ? common : rest).insert(value);
+    }
+    OrderedTree unionTree = makeTree(lhs);
+    unionTree.unionWith(makeTree(rhs), policy);
+    OrderedTree intersectionTree = makeTree(lhs);
+    intersectionTree.intersectWith(makeTree(rhs), policy);
+    OrderedTree differenceTree = makeTree(lhs);
+    differenceTree.difference(makeTree(rhs), policy);
+    std::string threads = std::to_string(nThreads);
+    test(("union on " + threads + " threads").c_str(), matchesMap(unionTree, united));
+    test(("intersection on " + threads + " threads").c_str(), matchesMap(intersectionTree, common));
+    test(("difference on " + threads + " threads").c_str(), matchesMap(differenceTree, rest));
+  }
+  OrderedTree empty;
+  empty.unionWith(makeTree(reference));
+  OrderedTree nothing = makeTree(reference);
+  nothing.intersectWith(OrderedTree());
+  demidenko::RBTree< int, int > plain;
+  plain.assignSorted(reference.begin(), reference.end());
+  demidenko::RBTree< int, int > evens;
+  for (int i = 0; i < 100000; i += 2)
+  {
+    evens.insert(i, 1);
+  }
+  plain.difference(std::move(evens));
+  std::size_t odd = static_cast< std::size_t >(std::count_if(reference.begin(), reference.end(), [](const std::pair< const int, int >& value) {
+    return value.first % 2 != 0;
+  }));
+  test("set operations with empty trees", matchesMap(empty, reference) && nothing.empty());
+  test("set operations count without subtree sizes", plain.size() == odd && plain.isRBTree()
+    && std::all_of(plain.begin(), plain.end(), [](const std::pair< const int, int >& value) {
+      return value.first % 2 != 0;
+    }));
+}
+void testNodeHandles()
+{
+  std::cout << "Node handle test\n";
+  using StatsTree = demidenko::RBTree< int, ThrowingValue, std::less< int >,
+    std::allocator< std::pair< const int, ThrowingValue > >, demidenko::StatsOptions >;
+  StatsTree source;
+  StatsTree target;
+  for (int i = 0; i < 100; ++i)
+  {
+    source.tryEmplace(i);
+  }
+  target.tryEmplace(50);
+  source.resetStats();
+  target.resetStats();
+  ThrowingValue::budget = 0;
+  StatsTree::node_type missing = source.extract(1000);
+  StatsTree::node_type node = source.extract(10);
+  bool isMoved = missing.empty() && node && node.key() == 10 && target.insert(std::move(node)).second && node.empty();
+  node = source.extract(source.find(50));
+  std::pair< StatsTree::iterator, bool > refused = target.insert(std::move(node));
+  isMoved = isMoved && !refused.second && refused.first->first == 50 && node && node.key() == 50;
+  source.insert(std::move(node));
+  target.merge(source);
+  ThrowingValue::budget = -1;
+  test("nodes move without allocations or copies", isMoved && target.size() == 100 && source.size() == 1
+    && source.count(50) && target.stats().allocations == 0 && source.stats().deallocations == 0 && target.isRBTree()
+    && source.isRBTree());
+
+  using OrderedTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::OrderStatisticOptions >;
+  OrderedTree left;
+  OrderedTree right;
+  std::map< int, int > reference;
+  std::map< int, int > rest;
+  for (int i = 0; i < 3000; ++i)
+  {
+    int key = (i * 7919) % 3000;
+    if (key % 3)
+    {
+      left.insert(key, 1);
+      reference.insert({ key, 1 });
+    }
+    if (key % 2)
+    {
+      right.insert(key, 2);
+      (key % 3 ? rest : reference).insert({ key, 2 });
+    }
+  }
+  OrderedTree::node_type extracted = left.extract(1);
+  extracted.mapped() = 3;
+  left.insert(std::move(extracted));
+  reference[1] = 3;
+  left.merge(right);
+  test("merge keeps present keys", matchesMap(left, reference) && matchesMap(right, rest));
+
+  using PoolTree = demidenko::RBTree< int, int, std::less< int >, demidenko::PoolAllocator< std::pair< const int, int > > >;
+  PoolTree pooled;
+  PoolTree otherPool;
+  for (int i = 0; i < 10; ++i)
+  {
+    pooled.insert(i, i);
+    otherPool.insert(i + 5, -i);
+  }
+  pooled.insert(otherPool.extract(14));
+  pooled.merge(otherPool);
+  test("unequal allocators move values instead", pooled.size() == 15 && otherPool.size() == 5 && pooled.at(14) == -9
+    && pooled.at(10) == -5 && pooled.at(5) == 5 && pooled.isRBTree());
+}
+void testIteratorErase()
+{
+  std::cout << "Erase by iterator test\n";
+  using OrderedTree = demidenko::RBTree< int, int, std::less< int >, std::allocator< std::pair< const int, int > >,
+    demidenko::OrderStatisticOptions >;
+  OrderedTree tree;
+  std::map< int, int > reference;
+  for (int i = 0; i < 4000; ++i)
+  {
+    int key = (i * 7919) % 4000;
+    tree.insert(key, i);
+    reference.insert({ key, i });
+  }
+  bool isValid = true;
+  for (OrderedTree::iterator current = tree.begin(); current != tree.end();)
+  {
+    if (current->first % 5 == 0)
+    {
+      int next = current->first + 1;
+      current = tree.erase(current);
+      isValid = isValid && current->first == next;
+    }
+    else
+    {
+      ++current;
+    }
+  }
+  for (std::map< int, int >::iterator current = reference.begin(); current != reference.end();)
+  {
+    current = current->first % 5 == 0 ? reference.erase(current) : std::next(current);
+  }
+  test("erase by iterator returns the next one", isValid && matchesMap(tree, reference));
+
+  unsigned seed = 3;
+  isValid = true;
+  for (int i = 0; i < 200 && isValid && !reference.empty(); ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int lo = static_cast< int >((seed >> 8) % 4200) - 100;
+    int length = static_cast< int >((seed >> 4) % (i % 2 ? 10 : 600));
+    OrderedTree::iterator last = tree.erase(tree.lowerBound(lo), tree.lowerBound(lo + length));
+    std::map< int, int >::iterator expected = reference.erase(reference.lower_bound(lo), reference.lower_bound(lo + length));
+    isValid = (expected == reference.end() ? last == tree.end() : last->first == expected->first) && matchesMap(tree, reference);
+  }
+  test("range erase matches std::map", isValid);
+  tree.erase(tree.nth(tree.size() / 2), tree.end());
+  reference.erase(std::next(reference.begin(), static_cast< std::ptrdiff_t >(reference.size() / 2)), reference.end());
+  isValid = matchesMap(tree, reference);
+  tree.erase(tree.begin(), tree.begin());
+  test("range erase to the end", isValid && matchesMap(tree, reference));
+  test("range erase of everything", tree.erase(tree.begin(), tree.end()) == tree.end() && tree.empty());
+}
+void testConcurrentTree()
+{
+  std::cout << "Concurrent tree test\n";
+  demidenko::ConcurrentRBTree< int, int > tree;
+  std::map< int, int > reference;
+  unsigned seed = 99;
+  bool isValid = true;
+  for (int i = 0; i < 20000; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = static_cast< int >((seed >> 8) % 3000);
+    if (seed & 0x10000)
+    {
+      isValid = isValid && tree.insert(key, i) == reference.insert({ key, i }).second;
+    }
+    else
+    {
+      isValid = isValid && tree.erase(key) == reference.erase(key);
+    }
+  }
+  demidenko::ConcurrentRBTree< int, int >::Reader reader = tree.read();
+  test("updates match std::map", isValid && tree.size() == reference.size() && tree.isRBTree()
+    && std::equal(reader.begin(), reader.end(), reference.begin(), reference.end()));
+  test("lookups of a reader", reader.count(reference.begin()->first) && !reader.count(-1)
+    && reader.lowerBound(1500)->first == reference.lower_bound(1500)->first
+    && reader.upperBound(1500)->first == reference.upper_bound(1500)->first
+    && reader.find(reference.rbegin()->first)->first == reference.rbegin()->first && reader.find(3000) == reader.end());
+
+  std::map< int, int > snapshot = reference;
+  for (int key = 0; key < 3000; key += 3)
+  {
+    tree.erase(key);
+    reference.erase(key);
+  }
+  tree.insert(5000, 1);
+  reference.insert({ 5000, 1 });
+  std::size_t nRetired = tree.retiredCount();
+  test("a reader keeps its snapshot", std::equal(reader.begin(), reader.end(), snapshot.begin(), snapshot.end()));
+  {
+    demidenko::ConcurrentRBTree< int, int >::Reader done = std::move(reader);
+  }
+  tree.reclaim();
+  test("retired nodes wait for older readers", nRetired > 0 && tree.retiredCount() == 0);
+  demidenko::ConcurrentRBTree< int, int >::Reader current = tree.read();
+  test("new readers see the latest tree", std::equal(current.begin(), current.end(), reference.begin(), reference.end()));
+  for (int i = 0; i < 40000; ++i)
+  {
+    tree.insert(10000 + i, i);
+  }
+  test("a pinned reader holds back the retired nodes", tree.retiredCount() > 40000 && current.count(5000)
+    && !current.count(10000) && tree.size() == reference.size() + 40000);
+  for (int i = 0; i < 40000; ++i)
+  {
+    tree.erase(10000 + i);
+  }
+
+  std::atomic< bool > isDone{ false };
+  std::atomic< int > nBroken{ 0 };
+  std::vector< std::thread > readers;
+  for (int i = 0; i < 4; ++i)
+  {
+    readers.emplace_back([&] {
+      while (!isDone)
+      {
+        demidenko::ConcurrentRBTree< int, int >::Reader view = tree.read();
+        int previous = -1;
+        for (const std::pair< const int, int >& value : view)
+        {
+          nBroken += value.first <= previous;
+          previous = value.first;
+        }
+        nBroken += view.at(5000) != 1;
+      }
+    });
+  }
+  for (int i = 0; i < 5000; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = static_cast< int >((seed >> 8) % 3000);
+    (seed & 0x10000) ? static_cast< void >(tree.insert(key, i)) : static_cast< void >(tree.erase(key));
+  }
+  isDone = true;
+  for (std::thread& thread : readers)
+  {
+    thread.join();
+  }
+  test("readers run along a writer", nBroken == 0 && tree.isRBTree());
+
+  demidenko::ConcurrentRBTree< int, ThrowingValue > throwing;
+  for (int i = 0; i < 100; ++i)
+  {
+    throwing.emplace(i * 2);
+  }
+  bool hasThrown = false;
+  std::size_t nInserted = 0;
+  ThrowingValue::budget = 30;
+  try
+  {
+    for (int i = 1; i < 100; i += 2, ++nInserted)
+    {
+      throwing.insert(i, ThrowingValue());
+    }
+  }
+  catch (const std::runtime_error&)
+  {
+    hasThrown = true;
+  }
+  ThrowingValue::budget = -1;
+  demidenko::ConcurrentRBTree< int, ThrowingValue >::Reader view = throwing.read();
+  test("failed update publishes nothing", hasThrown && throwing.size() == 100 + nInserted && throwing.isRBTree()
+    && static_cast< std::size_t >(std::distance(view.begin(), view.end())) == throwing.size()
+    && !view.count(static_cast< int >(nInserted * 2 + 1)));
+}
+void testPersistentTree()
+{
+  std::cout << "Persistent tree test\n";
+  demidenko::PersistentRBTree< int, int > tree;
+  std::map< int, int > reference;
+  std::vector< demidenko::PersistentRBTree< int, int > > versions;
+  std::vector< std::map< int, int > > expected;
+  unsigned seed = 5;
+  bool isValid = true;
+  for (int i = 0; i < 20000; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = static_cast< int >((seed >> 8) % 3000);
+    if (seed & 0x10000)
+    {
+      isValid = isValid && tree.insert(key, i) == reference.insert({ key, i }).second;
+    }
+    else
+    {
+      isValid = isValid && tree.erase(key) == reference.erase(key);
+    }
+    if (i % 2000 == 0)
+    {
+      versions.push_back(tree.snapshot());
+      expected.push_back(reference);
+    }
+  }
+  test("updates match std::map", isValid && tree.size() == reference.size() && tree.isRBTree()
+    && std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+  bool isKept = true;
+  for (std::size_t i = 0; i < versions.size(); ++i)
+  {
+    isKept = isKept && versions[i].size() == expected[i].size() && versions[i].isRBTree()
+      && std::equal(versions[i].begin(), versions[i].end(), expected[i].begin(), expected[i].end());
+  }
+  test("old versions are kept", isKept);
+  versions.erase(versions.begin() + 3);
+  versions.erase(versions.begin());
+  versions.pop_back();
+  expected.erase(expected.begin() + 3);
+  expected.erase(expected.begin());
+  expected.pop_back();
+  versions[1].erase(versions[1].begin()->first);
+  expected[1].erase(expected[1].begin());
+  versions[2] = versions[0];
+  expected[2] = expected[0];
+  versions[0].insert(-1, 0);
+  expected[0].insert({ -1, 0 });
+  isKept = std::equal(tree.begin(), tree.end(), reference.begin(), reference.end());
+  for (std::size_t i = 0; i < versions.size(); ++i)
+  {
+    isKept = isKept && versions[i].isRBTree()
+      && std::equal(versions[i].begin(), versions[i].end(), expected[i].begin(), expected[i].end());
+  }
+  test("versions change apart", isKept && tree.lowerBound(1500)->first == reference.lower_bound(1500)->first
+    && tree.at(reference.rbegin()->first) == reference.rbegin()->second);
+
+  demidenko::PersistentRBTree< int, ThrowingValue > throwing;
+  for (int i = 0; i < 10000; ++i)
+  {
+    throwing.emplace(i * 2);
+  }
+  ThrowingValue::budget = 1000000;
+  demidenko::PersistentRBTree< int, ThrowingValue > copy = throwing;
+  int nCopied = 1000000 - ThrowingValue::budget;
+  throwing.erase(5000);
+  throwing.emplace(5001);
+  int nPathCopied = 1000000 - ThrowingValue::budget - nCopied;
+  ThrowingValue::budget = -1;
+  test("snapshots copy nothing, updates their paths", nCopied == 0 && nPathCopied < 200 && copy.count(5000)
+    && !copy.count(5001) && throwing.count(5001) && !throwing.count(5000) && throwing.isRBTree());
+  bool hasThrown = false;
+  ThrowingValue::budget = 5;
+  try
+  {
+    throwing.erase(7000);
+  }
+  catch (const std::runtime_error&)
+  {
+    hasThrown = true;
+  }
+  ThrowingValue::budget = -1;
+  test("failed update leaves the version as it was", hasThrown && throwing.count(7000) && throwing.size() == 10000
+    && throwing.isRBTree());
+
+  using PoolVersion = demidenko::PersistentRBTree< int, int, std::less< int >,
+    demidenko::PoolAllocator< std::pair< const int, int > > >;
+  PoolVersion survivor;
+  PoolVersion assigned;
+  {
+    PoolVersion source(demidenko::PoolAllocator< std::pair< const int, int > >(64));
+    for (int i = 0; i < 1000; ++i)
+    {
+      source.insert(i, i);
+    }
+    PoolVersion snapshot(source);
+    survivor = snapshot;
+    assigned = source;
+    source.erase(500);
+  }
+  survivor.insert(1000, 1000);
+  assigned.erase(0);
+  test("pooled snapshots outlive their source", survivor.get_allocator() == assigned.get_allocator()
+    && survivor.size() == 1001 && survivor.count(500) && assigned.size() == 999 && survivor.isRBTree()
+    && assigned.isRBTree());
+}
+void testShardedTree()
+{
+  std::cout << "Sharded tree test\n";
+  demidenko::ShardedRBTree< int, int > tree(8);
+  std::map< int, int > reference;
+  unsigned seed = 17;
+  bool isValid = true;
+  for (int i = 0; i < 20000; ++i)
+  {
+    seed = seed * 1103515245 + 12345;
+    int key = static_cast< int >((seed >> 8) % 3000);
+    if (seed & 0x10000)
+    {
+      isValid = isValid && tree.insert(key, i) == reference.insert({ key, i }).second;
+    }
+    else
+    {
+      isValid = isValid && tree.erase(key) == static_cast< bool >(reference.erase(key));
+    }
+  }
+  std::vector< std::pair< const int, int > > merged;
+  tree.forEach([&](const std::pair< const int, int >& value) {
+    merged.push_back(value);
+  });
+  test("updates match std::map", isValid && tree.shardCount() == 8 && tree.size() == reference.size()
+    && std::equal(merged.begin(), merged.end(), reference.begin(), reference.end()));
+  test("lookups find their shard", tree.count(reference.begin()->first) && !tree.count(-1)
+    && tree.at(reference.rbegin()->first) == reference.rbegin()->second);
+
+  std::vector< std::pair< int, int > > batch;
+  std::vector< int > keys;
+  for (int i = 0; i < 3000; i += 2)
+  {
+    batch.emplace_back(i, -i);
+    keys.push_back(i + 1);
+  }
+  std::size_t nInserted = tree.insertBatch(batch.begin(), batch.end());
+  std::size_t nOld = reference.size();
+  reference.insert(batch.begin(), batch.end());
+  isValid = nInserted == reference.size() - nOld;
+  std::size_t nErased = tree.eraseBatch(keys.begin(), keys.end());
+  nOld = reference.size();
+  for (int key : keys)
+  {
+    reference.erase(key);
+  }
+  merged.clear();
+  tree.forEach([&](const std::pair< const int, int >& value) {
+    merged.push_back(value);
+  });
+  test("batches are split by shard", isValid && nErased == nOld - reference.size()
+    && std::equal(merged.begin(), merged.end(), reference.begin(), reference.end()));
+
+  tree.clear();
+  std::vector< std::thread > writers;
+  for (int t = 0; t < 4; ++t)
+  {
+    writers.emplace_back([&tree, t] {
+      for (int i = t; i < 40000; i += 4)
+      {
+        tree.insert(i, t);
+        if (i % 3 == 0)
+        {
+          tree.erase(i);
+        }
+      }
+    });
+  }
+  for (std::thread& thread : writers)
+  {
+    thread.join();
+  }
+  int previous = -1;
+  bool isComplete = true;
+  tree.forEach([&](const std::pair< const int, int >& value) {
+    isComplete = isComplete && value.first % 3 != 0 && value.second == value.first % 4 && value.first > previous;
+    previous = value.first;
+  });
+  test("writers run in parallel", isComplete && tree.size() == 40000 - 13334 && tree.count(39998) && !tree.count(39999));
+}
 int main()
 {
   testTree();
@@ -211,5 +2238,65 @@ int main()
   testDestructorAfterErase();
   std::cout << '\n';
   testIterators();
+  std::cout << '\n';
+  testPoolAllocator();
+  std::cout << '\n';
+  testTransparentLookup();
+  std::cout << '\n';
+  testSingleComparisonDescent();
+  std::cout << '\n';
+  testRandomOperations();
+  std::cout << '\n';
+  testEmplaceAndHints();
+  std::cout << '\n';
+  testAssignSorted();
+  std::cout << '\n';
+  testCopy();
+  std::cout << '\n';
+  testOrderStatistic();
+  std::cout << '\n';
+  testRanges();
+  std::cout << '\n';
+  testForEach();
+  std::cout << '\n';
+  testParallelTraversal();
+  std::cout << '\n';
+  testMoveAndSwap();
+  std::cout << '\n';
+  testCompactNodes();
+  std::cout << '\n';
+  testStats();
+  std::cout << '\n';
+  testFingerSearch();
+  std::cout << '\n';
+  testTombstones();
+  std::cout << '\n';
+  testAugmentation();
+  std::cout << '\n';
+  testMemoryUsage();
+  std::cout << '\n';
+  testSerialization();
+  std::cout << '\n';
+  testBTreeMap();
+  std::cout << '\n';
+  testSimdSearch();
+  std::cout << '\n';
+  testFreeze();
+  std::cout << '\n';
+  testFindBatch();
+  std::cout << '\n';
+  testBatchUpdates();
+  std::cout << '\n';
+  testSetOperations();
+  std::cout << '\n';
+  testNodeHandles();
+  std::cout << '\n';
+  testIteratorErase();
+  std::cout << '\n';
+  testConcurrentTree();
+  std::cout << '\n';
+  testPersistentTree();
+  std::cout << '\n';
+  testShardedTree();
   return 0;
 }